@@ -1,6 +1,8 @@
 #include <stdio.h>
 #include <cuda_runtime.h>
 #include <cufft.h>
+#include <cufftXt.h>
+#include <cuda_fp16.h>
 #include <nvToolsExt.h>
 #include <stdbool.h>
 #include <unistd.h>
@@ -11,13 +13,31 @@
 #include <chrono>
 #include <algorithm>
 #include <iostream>
+#include <functional>
+#include <thread>
+#include <mutex>
+#include <condition_variable>
+#include <deque>
+#include <vector>
+#include <climits>
+#include <cstring>
+#include <cmath>
+#include <map>
+#include <csignal>
 
 #include "azimuthal_average.cuh"
 #include "debug.hpp"
 #include "constants.hpp"
 #include "video_reader.hpp"
+#include "gpu_decoder.hpp"
 
 #include "DDM_kernel.cuh"
+#include "DDM.hpp"
+#include "isf_store.hpp"
+#include "isf_maps.hpp"
+#include "model_fit.cuh"
+#include "instrumentation.hpp"
+#include "checkpoint.hpp"
 
 
 // Function to swap two pointers
@@ -37,6 +57,98 @@ template <class T> inline void rotateThreePtr(T*& A, T*& B, T*& C) {
 }
 
 
+///////////////////////////////////////////////////////
+// Per-stage timing of the benchmark suite. Every timed piece
+// of work is bracketed by a pair of events on its stream and
+// the pairs are only read once the run has finished, so the
+// timing does not synchronise the pipeline. Normal runs pass
+// a NULL timer.
+///////////////////////////////////////////////////////
+struct stage_timer_struct {
+    std::deque<cudaEvent_t> marks[STAGE_COUNT];  // start / stop event pairs not yet collected
+    double bytes[STAGE_COUNT];
+    double flops[STAGE_COUNT];
+    double host_ms[STAGE_COUNT];                 // stages timed on host
+    double drained_ms[STAGE_COUNT];              // GPU time of the pairs already collected
+};
+
+
+// Runs [work] in an NVTX range of the stage and, with a timer, between a pair of events on [stream]
+template <typename F>
+inline void timeStage(stage_timer_struct *timer, int stage, cudaStream_t stream, double bytes, double flops, F work) {
+    profileRangePush(stage, stageName(stage));
+
+    if (timer == NULL) {
+        work();
+        profileRangePop();
+        return;
+    }
+
+    cudaEvent_t start, stop;
+    gpuErrorCheck(cudaEventCreate(&start));
+    gpuErrorCheck(cudaEventCreate(&stop));
+
+    gpuErrorCheck(cudaEventRecord(start, stream));
+    work();
+    gpuErrorCheck(cudaEventRecord(stop, stream));
+
+    timer->marks[stage].push_back(start);
+    timer->marks[stage].push_back(stop);
+    timer->bytes[stage] += bytes;
+    timer->flops[stage] += flops;
+
+    profileRangePop();
+}
+
+
+// Moves the times of the event pairs that have completed into drained_ms and the metrics,
+// never waits. Keeps the number of live events bounded on long (live) runs
+void drainStageTimes(stage_timer_struct *timer) {
+    if (timer == NULL)
+        return;
+
+    for (int stage = 0; stage < STAGE_COUNT; stage++) {
+        std::deque<cudaEvent_t> &marks = timer->marks[stage];
+
+        while (marks.size() >= 2 && cudaEventQuery(marks[1]) == cudaSuccess) {
+            float elapsed = 0.0f;
+            gpuErrorCheck(cudaEventElapsedTime(&elapsed, marks[0], marks[1]));
+
+            timer->drained_ms[stage] += elapsed;
+            addStageTime(stage, elapsed);
+
+            cudaEventDestroy(marks[0]);
+            cudaEventDestroy(marks[1]);
+            marks.pop_front();
+            marks.pop_front();
+        }
+    }
+}
+
+
+// Sums the stage times into [report] once all timed work has completed, releases the events
+void collectStageTimes(stage_timer_struct &timer, benchmark_report_struct &report) {
+    drainStageTimes(&timer);
+
+    for (int stage = 0; stage < STAGE_COUNT; stage++) {
+        double ms = timer.host_ms[stage] + timer.drained_ms[stage];
+
+        for (size_t i = 0; i + 1 < timer.marks[stage].size(); i += 2) {
+            float elapsed = 0.0f;
+            gpuErrorCheck(cudaEventElapsedTime(&elapsed, timer.marks[stage][i], timer.marks[stage][i + 1]));
+            ms += elapsed;
+        }
+        for (cudaEvent_t event : timer.marks[stage]) {
+            cudaEventDestroy(event);
+        }
+
+        report.stage_ms[stage]    = ms;
+        report.stage_bytes[stage] = timer.bytes[stage];
+        report.stage_flops[stage] = timer.flops[stage];
+    }
+}
+
+
 ///////////////////////////////////////////////////////
 // If we choose to dual-stream the code then we must
 // combine the FFT intensity accumulator associated with
@@ -46,19 +158,146 @@ inline void combineAccumulators(float **d_accum_list_A,
                                 float **d_accum_list_B,
                                 int *scale_arr,
 								int scale_count,
-                                int tau_count) {
+                                int tile_overlap,
+                                int tau_count,
+                                cudaStream_t stream) {
 
     dim3 blockDim(BLOCKSIZE);
     int main_scale = scale_arr[0];
 
     for (int s = 0; s < scale_count; s++) {
         int scale = scale_arr[s];
-        int tile_count = (main_scale / scale) * (main_scale / scale);
+        int tile_count = tileCount(scale, main_scale, tile_overlap);
         int frame_size = (scale / 2 + 1) * scale * tile_count;
 
         int gridDim = ceil(frame_size / static_cast<float>(BLOCKSIZE));
 
-        combineAccum<<<gridDim, blockDim>>>(d_accum_list_A[s], d_accum_list_B[s], tau_count, frame_size);
+        combineAccum<<<gridDim, blockDim, 0, stream>>>(d_accum_list_A[s], d_accum_list_B[s], tau_count, frame_size);
+    }
+}
+
+
+///////////////////////////////////////////////////////
+// Everything the analysis of the accumulators needs that
+// does not change during a run: the ring index of each
+// scale, the on-device ISF scratch and its pinned host
+// staging slots. Created once in runDDM so that analysing
+// an accumulator does not allocate.
+///////////////////////////////////////////////////////
+struct analysis_context_struct {
+    int tile_overlap;
+    int ring_count;                 // rings per tile (q-values x angle segments)
+    ring_index_struct *ring_list;   // one ring index per scale
+    size_t *ISF_offsets;            // start of each scale's ISF[tile][ring][tau]
+    float *d_ISF;
+    int staging_count;
+    float *h_ISF;                   // pinned, staging_count slots of ISF_offsets[scale_count] values
+    cudaEvent_t *staging_ready;     // copy into the slot has completed
+
+    // GPU model fit of every ISF curve, only when fit_curves is set
+    bool fit_curves;
+    int curve_count;                // ISF_offsets[scale_count] / tau_count
+    float *d_tau;                   // tau values in seconds
+    float *d_fit;
+    float *h_fit;                   // pinned, staging_count slots of curve_count x FIT_PARAM_COUNT values
+};
+
+
+void initAnalysisContext(analysis_context_struct &ctx,
+                         int *scale_arr, int scale_count,
+                         int tile_overlap,
+                         float *lambda_arr, int lambda_count,
+                         int *tau_arr, int tau_count,
+                         float fps,
+                         float mask_tolerance,
+                         bool enable_angle_analysis,
+                         int angle_count,
+                         int staging_count,
+                         bool fit_curves) {
+
+    int main_scale = scale_arr[0]; // the largest length-scale
+
+    ctx.tile_overlap = tile_overlap;
+
+    // Calculate total number of rings needed:
+    // When angle analysis is enabled: one ring per (q-value × angle segment) combination; Otherwise: one ring per q-value only
+    ctx.ring_count = enable_angle_analysis ? lambda_count * angle_count : lambda_count;
+
+    // The ring index of each scale only depends on the q-values, so is
+    // built once for the whole run rather than at every analysis
+    ctx.ring_list = new ring_index_struct[scale_count];
+    float *q_pixel_radius = new float[lambda_count]; // host array to hold temporary q values for each length-scale
+
+    for (int s = 0; s < scale_count; s++) {
+        int scale = scale_arr[s];
+
+        for (int i = 0; i < lambda_count; i++) {
+            q_pixel_radius[i] = static_cast<float>(scale) / (lambda_arr[i]);
+        }
+
+        buildRingIndex(ctx.ring_list[s], q_pixel_radius, lambda_count, mask_tolerance, scale, scale, enable_angle_analysis, angle_count);
+    }
+    delete[] q_pixel_radius;
+
+    // The ISF of every scale, tile, ring and tau is computed on device and copied back in one go
+    ctx.ISF_offsets = new size_t[scale_count + 1];
+    ctx.ISF_offsets[0] = 0;
+    for (int s = 0; s < scale_count; s++) {
+        int tile_count = tileCount(scale_arr[s], main_scale, tile_overlap);
+        ctx.ISF_offsets[s + 1] = ctx.ISF_offsets[s] + static_cast<size_t>(tile_count) * ctx.ring_count * tau_count;
+    }
+
+    ctx.staging_count = staging_count;
+    ctx.staging_ready = new cudaEvent_t[staging_count];
+    for (int i = 0; i < staging_count; i++) {
+        gpuErrorCheck(cudaEventCreateWithFlags(&ctx.staging_ready[i], cudaEventDisableTiming));
+    }
+
+    gpuErrorCheck(cudaMalloc((void** ) &ctx.d_ISF, sizeof(float) * ctx.ISF_offsets[scale_count]));
+    gpuErrorCheck(cudaHostAlloc((void **) &ctx.h_ISF, sizeof(float) * ctx.ISF_offsets[scale_count] * staging_count, cudaHostAllocDefault));
+
+    // The fit runs on the device ISF before it is copied back, one curve per scale, tile and ring
+    ctx.fit_curves  = fit_curves;
+    ctx.curve_count = static_cast<int>(ctx.ISF_offsets[scale_count] / tau_count);
+    ctx.d_tau = NULL;
+    ctx.d_fit = NULL;
+    ctx.h_fit = NULL;
+
+    if (fit_curves) {
+        float *tau_seconds = new float[tau_count];
+        for (int t = 0; t < tau_count; t++)
+            tau_seconds[t] = static_cast<float>(tau_arr[t]) / fps;
+
+        size_t fit_count = static_cast<size_t>(ctx.curve_count) * FIT_PARAM_COUNT;
+
+        gpuErrorCheck(cudaMalloc((void **) &ctx.d_tau, sizeof(float) * tau_count));
+        gpuErrorCheck(cudaMalloc((void **) &ctx.d_fit, sizeof(float) * fit_count));
+        gpuErrorCheck(cudaHostAlloc((void **) &ctx.h_fit, sizeof(float) * fit_count * staging_count, cudaHostAllocDefault));
+        gpuErrorCheck(cudaMemcpy(ctx.d_tau, tau_seconds, sizeof(float) * tau_count, cudaMemcpyHostToDevice));
+
+        delete[] tau_seconds;
+    }
+}
+
+
+void freeAnalysisContext(analysis_context_struct &ctx, int scale_count) {
+    for (int s = 0; s < scale_count; s++) {
+        freeRingIndex(ctx.ring_list[s]);
+    }
+    for (int i = 0; i < ctx.staging_count; i++) {
+        gpuErrorCheck(cudaEventDestroy(ctx.staging_ready[i]));
+    }
+    delete[] ctx.ring_list;
+    delete[] ctx.ISF_offsets;
+    delete[] ctx.staging_ready;
+
+    gpuErrorCheck(cudaFree(ctx.d_ISF));
+    gpuErrorCheck(cudaFreeHost(ctx.h_ISF));
+
+    if (ctx.fit_curves) {
+        gpuErrorCheck(cudaFree(ctx.d_tau));
+        gpuErrorCheck(cudaFree(ctx.d_fit));
+        gpuErrorCheck(cudaFreeHost(ctx.h_fit));
     }
 }
 
@@ -66,89 +305,290 @@ inline void combineAccumulators(float **d_accum_list_A,
 ///////////////////////////////////////////////////////
 //	This function handles analysis of the I(q, tau)
 //  accumulator. Given the inputed values of q it
-//  handles calculation of the azimuthal averages.
+//  handles calculation of the azimuthal averages, all
+//  tiles of a scale are reduced on device at once using
+//  the ring index of the analysis context. The work is
+//  only enqueued on [stream], the result arrives in
+//  staging slot [slot] once staging_ready[slot] fires.
 ///////////////////////////////////////////////////////
 void analyse_accums(int *scale_arr,	int scale_count,
-					float *lambda_arr,	int lambda_count,
-					int *tau_arr,	int tau_count,
+					int tau_count,
 					int frames_analysed,
-					float mask_tolerance,
-		            std::string file_out,
+					analysis_context_struct &ctx,
 		            float **accum_list,
-		            int framerate,
-		            int window_size,
-		            int window_index,
-		            bool enable_angle_analysis,
-		            int angle_count) {
+		            int slot,
+		            cudaStream_t stream) {
 
 	int main_scale = scale_arr[0]; // the largest length-scale
 
-	bool *d_masks; // device pointer to reference the boolean azimuthal masks
+	float normalisation = 1.0 / static_cast<float>(frames_analysed);
+
+	for (int s = 0; s < scale_count; s++) {
+        int scale = scale_arr[s];
+        int tile_count = tileCount(scale, main_scale, ctx.tile_overlap);
 
-	int element_count = (main_scale / 2 + 1) * main_scale;
-	int total_masks = lambda_count;
+        profileRangePush(STAGE_REDUCTION, "scale " + std::to_string(scale));
+        analyseAccumDevice(accum_list[s], ctx.ring_list[s], ctx.d_ISF + ctx.ISF_offsets[s], normalisation, tau_count, tile_count, scale, scale, stream);
+        profileRangePop();
+    }
 
-    // Calculate total number of masks needed: 
-    // When angle analysis is enabled: one mask per (q-value × angle segment) combination; Otherwise: one mask per q-value only
-	total_masks = enable_angle_analysis ? lambda_count * angle_count : lambda_count;
+    size_t ISF_count = ctx.ISF_offsets[scale_count];
 
-	// Allocate GPU memory for all azimuthal masks
-	// element_count: number of elements in FFT result ((main_scale/2 + 1) * main_scale)
-	// total_masks: total number of masks (lambda_count * angle_count in angle analysis mode or just lambda_count in regular mode)
-	// This large allocation creates all q-value and angle segment masks at once for GPU computation
-	gpuErrorCheck(cudaMalloc((void** ) &d_masks, sizeof(bool) * element_count * total_masks));
+    gpuErrorCheck(cudaMemcpyAsync(ctx.h_ISF + ISF_count * slot, ctx.d_ISF, sizeof(float) * ISF_count, cudaMemcpyDeviceToHost, stream));
 
-	int *h_pixel_counts = new int[total_masks * scale_count](); // host array to hold the number of pixels in each mask
+    if (ctx.fit_curves) {
+        size_t fit_count = static_cast<size_t>(ctx.curve_count) * FIT_PARAM_COUNT;
+
+        fitISFDevice(ctx.d_ISF, ctx.d_fit, ctx.d_tau, ctx.curve_count, tau_count, stream);
+        gpuErrorCheck(cudaMemcpyAsync(ctx.h_fit + fit_count * slot, ctx.d_fit, sizeof(float) * fit_count, cudaMemcpyDeviceToHost, stream));
+    }
+
+    gpuErrorCheck(cudaEventRecord(ctx.staging_ready[slot], stream));
+}
 
-	float normalisation = 1.0 / static_cast<float>(frames_analysed);
 
-	float *q_pixel_radius = new float[lambda_count]; // host array to hold temporary q values for each length-scale
+///////////////////////////////////////////////////////
+//	Writes the ISF held in staging slot [slot] to one
+//  file per scale and tile.
+///////////////////////////////////////////////////////
+void writeAccumResults(int *scale_arr,	int scale_count,
+                       float *lambda_arr, int lambda_count,
+                       int *tau_arr, int tau_count,
+                       analysis_context_struct &ctx,
+                       int slot,
+                       std::string file_out,
+                       int framerate,
+                       int window_size,
+                       int window_index,
+                       bool enable_angle_analysis,
+                       int angle_count) {
+
+	int main_scale = scale_arr[0]; // the largest length-scale
+	float *h_ISF = ctx.h_ISF + ctx.ISF_offsets[scale_count] * slot;
 
 	for (int s = 0; s < scale_count; s++) {
-    int scale = scale_arr[s];
-    int tile_count = (main_scale / scale) * (main_scale / scale);
-    int tile_size = (scale / 2 + 1) * scale;
+        int scale = scale_arr[s];
+        int tile_count = tileCount(scale, main_scale, ctx.tile_overlap);
 
-    for (int i = 0; i < lambda_count; i++) {
-        q_pixel_radius[i] = static_cast<float>(scale) / (lambda_arr[i]);
-    }
-        
-        buildAzimuthMask(d_masks, h_pixel_counts, q_pixel_radius, lambda_count, mask_tolerance, scale, scale, enable_angle_analysis, angle_count);
+        for (int tile_idx = 0; tile_idx < tile_count; tile_idx++) {
 
-        for (int tile_idx = 0; tile_idx < tile_count; tile_idx++) { 
-           
             std::string tmp_filename = file_out + "episode" + std::to_string(window_size) + "-" + std::to_string(window_index) + "_scale" + std::to_string(scale) + "-" + std::to_string(tile_idx);
 
-            float *d_accum_tmp = accum_list[s] + tile_size * tile_idx;
+            float *ISF = h_ISF + ctx.ISF_offsets[s] + static_cast<size_t>(tile_idx) * ctx.ring_count * tau_count;
 
-            float *ISF = analyseFFTDevice(d_accum_tmp, d_masks, h_pixel_counts, normalisation, tau_count, lambda_count, tile_count, scale, scale, enable_angle_analysis, angle_count);
-            
             writeIqtToFile(tmp_filename, ISF, lambda_arr, lambda_count, tau_arr, tau_count, framerate, enable_angle_analysis, angle_count);
-            
-            delete[] ISF;
+
+            if (ctx.fit_curves) {
+                size_t curve = (ctx.ISF_offsets[s] / tau_count) + static_cast<size_t>(tile_idx) * ctx.ring_count;
+                float *fit = ctx.h_fit + (static_cast<size_t>(ctx.curve_count) * slot + curve) * FIT_PARAM_COUNT;
+
+                writeFitToFile(tmp_filename + "_fit_generic_exp.txt", fit, lambda_arr, lambda_count, enable_angle_analysis, angle_count);
+            }
         }
     }
-    gpuErrorCheck(cudaFree(d_masks));
-    delete[] h_pixel_counts;
-    delete[] q_pixel_radius;
+}
+
+
+///////////////////////////////////////////////////////
+// Host side of the asynchronous analysis. The main thread
+// queues a job for every accumulator handed to the analysis
+// stream, the writer thread waits for the job's staging slot
+// to be filled, writes it out and returns the slot.
+///////////////////////////////////////////////////////
+struct ISF_write_job {
+    int slot;
+    std::string file_out;
+    int window_size;
+    int window_index;
+    int frames_analysed;
+};
+
+
+struct analysis_writer_struct {
+    std::thread thread;
+    std::mutex mtx;
+    std::condition_variable cv;
+    std::deque<ISF_write_job> jobs;
+    std::deque<int> free_slots;
+    bool stop;
+    size_t queued_count;    // jobs queued / written since the start
+    size_t written_count;
+};
+
+
+// Returns a free staging slot, or -1 without waiting if every slot is still being written out
+int tryAcquireStagingSlot(analysis_writer_struct &writer) {
+    std::lock_guard<std::mutex> lock(writer.mtx);
+    if (writer.free_slots.empty())
+        return -1;
+
+    int slot = writer.free_slots.front();
+    writer.free_slots.pop_front();
+    return slot;
+}
+
+
+// Blocks until a staging slot is no longer being written out
+int acquireStagingSlot(analysis_writer_struct &writer) {
+    std::unique_lock<std::mutex> lock(writer.mtx);
+    writer.cv.wait(lock, [&] { return !writer.free_slots.empty(); });
+
+    int slot = writer.free_slots.front();
+    writer.free_slots.pop_front();
+    return slot;
+}
+
+
+void queueWriteJob(analysis_writer_struct &writer, ISF_write_job job) {
+    {
+        std::lock_guard<std::mutex> lock(writer.mtx);
+        writer.jobs.push_back(job);
+        writer.queued_count++;
+    }
+    addGauge(METRIC_WRITER_QUEUE, 1);
+    writer.cv.notify_all();
+}
+
+
+void startWriter(analysis_writer_struct &writer,
+                 analysis_context_struct &ctx,
+                 const std::function<void(ISF_write_job &job)> &write) {
+
+    writer.stop = false;
+    writer.queued_count = 0;
+    writer.written_count = 0;
+    for (int i = 0; i < ctx.staging_count; i++) {
+        writer.free_slots.push_back(i);
+    }
+
+    writer.thread = std::thread([&writer, &ctx, write] {
+        while (true) {
+            ISF_write_job job;
+            {
+                std::unique_lock<std::mutex> lock(writer.mtx);
+                writer.cv.wait(lock, [&] { return writer.stop || !writer.jobs.empty(); });
+
+                if (writer.jobs.empty())
+                    return; // stopped and drained
+
+                job = writer.jobs.front();
+                writer.jobs.pop_front();
+            }
+            addGauge(METRIC_WRITER_QUEUE, -1);
+
+            gpuErrorCheck(cudaEventSynchronize(ctx.staging_ready[job.slot]));
+
+            profileRangePush(STAGE_OUTPUT, "write window " + std::to_string(job.window_size) + "-" + std::to_string(job.window_index));
+            write(job);
+            profileRangePop();
+            countMetric(METRIC_ISF_WRITTEN, 1);
+
+            {
+                std::lock_guard<std::mutex> lock(writer.mtx);
+                writer.free_slots.push_back(job.slot);
+                writer.written_count++;
+            }
+            writer.cv.notify_all();
+        }
+    });
+}
+
 
-    verbose("\n[Results for analysis window size = %d frames]\n", frames_analysed);
+// Blocks until the first [count] jobs ever queued have been written out
+void waitWritten(analysis_writer_struct &writer, size_t count) {
+    std::unique_lock<std::mutex> lock(writer.mtx);
+    writer.cv.wait(lock, [&] { return writer.written_count >= count; });
+}
+
+
+// Writes all outstanding jobs then joins the writer thread
+void stopWriter(analysis_writer_struct &writer) {
+    {
+        std::lock_guard<std::mutex> lock(writer.mtx);
+        writer.stop = true;
+    }
+    writer.cv.notify_all();
+    writer.thread.join();
+}
+
+
+// Parse into the FFT input workspace at [scale], dispatched on the sample type of the video,
+// with preprocessing (see parseBufferPreprocess) if [preprocess] is set, at the main scale only
+template <typename P>
+void launchParse(unsigned char *d_raw_in,
+                 P *d_workspace,
+                 video_info_struct info,
+                 const preprocess_struct *preprocess,
+                 int scale,
+                 int main_scale,
+                 int frame_count,
+                 float sample_scale,
+                 dim3 gridDim,
+                 dim3 blockDim,
+                 cudaStream_t stream) {
+
+    // raw frames hold only the region of interest, so no offset is applied on device
+    int channel_pp = info.bpp / info.bytes_per_sample;
+
+    // The power of two kernel masks with the scale, other main scales take the row-major kernel
+    // with no preprocessing (no modulo either, the tiles are addressed by the FFT plans)
+    if (preprocess != NULL || !isPowerOfTwo(main_scale)) {
+        preprocess_struct pre = {NULL, NULL, NULL, 0.0f, false, 1};
+        if (preprocess != NULL)
+            pre = *preprocess;
+
+        if (info.bytes_per_sample == 2) {
+            const unsigned short *d_raw16 = reinterpret_cast<const unsigned short *>(d_raw_in);
+
+            if (info.big_endian) {
+                parseBufferPreprocess<unsigned short, true, P><<<gridDim, blockDim, 0, stream>>>(d_raw16, d_workspace, channel_pp, info.roi_w, info.roi_h, main_scale, frame_count, sample_scale, pre);
+            } else {
+                parseBufferPreprocess<unsigned short, false, P><<<gridDim, blockDim, 0, stream>>>(d_raw16, d_workspace, channel_pp, info.roi_w, info.roi_h, main_scale, frame_count, sample_scale, pre);
+            }
+        } else {
+            parseBufferPreprocess<unsigned char, false, P><<<gridDim, blockDim, 0, stream>>>(d_raw_in, d_workspace, channel_pp, info.roi_w, info.roi_h, main_scale, frame_count, sample_scale, pre);
+        }
+    } else if (info.bytes_per_sample == 2) {
+        const unsigned short *d_raw16 = reinterpret_cast<const unsigned short *>(d_raw_in);
+
+        if (info.big_endian) {
+            parseBufferScalePow2<unsigned short, true, P><<<gridDim, blockDim, 0, stream>>>(d_raw16, d_workspace, channel_pp, 0, info.roi_w, info.roi_h, 0, 0, scale, main_scale, frame_count, sample_scale);
+        } else {
+            parseBufferScalePow2<unsigned short, false, P><<<gridDim, blockDim, 0, stream>>>(d_raw16, d_workspace, channel_pp, 0, info.roi_w, info.roi_h, 0, 0, scale, main_scale, frame_count, sample_scale);
+        }
+    } else {
+        parseBufferScalePow2<unsigned char, false, P><<<gridDim, blockDim, 0, stream>>>(d_raw_in, d_workspace, channel_pp, 0, info.roi_w, info.roi_h, 0, 0, scale, main_scale, frame_count, sample_scale);
+    }
 }
 
 
 ////////////////////////////////////////////////////////////////////////////////
 //  This function handles the parsing of on-device raw (uchar) data into a float
 //  array, and the multi-scale FFT of this data to a list of cufftComplex arrays.
+//  Frames are parsed once, row-major at the main scale, and the plan of every
+//  scale reads its tiles straight out of that buffer (see the plan set-up): one
+//  execution per tile column, batched over all frames and tile rows, writes the
+//  usual tile-major output. Overlapping tiles (tile_overlap > 1) share rows, so
+//  the bands of tile rows are first gathered into d_bands, one after the other,
+//  and the plans read the bands instead of the frame. With half_precision the
+//  workspace holds __half and the FFT is done in half precision into __half2
+//  arrays, samples are pre-scaled by HALF_FFT_SCALE / main_scale^2. The fused
+//  preprocessing (flat-field, binning, background) is applied by the parse.
 ////////////////////////////////////////////////////////////////////////////////
 void parseChunk(unsigned char *d_raw_in,
-                cufftComplex **d_fft_list_out,
-                float *d_workspace,
+                void **d_fft_list_out,
+                void *d_workspace,
+                void *d_bands,
                 int *scale_arr,
 				int scale_count,
+                int tile_overlap,
                 int frame_count,
                 video_info_struct info,
+                const preprocess_struct *preprocess,
                 cufftHandle *fft_plan_list,
-                cudaStream_t stream) {
+                bool half_precision,
+                cudaStream_t stream,
+                stage_timer_struct *timer) {
 
     int main_scale = scale_arr[0];
 
@@ -158,32 +598,96 @@ void parseChunk(unsigned char *d_raw_in,
     dim3 gridDim(x_dim, y_dim);
     dim3 blockDim(BLOCKSIZE_X, BLOCKSIZE_Y);
 
+    double frame_samples = static_cast<double>(frame_count) * main_scale * main_scale;
+    double sample_bytes  = half_precision ? sizeof(__half) : sizeof(float);
+    double fft_bytes     = half_precision ? sizeof(__half2) : sizeof(cufftComplex);
+    double raw_samples   = (preprocess != NULL) ? preprocess->binning * preprocess->binning : 1.0;
+
+    timeStage(timer, STAGE_PARSE, stream, frame_samples * (raw_samples * info.bytes_per_sample + sample_bytes), frame_samples * raw_samples, [&] {
+        if (half_precision) {
+            float sample_scale = HALF_FFT_SCALE / (main_scale * main_scale);
+            launchParse<__half>(d_raw_in, static_cast<__half *>(d_workspace), info, preprocess, main_scale, main_scale, frame_count,
+                                sample_scale, gridDim, blockDim, stream);
+        } else {
+            launchParse<float>(d_raw_in, static_cast<float *>(d_workspace), info, preprocess, main_scale, main_scale, frame_count,
+                               1.0f, gridDim, blockDim, stream);
+        }
+    });
+
     for (int s = 0; s < scale_count; s++) {
         int scale = scale_arr[s];
-        
-        parseBufferScalePow2<<<gridDim, blockDim, 0, stream>>>(d_raw_in, d_workspace, info.bpp, 0, info.w, info.h, info.x_off, info.y_off, scale, main_scale, frame_count);
+        int tiles_per_side = tilesPerSide(scale, main_scale, tile_overlap);
+        int stride = scale / tile_overlap;
+        size_t tile_size = (scale / 2 + 1) * scale;
+
+        // without overlap the bands of tile rows are the frame itself
+        void *d_input = d_workspace;
+
+        if (tile_overlap > 1 && scale < main_scale) {
+            dim3 bandGrid(x_dim, static_cast<int>(ceil(scale / static_cast<float>(BLOCKSIZE_Y))), tiles_per_side);
+            double band_samples = static_cast<double>(frame_count) * tiles_per_side * scale * main_scale;
+
+            timeStage(timer, STAGE_PARSE, stream, (frame_samples + band_samples) * sample_bytes, 0.0, [&] {
+                if (half_precision) {
+                    gatherTileBands<__half><<<bandGrid, blockDim, 0, stream>>>(static_cast<const __half *>(d_workspace), static_cast<__half *>(d_bands),
+                                                                               main_scale, scale, stride, tiles_per_side, frame_count);
+                } else {
+                    gatherTileBands<float><<<bandGrid, blockDim, 0, stream>>>(static_cast<const float *>(d_workspace), static_cast<float *>(d_bands),
+                                                                              main_scale, scale, stride, tiles_per_side, frame_count);
+                }
+            });
+            d_input = d_bands;
+        }
+
         cufftSetStream(fft_plan_list[s], stream);
 
-        int exe_code = cufftExecR2C(fft_plan_list[s], d_workspace, d_fft_list_out[s]);
-        conditionAssert(exe_code == CUFFT_SUCCESS, "cuFFT execution failed", true);
+        // real to complex FFT of n points ~ 2.5 n log2(n) flops
+        double tile_count = static_cast<double>(frame_count) * tiles_per_side * tiles_per_side;
+        double fft_flops  = tile_count * 2.5 * scale * scale * std::log2(static_cast<double>(scale) * scale);
+        double fft_io     = frame_samples * sample_bytes + tile_count * tile_size * fft_bytes;
+
+        timeStage(timer, STAGE_FFT, stream, fft_io, fft_flops, [&] {
+            profileRangePush(STAGE_FFT, "scale " + std::to_string(scale));
+            for (int tile_x = 0; tile_x < tiles_per_side; tile_x++) {
+                size_t in_offset  = static_cast<size_t>(tile_x) * stride;
+                size_t out_offset = static_cast<size_t>(tile_x) * tile_size;
+                int exe_code;
+
+                if (half_precision) {
+                    exe_code = cufftXtExec(fft_plan_list[s], static_cast<__half *>(d_input) + in_offset,
+                                           static_cast<__half2 *>(d_fft_list_out[s]) + out_offset, CUFFT_FORWARD);
+                } else {
+                    exe_code = cufftExecR2C(fft_plan_list[s], static_cast<float *>(d_input) + in_offset,
+                                            static_cast<cufftComplex *>(d_fft_list_out[s]) + out_offset);
+                }
+                conditionAssert(exe_code == CUFFT_SUCCESS, "cuFFT execution failed", true);
+            }
+            profileRangePop();
+        });
     }
 }
 
 
 ////////////////////////////////////////////////////////////////////////////////
 //  This function handles the analysis of the FFT, i.e. handles the calculation
-//  of the difference functions. Makes use of 3-section circular buffer 
+//  of the difference functions. Makes use of 3-section circular buffer, frames
+//  [frame_begin, frame_end) of the chunk are compared with all later frames in
+//  [partner_begin, frame_limit), for all tau values in one launch per scale.
 ////////////////////////////////////////////////////////////////////////////////
-void analyseChunk(cufftComplex **d_fft_buffer1,
-                  cufftComplex **d_fft_buffer2,
+void analyseChunk(void **d_fft_buffer1,
+                  void **d_fft_buffer2,
                   float **d_fft_accum_list,
                   int scale_count,
                   int *scale_vector,
-                  int frame_count,
+                  int tile_overlap,
+                  int frame_begin,
+                  int frame_end,
+                  int partner_begin,
+                  int frame_limit,
                   int chunk_frame_count,
-                  int frame_offset,
                   int tau_count,
-                  int *tau_vector,
+                  int *d_tau_vector,
+                  bool half_precision,
                   cudaStream_t stream) {
 
     dim3 blockDim(BLOCKSIZE);
@@ -192,696 +696,3163 @@ void analyseChunk(cufftComplex **d_fft_buffer1,
 
     for (int s = 0; s < scale_count; s++) {
         int scale = scale_vector[s];
-        int tile_count = (main_scale / scale) * (main_scale / scale);
+        int tile_count = tileCount(scale, main_scale, tile_overlap);
         int frame_size = (scale / 2 + 1) * scale * tile_count;
 
         int px_count = scale * scale;
         float fft_norm = 1.0f / px_count; // factor to normalise the FFT
 
-        dim3 gridDim(static_cast<int>(ceil(frame_size / static_cast<float>(BLOCKSIZE))));
-
-        int frames_left = chunk_frame_count - frame_offset;
+        dim3 gridDim(static_cast<int>(ceil(frame_size / static_cast<float>(BLOCKSIZE))),
+                     (tau_count + TAU_BATCH - 1) / TAU_BATCH);
 
-        cufftComplex *tmp; // index pointer
-        for (int t = 0; t < tau_count; t++) {
-            if (tau_vector[t] < frames_left) { // check to see if second index is in next chunk
-                tmp = d_fft_buffer1[s] + (frame_offset + tau_vector[t]) * frame_size;
-            } else {
-                tmp = d_fft_buffer2[s] + (tau_vector[t] - frames_left) * frame_size;
-            }
+        profileRangePush(STAGE_DIFFERENCE, "scale " + std::to_string(scale));
 
-            float *accum_out = d_fft_accum_list[s] + frame_size * t; // tmp pointer for position in accumulator array
+        if (half_precision) {
+            // input was pre-scaled by HALF_FFT_SCALE / main_scale^2
+            float half_norm = static_cast<float>(main_scale * main_scale) / (HALF_FFT_SCALE * px_count);
 
-            processFFT<<<gridDim, blockDim, 0, stream>>>(d_fft_buffer1[s] + frame_size * frame_offset, tmp, accum_out, fft_norm, frame_size);
+            processFFTChunk<__half2><<<gridDim, blockDim, 0, stream>>>(static_cast<const __half2 *>(d_fft_buffer1[s]), static_cast<const __half2 *>(d_fft_buffer2[s]),
+                                                                      d_fft_accum_list[s], d_tau_vector, tau_count, half_norm, frame_size,
+                                                                      frame_begin, frame_end, partner_begin, frame_limit, chunk_frame_count);
+        } else {
+            processFFTChunk<cufftComplex><<<gridDim, blockDim, 0, stream>>>(static_cast<const cufftComplex *>(d_fft_buffer1[s]), static_cast<const cufftComplex *>(d_fft_buffer2[s]),
+                                                                           d_fft_accum_list[s], d_tau_vector, tau_count, fft_norm, frame_size,
+                                                                           frame_begin, frame_end, partner_begin, frame_limit, chunk_frame_count);
         }
+
+        profileRangePop();
     }
 }
 
 
 ////////////////////////////////////////////////////////////////////////////////
-//  Main multi-DDM function
+//  Multi-tau counterpart of analyseChunk: frames [frame_begin, frame_end) of the
+//  chunk are pushed through the episode's frame hierarchy (d_ring_list), the
+//  first of them being frame first_index of its window.
 ////////////////////////////////////////////////////////////////////////////////
-void runDDM(std::string file_in,
-            std::string file_out,
-            int *tau_vector,
-			int tau_count,
-            float *lambda_arr,
-			int lambda_count,
-            int *scale_vector,
-			int scale_count,
-            int x_offset,
-			int y_offset,
-            int *episode_vector, 
-            int episode_count,   
-            int total_frames,
-			int frame_offset,
-            int chunk_frame_count,
-            bool multistream,
-            bool use_webcam,
-            int webcam_idx,
-            float mask_tolerance,
-			bool use_moviefile,
-			bool use_index_fps,
-			bool use_explicit_fps,
-			float explicit_fps,
-            int dump_accum_after,
-			bool benchmark_mode,
-            bool enable_angle_analysis,
-            int angle_count) {
+void analyseChunkMultiTau(void **d_fft_buffer,
+                          cufftComplex **d_ring_list,
+                          float **d_fft_accum_list,
+                          int scale_count,
+                          int *scale_vector,
+                          int tile_overlap,
+                          int frame_begin,
+                          int frame_end,
+                          int first_index,
+                          int *d_tau_vector,
+                          int *d_level_offsets,
+                          int level_count,
+                          int points,
+                          bool half_precision,
+                          cudaStream_t stream) {
 
-    auto start_time = std::chrono::high_resolution_clock::now();
-    verbose("[multiDDM Begin]\n");
+    dim3 blockDim(BLOCKSIZE);
 
-    //////////
-    ///  CUDA Check
-    //////////
+    int main_scale = scale_vector[0];
 
-    cudaDeviceProp deviceProp;
-    deviceProp.major = 0;
-    deviceProp.minor = 0;
-    int dev = 0;
+    for (int s = 0; s < scale_count; s++) {
+        int scale = scale_vector[s];
+        int tile_count = tileCount(scale, main_scale, tile_overlap);
+        int frame_size = (scale / 2 + 1) * scale * tile_count;
 
-    // This will pick the best possible CUDA capable device
-    gpuErrorCheck(cudaGetDeviceProperties(&deviceProp, dev));
+        // half precision input was pre-scaled by HALF_FFT_SCALE / main_scale^2
+        float fft_norm = half_precision ? static_cast<float>(main_scale * main_scale) / (HALF_FFT_SCALE * scale * scale)
+                                        : 1.0f / (scale * scale);
 
-    // Get information on CUDA device
-    verbose("[Device Info] Device found, %d Multi-Processors, SM %d.%d compute capabilities.\n",
-            deviceProp.multiProcessorCount, deviceProp.major, deviceProp.minor);
+        dim3 gridDim(static_cast<int>(ceil(frame_size / static_cast<float>(BLOCKSIZE))));
 
-    //////////
-    ///  Sort Parameter Arrays
-    //////////
+        profileRangePush(STAGE_DIFFERENCE, "scale " + std::to_string(scale));
 
-    // Can make assumptions later if tau / q / scale arrays are in known order
+        if (half_precision) {
+            processMultiTauChunk<__half2><<<gridDim, blockDim, 0, stream>>>(static_cast<const __half2 *>(d_fft_buffer[s]), d_ring_list[s], d_fft_accum_list[s],
+                                                                           d_tau_vector, d_level_offsets, level_count, points, fft_norm,
+                                                                           frame_size, frame_begin, frame_end, first_index);
+        } else {
+            processMultiTauChunk<cufftComplex><<<gridDim, blockDim, 0, stream>>>(static_cast<const cufftComplex *>(d_fft_buffer[s]), d_ring_list[s], d_fft_accum_list[s],
+                                                                                d_tau_vector, d_level_offsets, level_count, points, fft_norm,
+                                                                                frame_size, frame_begin, frame_end, first_index);
+        }
 
-    std::sort(tau_vector, tau_vector + tau_count);
-    std::sort(lambda_arr, lambda_arr + lambda_count);
-    std::sort(scale_vector, scale_vector + scale_count, std::greater<int>());
-    // Sort window sizes in ascending order for efficient processing (starting with smaller windows) but could also be descending
-    std::sort(episode_vector, episode_vector + episode_count);
+        profileRangePop();
+    }
+}
 
-    //////////
-    ///  Parameter Check
-    //////////
 
-    verbose("Scale list:\n");
-    for (int s = 0; s < scale_count; s++) {
-        unsigned int scale = scale_vector[s];
-        //printf("\t%d\n", scale);
-        conditionAssert(!(scale == 0) && !(scale & (scale - 1)), "scales must be powers of two (> 0)", true);
+///////////////////////////////////////////////////////
+// Video reading runs on its own thread. The producer fills
+// a ring of pinned host chunks ahead of the pipeline, in the
+// order given by the schedule of frame segments (one per
+// streamFrames call), seeking whenever a segment does not
+// follow on from the previous one. A slot is reused once the
+// host to device copy out of it has completed.
+///////////////////////////////////////////////////////
+struct frame_segment_struct {
+    int first_frame;
+    int frame_count;
+};
 
-        if (s < scale_count - 1)
-            conditionAssert((scale_vector[s] > scale_vector[s + 1]), "scales should be descending order", true);
-    }
 
-    verbose("Episode list (time window sizes):\n");
-    for (int e = 0; e < episode_count; e++) {
-        int window_size = episode_vector[e];
-        //printf("\t%d\n", window_size);
-        conditionAssert(window_size >= 0, "Window size should be non-negative", true);
-        
-        if (e < episode_count - 1) {
-            conditionAssert(window_size < episode_vector[e + 1], "Window sizes should be in ascending order", true);
-        }
-        
-        if (window_size == 0) {
-            verbose("Warning: Window with size 0 at position %d will be skipped\n", e+1);
-        } else if (window_size > total_frames) {
-            verbose("Warning: Window size %d exceeds total frame count %d, will analyze all available frames\n", 
-                    window_size, total_frames);
-        }
-    }
+struct chunk_slot_struct {
+    unsigned char *h_chunk;     // pinned
+    int first_frame;            // first frame held (relative to frame_offset)
+    int frame_count;
+    cudaEvent_t copied;         // copy to device of this slot has completed
+};
 
-    verbose("%d time window sizes.\n", episode_count);
 
-    for (int t = 0; t < tau_count - 1; t++) {
-        conditionAssert((tau_vector[t] >= 0), "Tau values should be positive", true);
-        conditionAssert((tau_vector[t] < tau_vector[t + 1]), "Tau vector should be ascending order", true);
-    }
+struct chunk_prefetch_struct {
+    // video source, only used by the producer thread
+    video_info_struct info;
+    bool use_moviefile;
+    bool use_webcam;
+    bool benchmark_mode;
+    movie_index_struct *movie_index;
+    const host_frames_struct *host_frames;  // engine frames in host memory, NULL otherwise
+    cv::VideoCapture cap;
+    int frame_offset;           // first frame of the video that is analysed
+    int next_frame;             // frame (relative to frame_offset) the source will deliver next
 
-    for (int q = 0; q < lambda_count - 1; q++) {
-        conditionAssert((lambda_arr[q] >= 0), "q-vector values should be positive", true);
-        conditionAssert((lambda_arr[q] < lambda_arr[q + 1]), "q-vector vector should be ascending order", true);
-    }
+    int chunk_frame_count;
+    std::vector<frame_segment_struct> schedule;
 
-    conditionAssert(mask_tolerance < 10 && mask_tolerance > 1.0,
-            "mask_tolerance is likely undesired value, refer to README for more information");
+    int depth;                  // number of slots
+    chunk_slot_struct *slots;
 
-    conditionAssert(lambda_arr[lambda_count-1] <= scale_vector[scale_count-1],
-            "The largest q-vector should be smaller than the smallest scale.", true);
+    std::thread thread;
+    std::mutex mtx;
+    std::condition_variable cv;
+    std::deque<int> ready;      // loaded slots, in stream order
+    std::deque<int> free_slots;
+    bool stop;
+};
 
-    verbose("%d tau-values.\n", tau_count);
-    verbose("%d q-vector values.\n", lambda_count);
 
-    verbose("Parameter Check Done.\n");
-    //////////
-    ///  Video Setup
-    //////////
+///////////////////////////////////////////////////////
+// Position the video source so that the next frame
+// loaded is [frame] (relative to the analysis offset).
+///////////////////////////////////////////////////////
+void seekVideo(chunk_prefetch_struct &q, int frame) {
+    if (q.benchmark_mode || q.use_webcam || q.next_frame == frame)
+        return;
 
-    // Web-cam alignment
-    if (use_webcam) {
-        cv::VideoCapture tmp_cap(webcam_idx);
+    if (q.use_moviefile || q.host_frames != NULL) {
+        // indexed movie-files and host frames need no seek, frames are addressed directly
+    } else {
+        q.cap.set(cv::CAP_PROP_POS_FRAMES, q.frame_offset + frame);
+        verbose("  Positioned video to frame %d\n", frame);
+    }
+    q.next_frame = frame;
+}
 
-        int main_scale = scale_vector[0];
 
-        while(1) {
-            cv::Mat tmp_frame;
-            tmp_cap >> tmp_frame;
+void loadChunk(chunk_prefetch_struct &q, unsigned char *h_chunk, int frame_count) {
+    if (q.host_frames != NULL) {
+        loadHostFramesToHost(q.host_frames->frames, h_chunk, q.info, q.frame_offset + q.next_frame, frame_count);
+    } else if (q.use_moviefile && !q.benchmark_mode) {
+        loadIndexedMovieToHost(*q.movie_index, h_chunk, q.info, q.frame_offset + q.next_frame, frame_count);
+    } else {
+        loadVideoToHost(false, NULL, q.cap, h_chunk, q.info, frame_count, q.benchmark_mode);
+    }
+    q.next_frame += frame_count;
+}
 
-            for (int s = 0; s < scale_count; s++) {
-                int scale = scale_vector[s];
-                int tiles_per_side = (main_scale / scale);
-                int tiles_per_frame = tiles_per_side * tiles_per_side;
 
-                for (int t = 0; t < tiles_per_frame; t++) {
-                    cv::Rect rect(x_offset + (t / tiles_per_side) * scale + s, y_offset + (t % tiles_per_side) * scale + s, scale, scale); // add s to each to help with readability
-                    cv::rectangle(tmp_frame, rect, cv::Scalar(0, 255, 0));
+void startPrefetch(chunk_prefetch_struct &q) {
+    q.stop = false;
+    for (int i = 0; i < q.depth; i++) {
+        q.free_slots.push_back(i);
+    }
+
+    q.thread = std::thread([&q] {
+        const int C = q.chunk_frame_count;
+
+        for (frame_segment_struct &seg : q.schedule) {
+            seekVideo(q, seg.first_frame);
+
+            for (int chunk_start = 0; chunk_start < seg.frame_count; chunk_start += C) {
+                int slot;
+                {
+                    std::unique_lock<std::mutex> lock(q.mtx);
+                    q.cv.wait(lock, [&] { return q.stop || !q.free_slots.empty(); });
+
+                    if (q.stop)
+                        return;
+
+                    slot = q.free_slots.front();
+                    q.free_slots.pop_front();
                 }
-            }
-            cv::imshow( "Web-cam", tmp_frame );
 
-            char c=(char) cv::waitKey(25);
-            if(c==27)
-                break;
+                chunk_slot_struct &c = q.slots[slot];
+                gpuErrorCheck(cudaEventSynchronize(c.copied));
+
+                c.first_frame = seg.first_frame + chunk_start;
+                c.frame_count = std::min(C, seg.frame_count - chunk_start);
+                loadChunk(q, c.h_chunk, c.frame_count);
+                countMetric(METRIC_FRAMES_LOADED, c.frame_count);
+
+                {
+                    std::lock_guard<std::mutex> lock(q.mtx);
+                    q.ready.push_back(slot);
+                }
+                addGauge(METRIC_PREFETCH_QUEUE, 1);
+                q.cv.notify_all();
+            }
         }
-        tmp_cap.release();
-        cv::destroyAllWindows();
+    });
+}
+
+
+// Blocks until the next chunk of the schedule has been loaded
+int popChunk(chunk_prefetch_struct &q) {
+    std::unique_lock<std::mutex> lock(q.mtx);
+    q.cv.wait(lock, [&] { return !q.ready.empty(); });
+
+    int slot = q.ready.front();
+    q.ready.pop_front();
+    addGauge(METRIC_PREFETCH_QUEUE, -1);
+    return slot;
+}
+
+
+// Returns a slot to the producer once the copy out of it (enqueued on [stream]) completes
+void releaseChunk(chunk_prefetch_struct &q, int slot, cudaStream_t stream) {
+    gpuErrorCheck(cudaEventRecord(q.slots[slot].copied, stream));
+    {
+        std::lock_guard<std::mutex> lock(q.mtx);
+        q.free_slots.push_back(slot);
+    }
+    q.cv.notify_all();
+}
+
+
+void stopPrefetch(chunk_prefetch_struct &q) {
+    {
+        std::lock_guard<std::mutex> lock(q.mtx);
+        q.stop = true;
     }
+    q.cv.notify_all();
+    q.thread.join();
+}
+
+
+///////////////////////////////////////////////////////
+// State of the chunk pipeline, i.e. the 3-section circular
+// buffers, per-stream pointers and the video source. Pointers
+// are rotated in place as chunks are streamed.
+///////////////////////////////////////////////////////
+struct chunk_pipeline_struct {
+    int *scale_vector;
+    int scale_count;
+    int tile_overlap;
+    int tau_count;
+    int *d_tau_vector;
+    int chunk_frame_count;
+    size_t chunk_size;      // bytes of one chunk of raw frames
+    int multitau_points;    // multi-tau mode if > 0, frames per level
+    int multitau_levels;
+    int *d_level_offsets;   // lags of level l are d_tau_vector[offsets[l] .. offsets[l+1])
+    bool multistream;
 
     video_info_struct info;
-    FILE *moviefile;
-    cv::VideoCapture cap;
+    chunk_prefetch_struct *prefetch; // delivers the raw chunks in stream order
+    gpu_decoder_struct *decoder;     // GPU decoding (-U): chunks are decoded on device instead, NULL otherwise
+    preprocess_struct *preprocess;   // fused preprocessing, NULL if off
+    int background_next;             // frame following the last one the running background has seen
+
+    cufftHandle *fft_plan_list;
+    void *d_bands;          // FFT input of overlapping tiles (see parseChunk), NULL without overlap
+    bool half_precision;    // workspace holds __half, FFT ring __half2 (else float / cufftComplex)
+
+    // rotating pointers
+    unsigned char *d_idle, *d_ready, *d_used;
+    void **d_start_list, **d_end_list, **d_junk_list;
+    void *d_workspace_cur, *d_workspace_nxt;
+    cudaStream_t *stream_cur, *stream_nxt;
+    bool second_accum;      // true if the current stream accumulates into the second accumulator copy
+
+    cudaEvent_t parse_done; // FFT of the newest chunk is ready
+    cudaEvent_t chunk_done; // multi-tau: chunk pushed, the frame hierarchy is updated in frame order
+
+    stage_timer_struct *timer; // benchmark suite stage timing, NULL otherwise
+
+    std::function<void(int next_frame)> checkpoint; // called after every chunk, frames before next_frame are accumulated
+};
+
+
+// Modelled cost of accumulating [frames] frames over [tau_count] lags: every pair reads the
+// later frame's coefficient (the earlier one stays in registers) and costs about 6 flops,
+// the accumulator is read and written once per tau
+inline void differenceWork(chunk_pipeline_struct &p, int frames, int tau_count, double &bytes, double &flops) {
+    int main_scale = p.scale_vector[0];
+    double pixels = 0.0;
+    for (int s = 0; s < p.scale_count; s++) {
+        int scale = p.scale_vector[s];
+        pixels += static_cast<double>((scale / 2 + 1) * scale) * tileCount(scale, main_scale, p.tile_overlap);
+    }
 
-    if (benchmark_mode) {
-    	info.w = scale_vector[0];
-    	info.h = scale_vector[0];
-    	info.bpp = 1;
-    	info.fps = 1.0;
-    } else if (use_moviefile) { // if we have a movie-file we use custom handler
-        moviefile = fopen(file_in.c_str(), "rb");
-        conditionAssert(moviefile != NULL, "couldn't open .movie file", true);
-        info = initFile(moviefile, frame_offset);
-    } else { // for other file types handle with OpenCV
-        if (use_webcam) {
-            cap = cv::VideoCapture(webcam_idx);
+    double pairs = static_cast<double>(frames) * tau_count * pixels;
+    bytes = pairs * (p.half_precision ? sizeof(__half2) : sizeof(cufftComplex)) + 2.0 * sizeof(float) * tau_count * pixels;
+    flops = 6.0 * pairs;
+}
+
+
+///////////////////////////////////////////////////////
+// Accumulators of one episode (time-window size). Windows of
+// an episode are disjoint, so at most one window per episode
+// is open at any time. The accumulators are double buffered,
+// while one bank is analysed on the analysis stream the
+// chunk pipeline keeps accumulating into the other.
+///////////////////////////////////////////////////////
+struct episode_accum_struct {
+    int window_size;
+    int window_first;           // first window handled by this set
+    int window_last;            // one past the last window handled by this set
+    int pair_end;               // frames from here on are only used as the later frame of a pair (tau halo)
+    float **d_accum_list_1;     // per-scale accumulators of the active bank
+    float **d_accum_list_2;     // second copy used by the second stream (same as _1 if single stream)
+    float **d_bank_list[2][2];  // [bank][copy] per-scale accumulators
+    int bank;                   // bank currently accumulated into
+    cudaEvent_t bank_cleared[2];// bank has been analysed and zeroed
+    int frames_accumulated;     // frames added since the last flush
+    int chunks_accumulated;     // chunks added since the last flush
+    int dump_count;             // number of rolling purges written so far
+    cufftComplex **d_multitau_list; // per-scale frame hierarchy (multi-tau mode)
+};
+
+// Callback used to analyse and clear an episode's accumulators
+typedef std::function<void(episode_accum_struct &episode, int window_index, bool partial)> flush_function;
+
+
+// Copies the next chunk loaded by the prefetch thread to device, which must hold the given frames
+void copyChunkToDevice(chunk_pipeline_struct &p, unsigned char *d_raw, int first_frame, int frame_count) {
+    // every copy is parsed next, its background restarts if the frames do not follow on
+    if (p.preprocess != NULL) {
+        p.preprocess->background_reset = (first_frame != p.background_next);
+        p.background_next = first_frame + frame_count;
+    }
+
+    if (p.decoder != NULL) {
+        // decoded straight into the device chunk, nothing passes through the prefetch slots
+        decodeChunkToDevice(p.decoder, d_raw, first_frame, frame_count, *p.stream_cur);
+
+        countMetric(METRIC_FRAMES_LOADED, frame_count);
+        countMetric(METRIC_CHUNKS, 1);
+        countMetric(METRIC_FRAMES_ANALYSED, frame_count);
+        return;
+    }
+
+    int slot = popChunk(*p.prefetch);
+    chunk_slot_struct &c = p.prefetch->slots[slot];
+
+    conditionAssert(c.first_frame == first_frame && c.frame_count == frame_count,
+                    "prefetched chunk does not match the frames being streamed", true);
+
+    timeStage(p.timer, STAGE_H2D, *p.stream_cur, p.chunk_size, 0.0, [&] {
+        gpuErrorCheck(cudaMemcpyAsync(d_raw, c.h_chunk, p.chunk_size, cudaMemcpyHostToDevice, *p.stream_cur));
+    });
+    releaseChunk(*p.prefetch, slot, *p.stream_cur);
+
+    countMetric(METRIC_CHUNKS, 1);
+    countMetric(METRIC_FRAMES_ANALYSED, frame_count);
+    countMetric(METRIC_BYTES_H2D, p.chunk_size);
+    drainStageTimes(p.timer);
+}
+
+
+////////////////////////////////////////////////////////////////////////////////
+//  Streams frames [first_frame, first_frame + frame_count) through the chunk
+//  pipeline. Each chunk is loaded and FFT'd once, then its differences are added
+//  to every episode with an open window overlapping that chunk. Window w of an
+//  episode covers frames [w * window_size, (w + 1) * window_size), frames of
+//  different windows are never paired. When a window closes (or after
+//  dump_accum_after chunks) the episode is handed to the flush callback. Up to
+//  the episode's pair_end frames start pairs, later ones only end them.
+////////////////////////////////////////////////////////////////////////////////
+void streamFrames(chunk_pipeline_struct &p,
+                  int first_frame,
+                  int frame_count,
+                  episode_accum_struct *episodes,
+                  int episode_count,
+                  int dump_accum_after,
+                  const flush_function &flush) {
+
+    const int C = p.chunk_frame_count;
+    const int stream_end = first_frame + frame_count;
+    const int chunk_count = (frame_count + C - 1) / C;
+
+    auto chunkFrames = [&](int k) { return (k < chunk_count) ? std::min(C, frame_count - k * C) : 0; };
+
+    auto copyChunk = [&](unsigned char *d_raw, int k) {
+        copyChunkToDevice(p, d_raw, first_frame + k * C, chunkFrames(k));
+    };
+
+    // Pre-process the first chunk to initialise the start_list
+    copyChunk(p.d_idle, 0);
+    parseChunk(p.d_idle, p.d_start_list, p.d_workspace_cur, p.d_bands, p.scale_vector, p.scale_count, p.tile_overlap, chunkFrames(0),
+               p.info, p.preprocess, p.fft_plan_list, p.half_precision, *p.stream_cur, p.timer);
+    gpuErrorCheck(cudaStreamSynchronize(*p.stream_cur));
+
+    for (int chunk_index = 0; chunk_index < chunk_count; chunk_index++) {
+        int frames_in_chunk = chunkFrames(chunk_index);
+        int frames_in_next  = chunkFrames(chunk_index + 1);
+
+        int chunk_start = first_frame + chunk_index * C;
+        int chunk_end   = chunk_start + frames_in_chunk;
+
+        verbose("  [Processing chunk %d out of total %d (frames %d-%d)]\n",
+                chunk_index + 1, chunk_count, chunk_start, chunk_end - 1);
+
+        // Copy the next chunk to device and perform FFT, the current chunk is paired with it
+        if (frames_in_next > 0) {
+            copyChunk(p.d_ready, chunk_index + 1);
+            parseChunk(p.d_ready, p.d_end_list, p.d_workspace_cur, p.d_bands, p.scale_vector, p.scale_count, p.tile_overlap, frames_in_next,
+                       p.info, p.preprocess, p.fft_plan_list, p.half_precision, *p.stream_cur, p.timer);
+        }
+
+        // The other stream analyses this chunk's successor next, it must see the finished FFT
+        gpuErrorCheck(cudaEventRecord(p.parse_done, *p.stream_cur));
+        gpuErrorCheck(cudaStreamWaitEvent(*p.stream_nxt, p.parse_done, 0));
+
+        for (int e = 0; e < episode_count; e++) {
+            episode_accum_struct &ep = episodes[e];
+            float **d_accum_list = p.second_accum ? ep.d_accum_list_2 : ep.d_accum_list_1;
+
+            int w_begin = std::max(chunk_start / ep.window_size, ep.window_first);
+            int w_end   = std::min((chunk_end - 1) / ep.window_size + 1, ep.window_last);
+
+            for (int w = w_begin; w < w_end; w++) {
+                int window_start = w * ep.window_size;
+                int window_end   = std::min(window_start + ep.window_size, stream_end);
+
+                int frame_begin = std::max(window_start, chunk_start) - chunk_start;
+                int frame_end   = std::min(std::min(window_end, chunk_end), ep.pair_end) - chunk_start;
+                int frame_limit = std::min(window_end - chunk_start, frames_in_chunk + frames_in_next);
+
+                double work_bytes = 0.0;
+                double work_flops = 0.0;
+                if (p.timer != NULL)
+                    differenceWork(p, frame_end - frame_begin, p.tau_count, work_bytes, work_flops);
+
+                if (frame_end > frame_begin && p.multitau_points > 0) {
+                    timeStage(p.timer, STAGE_DIFFERENCE, *p.stream_cur, work_bytes, work_flops, [&] {
+                        analyseChunkMultiTau(p.d_start_list, ep.d_multitau_list, d_accum_list, p.scale_count, p.scale_vector, p.tile_overlap,
+                                             frame_begin, frame_end, chunk_start + frame_begin - window_start, p.d_tau_vector,
+                                             p.d_level_offsets, p.multitau_levels, p.multitau_points, p.half_precision, *p.stream_cur);
+                    });
+
+                    ep.frames_accumulated += frame_end - frame_begin;
+                } else if (frame_end > frame_begin) {
+                    timeStage(p.timer, STAGE_DIFFERENCE, *p.stream_cur, work_bytes, work_flops, [&] {
+                        analyseChunk(p.d_start_list, p.d_end_list, d_accum_list, p.scale_count, p.scale_vector, p.tile_overlap,
+                                     frame_begin, frame_end, 0, frame_limit, C, p.tau_count, p.d_tau_vector,
+                                     p.half_precision, *p.stream_cur);
+                    });
+
+                    ep.frames_accumulated += frame_end - frame_begin;
+                }
+
+                if (window_end <= chunk_end) { // last frame of window analysed
+                    flush(ep, w, false);
+                    ep.chunks_accumulated = 0;
+                } else if (w == w_end - 1) {
+                    ep.chunks_accumulated++;
+
+                    // Periodic accumulator processing if enabled
+                    if (dump_accum_after != 0 && ep.chunks_accumulated == dump_accum_after) {
+                        flush(ep, w, true);
+                        ep.chunks_accumulated = 0;
+                    }
+                }
+            }
+        }
+
+        // The next chunk continues the frame hierarchy, it must not be pushed before this one
+        if (p.multitau_points > 0) {
+            gpuErrorCheck(cudaEventRecord(p.chunk_done, *p.stream_cur));
+            gpuErrorCheck(cudaStreamWaitEvent(*p.stream_nxt, p.chunk_done, 0));
+        }
+
+        // Ensure next stream operations don't start until current operations complete
+        // This prevents data races in the triple-buffer system
+        gpuErrorCheck(cudaStreamSynchronize(*p.stream_nxt));
+
+        // Rotate pointers for triple-buffer pattern
+        // This swaps current and next pointers for device buffers
+        swap<void>(p.d_workspace_cur, p.d_workspace_nxt);
+        swap<cudaStream_t>(p.stream_cur, p.stream_nxt);
+        p.second_accum = p.multistream && !p.second_accum;
+
+        // Rotate the three-pointer circular buffers for FFT data and raw frame data
+        rotateThreePtr<void*>(p.d_junk_list, p.d_start_list, p.d_end_list);
+        rotateThreePtr<unsigned char>(p.d_used, p.d_ready, p.d_idle);
+
+        if (p.checkpoint)
+            p.checkpoint(chunk_end);
+    }
+}
+
+
+///////////////////////////////////////////////////////
+// Live mode. Frames are analysed as they arrive and the
+// accumulators form a sliding window of the last
+// window_chunks chunks: every chunk accumulates into its own
+// sub-accumulator, which is added to the window total and
+// subtracted again once it drops out of the window. Two
+// spare slots let the next chunks accumulate while the
+// expired one is still being subtracted. Total updates and
+// snapshots run on the update (analysis) stream in chunk
+// order. Sliding windows (streamSliding) use the same set
+// with one sub-accumulator per hop rather than per chunk,
+// plus the cross accumulator.
+///////////////////////////////////////////////////////
+struct live_accum_struct {
+    int window_chunks;          // chunks (sliding windows: hops) in the sliding window
+    int slot_count;             // window_chunks + 2 sub-accumulators, chunk k uses slot k % slot_count
+    size_t accum_count;         // values of one accumulator set
+    float *d_live;              // slot_count sub-accumulators followed by the total (and the cross accumulator)
+    bool on_host;               // d_live spilled to mapped pinned host memory by the memory planner
+    float ***d_sub_list;        // per-slot per-scale sub-accumulators
+    float **d_total_list;       // per-scale sum of the window's sub-accumulators
+    float **d_cross_list;       // sliding windows: pairs of a hop's last chunk reaching into the next hop, else NULL
+    int *sub_frames;            // frames accumulated per slot
+    cudaEvent_t *sub_cleared;   // slot has been subtracted from the total and zeroed
+    cudaEvent_t chunk_added;    // newest sub-accumulator is complete
+    cudaEvent_t cross_cleared;  // cross accumulator has been added and zeroed
+    cudaStream_t update_stream;
+};
+
+// Called every publish_every chunks with the window total ready on the update stream
+typedef std::function<void(live_accum_struct &live, int window_frames, int snapshot)> publish_function;
+
+// Set by SIGINT, ends a live run after the current chunk
+volatile std::sig_atomic_t live_stop = 0;
+
+void liveStopHandler(int) {
+    live_stop = 1;
+}
+
+
+void initLiveAccum(live_accum_struct &live,
+                   int window_chunks,
+                   size_t accum_size,
+                   int *scale_vector, int scale_count,
+                   int tile_overlap,
+                   int tau_count,
+                   bool with_cross,
+                   bool on_host,
+                   cudaStream_t update_stream) {
+
+    int main_scale = scale_vector[0];
+    int set_count  = window_chunks + 2 + 1 + (with_cross ? 1 : 0);
+
+    live.window_chunks = window_chunks;
+    live.slot_count    = window_chunks + 2;
+    live.accum_count   = accum_size / sizeof(float);
+    live.update_stream = update_stream;
+
+    live.on_host       = on_host;
+
+    if (on_host) {
+        gpuErrorCheck(cudaHostAlloc((void **) &live.d_live, accum_size * set_count, cudaHostAllocMapped));
+        memset(live.d_live, 0, accum_size * set_count);
+    } else {
+        gpuErrorCheck(cudaMalloc((void **) &live.d_live, accum_size * set_count));
+        gpuErrorCheck(cudaMemset(live.d_live, 0, accum_size * set_count));
+    }
+
+    auto splitAccum = [&](float *d_base) {
+        float **list = new float*[scale_count];
+        list[0] = d_base;
+        for (int s = 0; s < scale_count - 1; s++) {
+            int scale = scale_vector[s];
+            int tiles_per_frame = tileCount(scale, main_scale, tile_overlap);
+            list[s + 1] = list[s] + static_cast<size_t>((scale / 2 + 1) * scale) * tiles_per_frame * tau_count;
+        }
+        return list;
+    };
+
+    live.d_sub_list  = new float**[live.slot_count];
+    live.sub_frames  = new int[live.slot_count];
+    live.sub_cleared = new cudaEvent_t[live.slot_count];
+
+    for (int i = 0; i < live.slot_count; i++) {
+        live.d_sub_list[i] = splitAccum(live.d_live + live.accum_count * i);
+        live.sub_frames[i] = 0;
+        gpuErrorCheck(cudaEventCreateWithFlags(&live.sub_cleared[i], cudaEventDisableTiming));
+    }
+    live.d_total_list = splitAccum(live.d_live + live.accum_count * live.slot_count);
+    live.d_cross_list = with_cross ? splitAccum(live.d_live + live.accum_count * (live.slot_count + 1)) : NULL;
+
+    gpuErrorCheck(cudaEventCreateWithFlags(&live.chunk_added, cudaEventDisableTiming));
+    gpuErrorCheck(cudaEventCreateWithFlags(&live.cross_cleared, cudaEventDisableTiming));
+
+    verbose("Sliding window of %d sub-accumulators, %f GB\n", window_chunks, accum_size * set_count / (float) 1073741824);
+}
+
+
+void freeLiveAccum(live_accum_struct &live) {
+    for (int i = 0; i < live.slot_count; i++) {
+        delete[] live.d_sub_list[i];
+        cudaEventDestroy(live.sub_cleared[i]);
+    }
+    delete[] live.d_sub_list;
+    delete[] live.d_total_list;
+    delete[] live.d_cross_list;
+    delete[] live.sub_frames;
+    delete[] live.sub_cleared;
+    cudaEventDestroy(live.chunk_added);
+    cudaEventDestroy(live.cross_cleared);
+    if (live.on_host) {
+        cudaFreeHost(live.d_live);
+    } else {
+        cudaFree(live.d_live);
+    }
+}
+
+
+////////////////////////////////////////////////////////////////////////////////
+//  Live counterpart of streamFrames: streams frames [0, frame_count) (or until
+//  SIGINT) through the chunk pipeline, keeps the sliding window total up to date
+//  and hands it to the publish callback every publish_every chunks.
+////////////////////////////////////////////////////////////////////////////////
+void streamLive(chunk_pipeline_struct &p,
+                live_accum_struct &live,
+                int frame_count,
+                int publish_every,
+                const publish_function &publish) {
+
+    const int C = p.chunk_frame_count;
+    const int chunk_count = (frame_count + C - 1) / C;
+
+    auto chunkFrames = [&](int k) { return (k < chunk_count) ? std::min(C, frame_count - k * C) : 0; };
+
+    dim3 blockDim(BLOCKSIZE);
+    dim3 gridDim(static_cast<unsigned int>((live.accum_count + BLOCKSIZE - 1) / BLOCKSIZE));
+
+    copyChunkToDevice(p, p.d_idle, 0, chunkFrames(0));
+    parseChunk(p.d_idle, p.d_start_list, p.d_workspace_cur, p.d_bands, p.scale_vector, p.scale_count, p.tile_overlap, chunkFrames(0),
+               p.info, p.preprocess, p.fft_plan_list, p.half_precision, *p.stream_cur, p.timer);
+    gpuErrorCheck(cudaStreamSynchronize(*p.stream_cur));
+
+    int window_frames = 0;
+    int snapshot = 0;
+
+    for (int chunk_index = 0; chunk_index < chunk_count && !live_stop; chunk_index++) {
+        int frames_in_chunk = chunkFrames(chunk_index);
+        int frames_in_next  = chunkFrames(chunk_index + 1);
+
+        if (frames_in_next > 0) {
+            copyChunkToDevice(p, p.d_ready, (chunk_index + 1) * C, frames_in_next);
+            parseChunk(p.d_ready, p.d_end_list, p.d_workspace_cur, p.d_bands, p.scale_vector, p.scale_count, p.tile_overlap, frames_in_next,
+                       p.info, p.preprocess, p.fft_plan_list, p.half_precision, *p.stream_cur, p.timer);
+        }
+
+        gpuErrorCheck(cudaEventRecord(p.parse_done, *p.stream_cur));
+        gpuErrorCheck(cudaStreamWaitEvent(*p.stream_nxt, p.parse_done, 0));
+
+        // This chunk's pairs go to its own sub-accumulator, once the update stream has emptied it
+        int slot = chunk_index % live.slot_count;
+        gpuErrorCheck(cudaStreamWaitEvent(*p.stream_cur, live.sub_cleared[slot], 0));
+
+        double work_bytes = 0.0;
+        double work_flops = 0.0;
+        if (p.timer != NULL)
+            differenceWork(p, frames_in_chunk, p.tau_count, work_bytes, work_flops);
+
+        timeStage(p.timer, STAGE_DIFFERENCE, *p.stream_cur, work_bytes, work_flops, [&] {
+            analyseChunk(p.d_start_list, p.d_end_list, live.d_sub_list[slot], p.scale_count, p.scale_vector, p.tile_overlap,
+                         0, frames_in_chunk, 0, frames_in_chunk + frames_in_next, C, p.tau_count, p.d_tau_vector,
+                         p.half_precision, *p.stream_cur);
+        });
+
+        gpuErrorCheck(cudaEventRecord(live.chunk_added, *p.stream_cur));
+        gpuErrorCheck(cudaStreamWaitEvent(live.update_stream, live.chunk_added, 0));
+
+        // window after this chunk: chunks (chunk_index - window_chunks, chunk_index]
+        int expired = (chunk_index >= live.window_chunks) ? (chunk_index - live.window_chunks) % live.slot_count : -1;
+        float *d_expired = (expired >= 0) ? live.d_sub_list[expired][0] : NULL;
+        float *d_total = live.d_total_list[0];
+
+        if ((chunk_index + 1) % (live.window_chunks * LIVE_REBUILD_CYCLES) == 0) {
+            // exact re-sum of the window, the expired slot is only cleared
+            gpuErrorCheck(cudaMemsetAsync(d_total, 0, sizeof(float) * live.accum_count, live.update_stream));
+            for (int k = std::max(0, chunk_index - live.window_chunks + 1); k <= chunk_index; k++) {
+                updateLiveAccum<<<gridDim, blockDim, 0, live.update_stream>>>(d_total, live.d_sub_list[k % live.slot_count][0], NULL, live.accum_count);
+            }
+            if (d_expired != NULL)
+                gpuErrorCheck(cudaMemsetAsync(d_expired, 0, sizeof(float) * live.accum_count, live.update_stream));
         } else {
-            cap = cv::VideoCapture(file_in);
+            updateLiveAccum<<<gridDim, blockDim, 0, live.update_stream>>>(d_total, live.d_sub_list[slot][0], d_expired, live.accum_count);
         }
+        gpuErrorCheck(cudaPeekAtLastError());
 
-        conditionAssert(cap.isOpened(), "error opening video file with openCV", true);
+        if (expired >= 0) {
+            gpuErrorCheck(cudaEventRecord(live.sub_cleared[expired], live.update_stream));
+            window_frames -= live.sub_frames[expired];
+            live.sub_frames[expired] = 0;
+        }
+        live.sub_frames[slot] = frames_in_chunk;
+        window_frames += frames_in_chunk;
 
-        info.w = cap.get(cv::CAP_PROP_FRAME_WIDTH);
-        info.h = cap.get(cv::CAP_PROP_FRAME_HEIGHT);
-        info.fps = static_cast<float>(cap.get(cv::CAP_PROP_FPS)); // cast from double to float
+        if ((chunk_index + 1) % publish_every == 0) {
+            publish(live, window_frames, snapshot++);
+        }
 
-        cv::Mat test_img;
-        cap >> test_img;
+        gpuErrorCheck(cudaStreamSynchronize(*p.stream_nxt));
 
-        // Due to the difficulty in dealing with many image types, we only
-        // deal with multi-channel data if image is CV_8U (i.e. uchar)
-        int type = test_img.type();
-        info.bpp = (type % 8) ? 1 : test_img.channels();
+        swap<void>(p.d_workspace_cur, p.d_workspace_nxt);
+        swap<cudaStream_t>(p.stream_cur, p.stream_nxt);
 
-        if (!use_webcam)
-            cap = cv::VideoCapture(file_in); // re-open so can view first frame again
+        rotateThreePtr<void*>(p.d_junk_list, p.d_start_list, p.d_end_list);
+        rotateThreePtr<unsigned char>(p.d_used, p.d_ready, p.d_idle);
+    }
 
-        // Offset the video by frame_offset frames
-        for (int i = 0; i < frame_offset; i++) {
-        	cap >> test_img;
+    if (live_stop)
+        verbose("[Live] interrupted after %d snapshots\n", snapshot);
+}
+
+
+////////////////////////////////////////////////////////////////////////////////
+//  Sliding windows of one episode: frames [0, frame_count) are streamed once, in
+//  hops of hop_chunks chunks, and window k covers hops [k, k + window_chunks).
+//  Every hop accumulates into its own sub-accumulator, which is added to the
+//  window total and subtracted once it drops out of the window, so the cost
+//  does not depend on the overlap of the windows. The pairs of a hop's last
+//  chunk that reach into the next hop do not belong to the window ending with
+//  the hop, they go to the cross accumulator and are added to the total (and to
+//  the hop's sub-accumulator) once that window has been published. Each window
+//  total thus holds exactly the pairs of a disjoint window at its position.
+////////////////////////////////////////////////////////////////////////////////
+void streamSliding(chunk_pipeline_struct &p,
+                   live_accum_struct &live,
+                   int hop_chunks,
+                   int frame_count,
+                   int max_tau,
+                   const publish_function &publish) {
+
+    const int C = p.chunk_frame_count;
+    const int chunk_count = (frame_count + C - 1) / C;
+    const int hop_count = (chunk_count + hop_chunks - 1) / hop_chunks;
+
+    auto chunkFrames = [&](int k) { return (k < chunk_count) ? std::min(C, frame_count - k * C) : 0; };
+
+    dim3 blockDim(BLOCKSIZE);
+    dim3 gridDim(static_cast<unsigned int>((live.accum_count + BLOCKSIZE - 1) / BLOCKSIZE));
+
+    copyChunkToDevice(p, p.d_idle, 0, chunkFrames(0));
+    parseChunk(p.d_idle, p.d_start_list, p.d_workspace_cur, p.d_bands, p.scale_vector, p.scale_count, p.tile_overlap, chunkFrames(0),
+               p.info, p.preprocess, p.fft_plan_list, p.half_precision, *p.stream_cur, p.timer);
+    gpuErrorCheck(cudaStreamSynchronize(*p.stream_cur));
+
+    int window_frames = 0;
+
+    for (int chunk_index = 0; chunk_index < chunk_count; chunk_index++) {
+        int frames_in_chunk = chunkFrames(chunk_index);
+        int frames_in_next  = chunkFrames(chunk_index + 1);
+
+        int hop  = chunk_index / hop_chunks;
+        int slot = hop % live.slot_count;
+        bool last_of_hop = ((chunk_index + 1) % hop_chunks == 0) || (chunk_index == chunk_count - 1);
+
+        verbose("  [Processing chunk %d out of total %d (hop %d)]\n", chunk_index + 1, chunk_count, hop);
+
+        if (frames_in_next > 0) {
+            copyChunkToDevice(p, p.d_ready, (chunk_index + 1) * C, frames_in_next);
+            parseChunk(p.d_ready, p.d_end_list, p.d_workspace_cur, p.d_bands, p.scale_vector, p.scale_count, p.tile_overlap, frames_in_next,
+                       p.info, p.preprocess, p.fft_plan_list, p.half_precision, *p.stream_cur, p.timer);
+        }
+
+        gpuErrorCheck(cudaEventRecord(p.parse_done, *p.stream_cur));
+        gpuErrorCheck(cudaStreamWaitEvent(*p.stream_nxt, p.parse_done, 0));
+
+        // the chunks of a hop share its sub-accumulator, so are accumulated one after the other,
+        // the first of them once the update stream has emptied the slot
+        gpuErrorCheck(cudaStreamWaitEvent(*p.stream_cur, live.chunk_added, 0));
+        if (chunk_index % hop_chunks == 0)
+            gpuErrorCheck(cudaStreamWaitEvent(*p.stream_cur, live.sub_cleared[slot], 0));
+
+        bool cross = last_of_hop && frames_in_next > 0;
+        int own_limit = last_of_hop ? frames_in_chunk : frames_in_chunk + frames_in_next;
+
+        double work_bytes = 0.0;
+        double work_flops = 0.0;
+        if (p.timer != NULL)
+            differenceWork(p, frames_in_chunk, p.tau_count, work_bytes, work_flops);
+
+        timeStage(p.timer, STAGE_DIFFERENCE, *p.stream_cur, work_bytes, work_flops, [&] {
+            analyseChunk(p.d_start_list, p.d_end_list, live.d_sub_list[slot], p.scale_count, p.scale_vector, p.tile_overlap,
+                         0, frames_in_chunk, 0, own_limit, C, p.tau_count, p.d_tau_vector,
+                         p.half_precision, *p.stream_cur);
+
+            if (cross) {
+                gpuErrorCheck(cudaStreamWaitEvent(*p.stream_cur, live.cross_cleared, 0));
+                analyseChunk(p.d_start_list, p.d_end_list, live.d_cross_list, p.scale_count, p.scale_vector, p.tile_overlap,
+                             std::max(0, frames_in_chunk - max_tau), frames_in_chunk, frames_in_chunk,
+                             frames_in_chunk + frames_in_next, C, p.tau_count, p.d_tau_vector,
+                             p.half_precision, *p.stream_cur);
+            }
+        });
+
+        gpuErrorCheck(cudaEventRecord(live.chunk_added, *p.stream_cur));
+        gpuErrorCheck(cudaStreamWaitEvent(live.update_stream, live.chunk_added, 0));
+
+        live.sub_frames[slot] += frames_in_chunk;
+
+        if (last_of_hop) {
+            // window after this hop: hops (hop - window_chunks, hop]
+            int expired = (hop >= live.window_chunks) ? (hop - live.window_chunks) % live.slot_count : -1;
+            float *d_expired = (expired >= 0) ? live.d_sub_list[expired][0] : NULL;
+            float *d_total = live.d_total_list[0];
+
+            if ((hop + 1) % (live.window_chunks * LIVE_REBUILD_CYCLES) == 0) {
+                // exact re-sum of the window, the expired slot is only cleared
+                gpuErrorCheck(cudaMemsetAsync(d_total, 0, sizeof(float) * live.accum_count, live.update_stream));
+                for (int h = std::max(0, hop - live.window_chunks + 1); h <= hop; h++) {
+                    updateLiveAccum<<<gridDim, blockDim, 0, live.update_stream>>>(d_total, live.d_sub_list[h % live.slot_count][0], NULL, live.accum_count);
+                }
+                if (d_expired != NULL)
+                    gpuErrorCheck(cudaMemsetAsync(d_expired, 0, sizeof(float) * live.accum_count, live.update_stream));
+            } else {
+                updateLiveAccum<<<gridDim, blockDim, 0, live.update_stream>>>(d_total, live.d_sub_list[slot][0], d_expired, live.accum_count);
+            }
+            gpuErrorCheck(cudaPeekAtLastError());
+
+            if (expired >= 0) {
+                gpuErrorCheck(cudaEventRecord(live.sub_cleared[expired], live.update_stream));
+                window_frames -= live.sub_frames[expired];
+                live.sub_frames[expired] = 0;
+            }
+            window_frames += live.sub_frames[slot];
+
+            // a run shorter than one window still publishes the window of all its hops
+            if (hop >= live.window_chunks - 1 || hop == hop_count - 1) {
+                publish(live, window_frames, std::max(0, hop - live.window_chunks + 1));
+            }
+
+            if (cross) {
+                updateLiveAccum<<<gridDim, blockDim, 0, live.update_stream>>>(d_total, live.d_cross_list[0], NULL, live.accum_count);
+                updateLiveAccum<<<gridDim, blockDim, 0, live.update_stream>>>(live.d_sub_list[slot][0], live.d_cross_list[0], NULL, live.accum_count);
+                gpuErrorCheck(cudaPeekAtLastError());
+                gpuErrorCheck(cudaMemsetAsync(live.d_cross_list[0], 0, sizeof(float) * live.accum_count, live.update_stream));
+                gpuErrorCheck(cudaEventRecord(live.cross_cleared, live.update_stream));
+            }
         }
+
+        gpuErrorCheck(cudaStreamSynchronize(*p.stream_nxt));
+
+        swap<void>(p.d_workspace_cur, p.d_workspace_nxt);
+        swap<cudaStream_t>(p.stream_cur, p.stream_nxt);
+
+        rotateThreePtr<void*>(p.d_junk_list, p.d_start_list, p.d_end_list);
+        rotateThreePtr<unsigned char>(p.d_used, p.d_ready, p.d_idle);
     }
+}
 
 
-    if (use_index_fps) { // if flag to use frame indices as frame-rate (same as setting FPS to 1)
-        info.fps = 1.0;
+///////////////////////////////////////////////////////
+// Wiener-Khinchin engine. Instead of forming the differences of
+// every frame pair, the FFT frames of a whole window are kept on
+// device and per Fourier pixel
+//     D(tau) = sum |F(t)|^2 terms - 2 Re sum_t F*(t) F(t + tau)
+// is evaluated with a zero padded temporal FFT, so the cost hardly
+// depends on the number of tau values.
+///////////////////////////////////////////////////////
+struct wk_engine_struct {
+    int store_frames;           // frames the window store holds (multiple of the chunk size)
+    cufftComplex *d_store;      // FFT frames of the current window, all scales
+    void **d_store_list;        // per-scale start of d_store
+    cufftComplex *d_pad;        // WK_BATCH_ELEMENTS zero padded time series
+    float *d_sum;               // intensity terms, tau_count x pixels per batch
+    std::map<std::pair<int, int>, cufftHandle> plans; // temporal C2C plans by (length, batch)
+};
+
+
+// Zero padded length of the temporal FFT of a window, long enough that the correlation does not wrap
+inline int wkLength(int frame_count) {
+    int L = 1;
+    while (L < 2 * frame_count - 1)
+        L *= 2;
+    return L;
+}
+
+
+// Temporal plan of length L over batch pixel columns of a (L x batch) buffer
+cufftHandle getWKPlan(wk_engine_struct &wk, int L, int batch) {
+    std::pair<int, int> key(L, batch);
+    auto found = wk.plans.find(key);
+    if (found != wk.plans.end())
+        return found->second;
+
+    cufftHandle plan;
+    int n[1] = {L};
+    int plan_code = cufftPlanMany(&plan, 1, n, n, batch, 1, n, batch, 1, CUFFT_C2C, batch);
+    conditionAssert(plan_code == CUFFT_SUCCESS, "temporal cuFFT plan failure", true);
+
+    wk.plans[key] = plan;
+    return plan;
+}
+
+
+////////////////////////////////////////////////////////////////////////////////
+//  Wiener-Khinchin counterpart of streamFrames for one window: the window's
+//  frames [first_frame, first_frame + frame_count) are FFT'd into the window
+//  store, then the structure function of every pixel and tau is added to the
+//  episode's accumulators and the episode is flushed.
+////////////////////////////////////////////////////////////////////////////////
+void streamWindowWK(chunk_pipeline_struct &p,
+                    wk_engine_struct &wk,
+                    int first_frame,
+                    int frame_count,
+                    episode_accum_struct &ep,
+                    int window_index,
+                    const flush_function &flush) {
+
+    const int C = p.chunk_frame_count;
+    const int main_scale = p.scale_vector[0];
+    cudaStream_t stream = *p.stream_cur;
+
+    conditionAssert(frame_count <= wk.store_frames, "window does not fit the Wiener-Khinchin window store", true);
+
+    // spatial FFT of every chunk straight into the window store
+    std::vector<void *> chunk_list(p.scale_count);
+
+    for (int chunk_start = 0; chunk_start < frame_count; chunk_start += C) {
+        int frames_in_chunk = std::min(C, frame_count - chunk_start);
+
+        verbose("  [Processing chunk %d out of total %d (frames %d-%d)]\n", chunk_start / C + 1, (frame_count + C - 1) / C,
+                first_frame + chunk_start, first_frame + chunk_start + frames_in_chunk - 1);
+
+        for (int s = 0; s < p.scale_count; s++) {
+            int scale = p.scale_vector[s];
+            int frame_size = (scale / 2 + 1) * scale * tileCount(scale, main_scale, p.tile_overlap);
+            chunk_list[s] = static_cast<cufftComplex *>(wk.d_store_list[s]) + static_cast<size_t>(chunk_start) * frame_size;
+        }
+
+        copyChunkToDevice(p, p.d_idle, first_frame + chunk_start, frames_in_chunk);
+        parseChunk(p.d_idle, chunk_list.data(), p.d_workspace_cur, p.d_bands, p.scale_vector, p.scale_count, p.tile_overlap, frames_in_chunk,
+                   p.info, p.preprocess, p.fft_plan_list, false, stream, p.timer);
     }
-    if (use_explicit_fps) { // if flag to explicitly specify the video frame-rate
-    	info.fps = explicit_fps;
+
+    // temporal autocorrelation, in batches of pixel columns
+    int L = wkLength(frame_count);
+
+    // modelled as two complex FFTs of length L per pixel, each pass reading and writing the padded series
+    double wk_pixels = 0.0;
+    for (int s = 0; s < p.scale_count; s++) {
+        int scale = p.scale_vector[s];
+        wk_pixels += static_cast<double>((scale / 2 + 1) * scale) * tileCount(scale, main_scale, p.tile_overlap);
+    }
+    double wk_flops = wk_pixels * 2.0 * 5.0 * L * std::log2(static_cast<double>(L));
+    double wk_bytes = wk_pixels * L * sizeof(cufftComplex) * 8.0;
+
+    timeStage(p.timer, STAGE_DIFFERENCE, stream, wk_bytes, wk_flops, [&] {
+        for (int s = 0; s < p.scale_count; s++) {
+            int scale = p.scale_vector[s];
+            int frame_size = (scale / 2 + 1) * scale * tileCount(scale, main_scale, p.tile_overlap);
+            float fft_norm = 1.0f / (scale * scale);
+
+            int batch = std::max(1, std::min(frame_size, WK_BATCH_ELEMENTS / L));
+            cufftHandle plan = getWKPlan(wk, L, batch);
+            cufftSetStream(plan, stream);
+
+            const cufftComplex *d_store = static_cast<const cufftComplex *>(wk.d_store_list[s]);
+            size_t pad_count = static_cast<size_t>(L) * batch;
+
+            for (int base = 0; base < frame_size; base += batch) {
+                int pixel_count = std::min(batch, frame_size - base);
+                dim3 gridDim((pixel_count + BLOCKSIZE - 1) / BLOCKSIZE);
+
+                kernelWKLoad<<<gridDim, BLOCKSIZE, 0, stream>>>(d_store, wk.d_pad, wk.d_sum, p.d_tau_vector, p.tau_count,
+                                                                frame_size, base, pixel_count, batch, frame_count, L);
+
+                int exe_code = cufftExecC2C(plan, wk.d_pad, wk.d_pad, CUFFT_FORWARD);
+                conditionAssert(exe_code == CUFFT_SUCCESS, "temporal cuFFT execution failed", true);
+
+                kernelWKPower<<<static_cast<unsigned int>((pad_count + BLOCKSIZE - 1) / BLOCKSIZE), BLOCKSIZE, 0, stream>>>(wk.d_pad, pad_count);
+
+                exe_code = cufftExecC2C(plan, wk.d_pad, wk.d_pad, CUFFT_INVERSE);
+                conditionAssert(exe_code == CUFFT_SUCCESS, "temporal cuFFT execution failed", true);
+
+                kernelWKAccum<<<gridDim, BLOCKSIZE, 0, stream>>>(wk.d_pad, wk.d_sum, ep.d_accum_list_1[s], p.d_tau_vector, p.tau_count,
+                                                                 frame_size, base, pixel_count, batch, frame_count, L,
+                                                                 fft_norm * fft_norm);
+            }
+        }
+    });
+
+    ep.frames_accumulated += frame_count;
+    flush(ep, window_index, false);
+}
+
+
+///////////////////////////////////////////////////////
+// Spatial FFT plans of all scales. The plans do not allocate
+// their own work areas, they share one sized to the largest
+// requirement: plans run one after the other (the streams are
+// ordered by the parse_done event), never concurrently. For
+// the same reason the scales share one buffer for the bands
+// of overlapping tiles.
+///////////////////////////////////////////////////////
+struct fft_plan_set_struct {
+    int scale_count;
+    cufftHandle *plans;
+    void *d_work_area;
+    size_t work_size;
+    void *d_bands;          // FFT input of overlapping tiles, NULL without overlap
+    size_t bands_size;
+};
+
+
+// Batched R2C layout of scale [scale], see parseChunk
+struct fft_plan_layout_struct {
+    int n[2];
+    int inembed[2];
+    int onembed[2];
+    int idist;
+    int odist;
+    int batch_count;
+};
+
+
+fft_plan_layout_struct fftPlanLayout(int scale, int main_scale, int chunk_frame_count, int tile_overlap) {
+    // The input is the row-major main scale frame. One execution covers one tile column:
+    // tile rows of all frames are evenly spaced (scale rows apart), as are the outputs
+    // of a column (tiles_per_side tiles apart), the column is chosen by pointer offset.
+    // Overlapping tiles are read from their gathered bands, which have the same spacing
+    int tiles_per_side = tilesPerSide(scale, main_scale, tile_overlap);
+
+    fft_plan_layout_struct layout;
+    layout.n[0]        = scale;
+    layout.n[1]        = scale;
+    layout.inembed[0]  = scale;
+    layout.inembed[1]  = main_scale;
+    layout.onembed[0]  = scale;
+    layout.onembed[1]  = scale / 2 + 1;
+    layout.idist       = scale * main_scale;
+    layout.odist       = scale * (scale / 2 + 1) * tiles_per_side;
+    layout.batch_count = chunk_frame_count * tiles_per_side;
+    return layout;
+}
+
+
+// Samples of the largest band buffer of a frame with overlapping tiles, 0 without overlap
+size_t bandSamples(int *scale_vector, int scale_count, int tile_overlap) {
+    size_t samples = 0;
+
+    for (int s = 1; tile_overlap > 1 && s < scale_count; s++) {
+        int scale = scale_vector[s];
+        samples = std::max(samples, static_cast<size_t>(tilesPerSide(scale, scale_vector[0], tile_overlap)) * scale * scale_vector[0]);
     }
+    return samples;
+}
+
+
+// Largest cuFFT work area of the scales' plans for chunks of chunk_frame_count frames (estimate)
+size_t estimateFFTWorkArea(int *scale_vector, int scale_count, int chunk_frame_count, int tile_overlap) {
+    size_t work_size = 0;
+
+    for (int s = 0; s < scale_count; s++) {
+        fft_plan_layout_struct l = fftPlanLayout(scale_vector[s], scale_vector[0], chunk_frame_count, tile_overlap);
+
+        size_t mem_usage = 0;
+        int esti_code = cufftEstimateMany(2, l.n, l.inembed, 1, l.idist, l.onembed, 1, l.odist, CUFFT_R2C, l.batch_count, &mem_usage);
+        conditionAssert(esti_code == CUFFT_SUCCESS, "error estimating cuFFT plan memory usage", true);
+
+        work_size = std::max(work_size, mem_usage);
+    }
+    return work_size;
+}
+
+
+void createFFTPlans(fft_plan_set_struct &set, int *scale_vector, int scale_count, int chunk_frame_count, int tile_overlap, bool half_precision) {
+    set.scale_count = scale_count;
+    set.plans = new cufftHandle[scale_count];
+    set.work_size = 0;
+
+    for (int s = 0; s < scale_count; s++) {
+        fft_plan_layout_struct l = fftPlanLayout(scale_vector[s], scale_vector[0], chunk_frame_count, tile_overlap);
+        size_t mem_usage = 0;
+
+        verbose("FFT Plan Info:\n");
+        verbose("\tn: (%d, %d), inembed: (%d, %d), onembed: (%d, %d), idist, odist: (%d, %d), batch: %d%s\n", l.n[0], l.n[1], l.inembed[0], l.inembed[1], l.onembed[0], l.onembed[1], l.idist, l.odist, l.batch_count,
+                half_precision ? " (half precision)" : "");
+
+        int create_code = cufftCreate(&set.plans[s]);
+        int alloc_code  = cufftSetAutoAllocation(set.plans[s], 0);
+        conditionAssert(create_code == CUFFT_SUCCESS && alloc_code == CUFFT_SUCCESS, "cuFFT plan creation failure", true);
+
+        int plan_code;
+        if (half_precision) {
+            long long n_ll[2]       = {l.n[0], l.n[1]};
+            long long inembed_ll[2] = {l.inembed[0], l.inembed[1]};
+            long long onembed_ll[2] = {l.onembed[0], l.onembed[1]};
+
+            plan_code = cufftXtMakePlanMany(set.plans[s], 2, n_ll, inembed_ll, 1, l.idist, CUDA_R_16F,
+                                            onembed_ll, 1, l.odist, CUDA_C_16F, l.batch_count, &mem_usage, CUDA_C_16F);
+        } else {
+            plan_code = cufftMakePlanMany(set.plans[s], 2, l.n, l.inembed, 1, l.idist, l.onembed, 1, l.odist, CUFFT_R2C, l.batch_count, &mem_usage);
+        }
+        conditionAssert(plan_code == CUFFT_SUCCESS, "main cuFFT plan failure", true);
+
+        set.work_size = std::max(set.work_size, mem_usage);
+    }
+
+    gpuErrorCheck(cudaMalloc(&set.d_work_area, std::max(set.work_size, static_cast<size_t>(1))));
+
+    for (int s = 0; s < scale_count; s++) {
+        int area_code = cufftSetWorkArea(set.plans[s], set.d_work_area);
+        conditionAssert(area_code == CUFFT_SUCCESS, "cuFFT work area failure", true);
+    }
+
+    verbose("Shared cuFFT work area: %f GB\n", set.work_size / (float) 1073741824);
+
+    set.bands_size = (half_precision ? sizeof(__half) : sizeof(float)) * chunk_frame_count * bandSamples(scale_vector, scale_count, tile_overlap);
+    set.d_bands = NULL;
+
+    if (set.bands_size > 0) {
+        gpuErrorCheck(cudaMalloc(&set.d_bands, set.bands_size));
+        verbose("Overlapping tile bands: %f GB\n", set.bands_size / (float) 1073741824);
+    }
+}
+
+
+void destroyFFTPlans(fft_plan_set_struct &set) {
+    for (int s = 0; s < set.scale_count; s++) {
+        cufftDestroy(set.plans[s]);
+    }
+    delete[] set.plans;
+    cudaFree(set.d_work_area);
+    cudaFree(set.d_bands);
+}
+
+
+///////////////////////////////////////////////////////
+// Resources kept between runs of an engine (DDMEngine):
+// released device and pinned host buffers are kept by size
+// and handed out again, plan sets and analysis contexts by a
+// key of the parameters they were built for. Runs of the
+// same configuration therefore allocate, plan and build the
+// ring index only once. With cache NULL every resource is
+// created and released directly.
+///////////////////////////////////////////////////////
+struct engine_cache_struct {
+    int device;
+    std::multimap<size_t, void *> device_free;
+    std::multimap<size_t, void *> host_free;
+    std::map<void *, size_t> sizes;                 // every buffer the cache owns
+    std::multimap<std::string, fft_plan_set_struct> plans_free;
+    std::multimap<std::string, std::pair<int, analysis_context_struct>> contexts_free; // (scale count, context)
+};
+
+
+engine_cache_struct *createEngineCache(int device) {
+    engine_cache_struct *cache = new engine_cache_struct;
+    cache->device = device;
+    return cache;
+}
+
+
+template <typename T>
+void deviceAlloc(engine_cache_struct *cache, T **ptr, size_t bytes) {
+    if (cache != NULL) {
+        auto it = cache->device_free.find(bytes);
+        if (it != cache->device_free.end()) {
+            *ptr = static_cast<T *>(it->second);
+            cache->device_free.erase(it);
+            return;
+        }
+    }
+
+    gpuErrorCheck(cudaMalloc((void **) ptr, bytes));
+    if (cache != NULL)
+        cache->sizes[*ptr] = bytes;
+}
+
+
+void deviceRelease(engine_cache_struct *cache, void *ptr) {
+    if (ptr == NULL)
+        return;
+
+    if (cache != NULL) {
+        cache->device_free.insert({cache->sizes.at(ptr), ptr});
+    } else {
+        cudaFree(ptr);
+    }
+}
+
+
+template <typename T>
+void hostAlloc(engine_cache_struct *cache, T **ptr, size_t bytes) {
+    if (cache != NULL) {
+        auto it = cache->host_free.find(bytes);
+        if (it != cache->host_free.end()) {
+            *ptr = static_cast<T *>(it->second);
+            cache->host_free.erase(it);
+            return;
+        }
+    }
+
+    gpuErrorCheck(cudaHostAlloc((void **) ptr, bytes, cudaHostAllocDefault));
+    if (cache != NULL)
+        cache->sizes[*ptr] = bytes;
+}
+
+
+void hostRelease(engine_cache_struct *cache, void *ptr) {
+    if (cache != NULL) {
+        cache->host_free.insert({cache->sizes.at(ptr), ptr});
+    } else {
+        cudaFreeHost(ptr);
+    }
+}
+
+
+// Plan set for [key] (scales, tile overlap, chunk size and precision), planned only if none is cached
+void acquireFFTPlans(engine_cache_struct *cache, const std::string &key, fft_plan_set_struct &set,
+                     int *scale_vector, int scale_count, int chunk_frame_count, int tile_overlap, bool half_precision) {
+    if (cache != NULL) {
+        auto it = cache->plans_free.find(key);
+        if (it != cache->plans_free.end()) {
+            set = it->second;
+            cache->plans_free.erase(it);
+            verbose("FFT plans reused.\n");
+            return;
+        }
+    }
+    createFFTPlans(set, scale_vector, scale_count, chunk_frame_count, tile_overlap, half_precision);
+}
+
+
+void releaseFFTPlans(engine_cache_struct *cache, const std::string &key, fft_plan_set_struct &set) {
+    if (cache != NULL) {
+        cache->plans_free.insert({key, set});
+    } else {
+        destroyFFTPlans(set);
+    }
+}
+
+
+void acquireAnalysisContext(engine_cache_struct *cache, const std::string &key, analysis_context_struct &ctx,
+                            int *scale_arr, int scale_count, int tile_overlap, float *lambda_arr, int lambda_count,
+                            int *tau_arr, int tau_count, float fps, float mask_tolerance,
+                            bool enable_angle_analysis, int angle_count, int staging_count, bool fit_curves) {
+    if (cache != NULL) {
+        auto it = cache->contexts_free.find(key);
+        if (it != cache->contexts_free.end()) {
+            ctx = it->second.second;
+            cache->contexts_free.erase(it);
+            verbose("Ring indices reused.\n");
+            return;
+        }
+    }
+    initAnalysisContext(ctx, scale_arr, scale_count, tile_overlap, lambda_arr, lambda_count, tau_arr, tau_count, fps,
+                        mask_tolerance, enable_angle_analysis, angle_count, staging_count, fit_curves);
+}
+
+
+void releaseAnalysisContext(engine_cache_struct *cache, const std::string &key, analysis_context_struct &ctx, int scale_count) {
+    if (cache != NULL) {
+        cache->contexts_free.insert({key, {scale_count, ctx}});
+    } else {
+        freeAnalysisContext(ctx, scale_count);
+    }
+}
+
+
+void destroyEngineCache(engine_cache_struct *cache) {
+    gpuErrorCheck(cudaSetDevice(cache->device));
+
+    for (auto &plans : cache->plans_free) {
+        destroyFFTPlans(plans.second);
+    }
+    for (auto &ctx : cache->contexts_free) {
+        freeAnalysisContext(ctx.second.second, ctx.second.first);
+    }
+    for (auto &buffer : cache->device_free) {
+        cudaFree(buffer.second);
+    }
+    for (auto &buffer : cache->host_free) {
+        cudaFreeHost(buffer.second);
+    }
+    delete cache;
+}
+
+
+///////////////////////////////////////////////////////
+// Work of one device in a multi-GPU run. In window mode a
+// device handles whole windows (or, in single-pass mode,
+// whole episodes). In frame-split mode every device takes a
+// slice of every window's frames plus a tau halo, and the
+// partial accumulators are summed on device 0 before analysis.
+///////////////////////////////////////////////////////
+struct window_unit_struct {
+    int episode;
+    int window;
+};
+
+
+struct device_group_struct {
+    int device_count;
+    std::mutex mtx;
+    std::condition_variable cv;
+    int arrived;
+    int generation;
+    std::vector<float *> d_accum;   // first accumulator copy (all scales) published by each device
+    std::vector<int> frames;        // frames accumulated by each device
+};
+
+
+struct device_task_struct {
+    int device;
+    bool split_frames;
+    std::vector<window_unit_struct> windows;    // windows handled, in processing order (not single-pass)
+    std::vector<bool> episode_owned;            // episodes handled (single-pass)
+    device_group_struct *group;                 // shared by all devices when split_frames
+};
+
+
+// Blocks until every device of the group has arrived
+void groupBarrier(device_group_struct &group) {
+    std::unique_lock<std::mutex> lock(group.mtx);
+    int generation = group.generation;
+
+    if (++group.arrived == group.device_count) {
+        group.arrived = 0;
+        group.generation++;
+        group.cv.notify_all();
+    } else {
+        group.cv.wait(lock, [&] { return group.generation != generation; });
+    }
+}
+
+
+////////////////////////////////////////////////////////////////////////////////
+//  Main multi-DDM function
+////////////////////////////////////////////////////////////////////////////////
+void runDDMDevice(device_task_struct &task,
+            std::string file_in,
+            std::string file_out,
+            int *tau_vector,
+			int tau_count,
+            float *lambda_arr,
+			int lambda_count,
+            int *scale_vector,
+			int scale_count,
+            int x_offset,
+			int y_offset,
+            int *episode_vector, 
+            int episode_count,   
+            int total_frames,
+			int frame_offset,
+            int chunk_frame_count,
+            bool multistream,
+            bool use_webcam,
+            int webcam_idx,
+            float mask_tolerance,
+			bool use_moviefile,
+			bool use_index_fps,
+			bool use_explicit_fps,
+			float explicit_fps,
+            int dump_accum_after,
+			bool benchmark_mode,
+            bool enable_angle_analysis,
+            int angle_count,
+            bool single_pass,
+            int prefetch_depth,
+            bool half_precision,
+            bool wk_engine,
+            int multitau_points,
+            bool fit_curves,
+            int live_chunks,
+            int checkpoint_interval,
+            bool resume,
+            int tile_overlap,
+            int window_hop,
+            bool gpu_decode,
+            const preprocess_params_struct &preprocess,
+            const ISF_sink_function &sink,
+            benchmark_report_struct *report,
+            const engine_run_struct *engine) {
+
+    auto start_time = std::chrono::high_resolution_clock::now();
+    verbose("[multiDDM Begin]\n");
+
+    // engine runs keep their buffers and plans in the cache and may read frames from host memory
+    engine_cache_struct *cache = (engine != NULL) ? engine->cache : NULL;
+    const host_frames_struct *host_frames = (engine != NULL) ? engine->frames : NULL;
+
+    //////////
+    ///  CUDA Check
+    //////////
+
+    cudaDeviceProp deviceProp;
+    deviceProp.major = 0;
+    deviceProp.minor = 0;
+    int dev = task.device;
+
+    gpuErrorCheck(cudaSetDevice(dev));
+    gpuErrorCheck(cudaGetDeviceProperties(&deviceProp, dev));
+
+    // Get information on CUDA device
+    verbose("[Device Info] Device %d found, %d Multi-Processors, SM %d.%d compute capabilities.\n",
+            dev, deviceProp.multiProcessorCount, deviceProp.major, deviceProp.minor);
+
+    //////////
+    ///  Parameter Check
+    //////////
+
+    verbose("Scale list:\n");
+    for (int s = 0; s < scale_count; s++) {
+        int scale = scale_vector[s];
+        //printf("\t%d\n", scale);
+        conditionAssert(scale > 0 && scale_vector[0] % scale == 0, "scales must divide the largest scale (> 0)", true);
+        conditionAssert(!half_precision || isPowerOfTwo(scale), "half precision FFTs need power of two scales", true);
+        conditionAssert(isSmoothSize(scale), "scale " + std::to_string(scale) + " is not of the form 2^a 3^b 5^c 7^d, its FFT is much slower");
+
+        if (s < scale_count - 1)
+            conditionAssert((scale_vector[s] > scale_vector[s + 1]), "scales should be descending order", true);
+    }
+
+    for (int s = 0; s < scale_count; s++)
+        conditionAssert(tile_overlap >= 1 && scale_vector[s] % tile_overlap == 0, "tile overlap must divide every scale", true);
+
+    verbose("Episode list (time window sizes):\n");
+    for (int e = 0; e < episode_count; e++) {
+        int window_size = episode_vector[e];
+        //printf("\t%d\n", window_size);
+        conditionAssert(window_size >= 0, "Window size should be non-negative", true);
+        
+        if (e < episode_count - 1) {
+            conditionAssert(window_size < episode_vector[e + 1], "Window sizes should be in ascending order", true);
+        }
+        
+        if (window_size == 0) {
+            verbose("Warning: Window with size 0 at position %d will be skipped\n", e+1);
+        } else if (window_size > total_frames) {
+            verbose("Warning: Window size %d exceeds total frame count %d, will analyze all available frames\n", 
+                    window_size, total_frames);
+        }
+    }
+
+    verbose("%d time window sizes.\n", episode_count);
+
+    for (int t = 0; t < tau_count - 1; t++) {
+        conditionAssert((tau_vector[t] >= 0), "Tau values should be positive", true);
+        conditionAssert((tau_vector[t] < tau_vector[t + 1]), "Tau vector should be ascending order", true);
+    }
+
+    for (int q = 0; q < lambda_count - 1; q++) {
+        conditionAssert((lambda_arr[q] >= 0), "q-vector values should be positive", true);
+        conditionAssert((lambda_arr[q] < lambda_arr[q + 1]), "q-vector vector should be ascending order", true);
+    }
+
+    conditionAssert(prefetch_depth >= 2, "prefetch depth must be at least 2 chunks", true);
+
+    conditionAssert(!gpu_decode || (!use_moviefile && !use_webcam && !benchmark_mode && host_frames == NULL),
+            "GPU decoding (-U) reads compressed video files only", true);
+
+    conditionAssert(preprocess.binning >= 1, "binning must be at least 1", true);
+    conditionAssert(preprocess.background_weight >= 0.0f && preprocess.background_weight <= 1.0f,
+            "background weight must be between 0 and 1", true);
+
+    conditionAssert(mask_tolerance < 10 && mask_tolerance > 1.0,
+            "mask_tolerance is likely undesired value, refer to README for more information");
+
+    conditionAssert(lambda_arr[lambda_count-1] <= scale_vector[scale_count-1],
+            "The largest q-vector should be smaller than the smallest scale.", true);
+
+    verbose("%d tau-values.\n", tau_count);
+    verbose("%d q-vector values.\n", lambda_count);
+
+    verbose("Parameter Check Done.\n");
+    //////////
+    ///  Video Setup
+    //////////
+
+    // Web-cam alignment
+    if (use_webcam) {
+        cv::VideoCapture tmp_cap(webcam_idx);
+
+        int main_scale = scale_vector[0];
+
+        while(1) {
+            cv::Mat tmp_frame;
+            tmp_cap >> tmp_frame;
+
+            for (int s = 0; s < scale_count; s++) {
+                int scale = scale_vector[s];
+                int tiles_per_side = tilesPerSide(scale, main_scale, tile_overlap);
+                int tiles_per_frame = tiles_per_side * tiles_per_side;
+                int stride = scale / tile_overlap;
+
+                for (int t = 0; t < tiles_per_frame; t++) {
+                    cv::Rect rect(x_offset + (t / tiles_per_side) * stride + s, y_offset + (t % tiles_per_side) * stride + s, scale, scale); // add s to each to help with readability
+                    cv::rectangle(tmp_frame, rect, cv::Scalar(0, 255, 0));
+                }
+            }
+            cv::imshow( "Web-cam", tmp_frame );
+
+            char c=(char) cv::waitKey(25);
+            if(c==27)
+                break;
+        }
+        tmp_cap.release();
+        cv::destroyAllWindows();
+    }
+
+    video_info_struct info;
+    FILE *moviefile;
+    movie_index_struct movie_index;
+    cv::VideoCapture cap;
+
+    if (benchmark_mode) {
+    	info.w = scale_vector[0] * preprocess.binning;
+    	info.h = scale_vector[0] * preprocess.binning;
+    	info.bpp = 1;
+    	info.fps = 1.0;
+    } else if (host_frames != NULL) { // frames in host memory are read in place
+        info.w   = host_frames->w;
+        info.h   = host_frames->h;
+        info.bpp = host_frames->bpp;
+        info.bytes_per_sample = host_frames->bpp;
+        info.fps = host_frames->fps;
+
+        conditionAssert(host_frames->bpp == 1 || host_frames->bpp == 2, "host frames must be 8 or 16-bit single channel", true);
+        conditionAssert(frame_offset + total_frames <= host_frames->frame_count, "fewer host frames passed than requested", true);
+    } else if (use_moviefile) { // if we have a movie-file we use custom handler
+        moviefile = fopen(file_in.c_str(), "rb");
+        conditionAssert(moviefile != NULL, "couldn't open .movie file", true);
+        info = initFile(moviefile, frame_offset);
+        fclose(moviefile);
+
+        openMovieIndex(movie_index, file_in.c_str(), info);
+        conditionAssert(frame_offset + total_frames <= movie_index.frame_count,
+                        "movie file holds fewer frames than requested", true);
+    } else { // for other file types handle with OpenCV
+        if (use_webcam) {
+            cap = cv::VideoCapture(webcam_idx);
+        } else {
+            cap = cv::VideoCapture(file_in);
+        }
+
+        conditionAssert(cap.isOpened(), "error opening video file with openCV", true);
+
+        info.w = cap.get(cv::CAP_PROP_FRAME_WIDTH);
+        info.h = cap.get(cv::CAP_PROP_FRAME_HEIGHT);
+        info.fps = static_cast<float>(cap.get(cv::CAP_PROP_FPS)); // cast from double to float
+
+        cv::Mat test_img;
+        cap >> test_img;
+
+        // Due to the difficulty in dealing with many image types, we only
+        // deal with multi-channel data if image is CV_8U (i.e. uchar)
+        int type = test_img.type();
+        info.bpp = (type % 8) ? 1 : test_img.channels();
+
+        // Single channel 16-bit video is kept at full depth
+        if (type == CV_16UC1) {
+            info.bpp = 2;
+            info.bytes_per_sample = 2;
+        }
+
+        if (!use_webcam)
+            cap = cv::VideoCapture(file_in); // re-open so can view first frame again
+
+        // Offset the video by frame_offset frames (the GPU decoder skips them itself)
+        for (int i = 0; !gpu_decode && i < frame_offset; i++) {
+        	cap >> test_img;
+        }
+    }
+
+
+    if (use_index_fps) { // if flag to use frame indices as frame-rate (same as setting FPS to 1)
+        info.fps = 1.0;
+    }
+    if (use_explicit_fps) { // if flag to explicitly specify the video frame-rate
+    	info.fps = explicit_fps;
+    }
+
+    info.x_off = x_offset;
+    info.y_off = y_offset;
+
+    // Only the analysed main_scale x main_scale region (binned from binning times as many pixels) is read and copied to device
+    info.roi_w = scale_vector[0] * preprocess.binning;
+    info.roi_h = scale_vector[0] * preprocess.binning;
+
+    conditionAssert(info.x_off + info.roi_w <= info.w && info.y_off + info.roi_h <= info.h,
+            "region read exceeds the frame (offsets, largest scale and binning)", true);
+
+    // GPU decoding, frames are cropped on device
+    gpu_decoder_struct *decoder = NULL;
+    if (gpu_decode)
+        decoder = openGPUDecoder(file_in, frame_offset, info);
+
+    verbose("Video Setup Done.\n");
+    //////////
+    ///  Memory Planner
+    //////////
+
+    // The device footprint is modelled on the buffers allocated below, fixed buffers plus buffers
+    // per chunk frame. A run that does not fit in AUTO_CHUNK_MEMORY_FRACTION of the free device
+    // memory degrades step by step instead of failing in cudaMalloc: a single stream with one
+    // shared accumulator copy (as -Z), then smaller chunks (the direct engine down to the largest
+    // tau), then accumulators spilled to mapped pinned host memory that the kernels reach over the
+    // bus. Chunk size 0 is the largest chunk (up to AUTO_CHUNK_MAX_FRAMES) that fits.
+    bool spill_accumulators = false;
+    {
+        int main_scale = scale_vector[0];
+
+        // banks of every accumulator set, live mode and sliding window sub-accumulators (see initLiveAccum)
+        int accum_sets = (single_pass ? episode_count : 1) * 2;
+        int live_sets  = (live_chunks > 0) ? live_chunks + 3 : 0;
+        for (int e = 0; window_hop > 0 && e < episode_count; e++)
+            live_sets = std::max(live_sets, episode_vector[e] / window_hop + 4);
+
+        size_t fft_frame_elements = 0;
+        for (int s = 0; s < scale_count; s++) {
+            int scale = scale_vector[s];
+            fft_frame_elements += static_cast<size_t>((scale / 2 + 1) * scale) * tileCount(scale, main_scale, tile_overlap);
+        }
+
+        size_t sample_bytes = half_precision ? sizeof(__half)  : sizeof(float);
+        size_t fft_bytes    = half_precision ? sizeof(__half2) : sizeof(cufftComplex);
+        size_t set_bytes    = sizeof(float) * fft_frame_elements * tau_count;
+
+        // fixed apart from the accumulators: multi-tau hierarchy, Wiener-Khinchin window store and padded series
+        size_t other_bytes = 0;
+        if (multitau_points > 0) {
+            int levels = 1;
+            while ((tau_vector[tau_count - 1] >> (levels - 1)) >= multitau_points)
+                levels++;
+            other_bytes += sizeof(cufftComplex) * fft_frame_elements * levels * multitau_points * (single_pass ? episode_count : 1);
+        }
+        if (wk_engine) {
+            int max_window = 0;
+            for (window_unit_struct &unit : task.windows) {
+                int window_size = episode_vector[unit.episode];
+                max_window = std::max(max_window, std::min(window_size, total_frames - unit.window * window_size));
+            }
+            other_bytes += sizeof(cufftComplex) * (fft_frame_elements * max_window + WK_BATCH_ELEMENTS);
+        }
+
+        size_t work_area_bytes = estimateFFTWorkArea(scale_vector, scale_count, AUTO_CHUNK_PROBE_FRAMES, tile_overlap) / AUTO_CHUNK_PROBE_FRAMES;
+
+        auto fixedBytes = [&](bool multi, bool spill) {
+            return other_bytes + (spill ? 0 : set_bytes * (accum_sets * (multi ? 2 : 1) + live_sets));
+        };
+
+        // per chunk frame: 3 raw frames, workspace(s), overlapping tile bands, 3 FFT frames and the cuFFT work area
+        auto frameBytesPerChunk = [&](bool multi) {
+            return 3 * frameBytes(info)
+                 + (multi ? 2 : 1) * sample_bytes * main_scale * main_scale
+                 + sample_bytes * bandSamples(scale_vector, scale_count, tile_overlap)
+                 + 3 * fft_bytes * fft_frame_elements
+                 + work_area_bytes;
+        };
+
+        size_t free_memory = 0;
+        size_t total_memory = 0;
+        gpuErrorCheck(cudaMemGetInfo(&free_memory, &total_memory));
+
+        size_t budget = static_cast<size_t>(free_memory * AUTO_CHUNK_MEMORY_FRACTION);
+
+        // the direct engine pairs frames at most one chunk apart, sliding windows hop by whole chunks
+        int min_frames = (wk_engine || multitau_points > 0) ? 1 : std::max(1, tau_vector[tau_count - 1]);
+        int max_frames = (chunk_frame_count > 0) ? chunk_frame_count : std::min(AUTO_CHUNK_MAX_FRAMES, total_frames);
+
+        // largest chunk in [min_frames, max_frames] that fits, 0 if none does
+        auto fittingChunk = [&](bool multi, bool spill) {
+            size_t fixed = fixedBytes(multi, spill);
+            size_t fit   = (budget > fixed) ? (budget - fixed) / frameBytesPerChunk(multi) : 0;
+
+            for (int c = static_cast<int>(std::min(fit, static_cast<size_t>(max_frames))); c >= min_frames; c--) {
+                if (window_hop == 0 || window_hop % c == 0)
+                    return c;
+            }
+            return 0;
+        };
+
+        bool requested_multistream = multistream;
+        size_t requested = fixedBytes(multistream, false) + frameBytesPerChunk(multistream) * (chunk_frame_count > 0 ? chunk_frame_count : min_frames);
+        int chunk = fittingChunk(multistream, false);
+
+        // a single stream is preferred to a smaller chunk than the one requested
+        if (chunk_frame_count > 0 && chunk < chunk_frame_count && multistream && fittingChunk(false, false) == chunk_frame_count) {
+            multistream = false;
+            chunk = chunk_frame_count;
+        }
+
+        if (chunk == 0 && multistream) {
+            multistream = false;
+            chunk = fittingChunk(false, false);
+        }
+
+        if (chunk == 0) {
+            spill_accumulators = true;
+            chunk = fittingChunk(false, true);
+        }
+
+        conditionAssert(chunk > 0, "not enough device memory, the run needs " + std::to_string(requested / 1048576) + " MB and only " +
+                        std::to_string(budget / 1048576) + " MB are usable, even with the accumulators in host memory", true);
+
+        bool degraded = multistream != requested_multistream || spill_accumulators || (chunk_frame_count > 0 && chunk != chunk_frame_count);
+
+        conditionAssert(!degraded, "memory planner: " + std::to_string(requested / 1048576) + " MB needed, " + std::to_string(budget / 1048576) +
+                        " MB usable, running " + (multistream ? "multi-stream" : "single stream (one shared accumulator copy)") +
+                        " with chunks of " + std::to_string(chunk) + " frames" +
+                        (spill_accumulators ? " and the accumulators in pinned host memory (slower)" : ""));
+
+        if (chunk_frame_count == 0) {
+            verbose("Automatic chunk size: %d frames (%f GB free, %f GB per frame)\n", chunk,
+                    free_memory / (float) 1073741824, frameBytesPerChunk(multistream) / (float) 1073741824);
+        }
+
+        chunk_frame_count = chunk;
+    }
+
+    //////////
+    ///  Parameter check
+    //////////
+
+    conditionAssert((scale_vector[0] + info.x_off <= info.w && scale_vector[0] + info.y_off <= info.h),
+            "the specified out dimensions must be smaller than actual image size", true);
+
+    if (wk_engine) {
+        // lags are limited by the window only, the FFT frames of a whole window are kept
+        conditionAssert(!single_pass && !task.split_frames && dump_accum_after == 0 && !half_precision,
+                "the Wiener-Khinchin engine can not be combined with -P, -K, -G or -H", true);
+    } else if (multitau_points > 0) {
+        // lags beyond the ring of frames at full rate are taken from coarser levels, not from the next chunk
+        conditionAssert(!task.split_frames, "multi-tau mode can not be combined with -K", true);
+    } else {
+        conditionAssert((tau_vector[tau_count - 1] <= chunk_frame_count),
+                "the largest tau value must be smaller than number frames in a chunk", true);
+    }
+
+    if (window_hop > 0) {
+        // windows are built from whole hops, hops from whole chunks
+        conditionAssert(window_hop % chunk_frame_count == 0, "the window hop must be a multiple of the chunk size", true);
+        for (int e = 0; e < episode_count; e++) {
+            conditionAssert(episode_vector[e] % window_hop == 0, "window sizes must be multiples of the window hop", true);
+        }
+    }
+
+    if (half_precision) {
+        conditionAssert(info.bytes_per_sample == 1, "half precision FFT mode is only supported for 8-bit video", true);
+        conditionAssert(deviceProp.major * 10 + deviceProp.minor >= 53, "half precision FFT mode needs compute capability 5.3 or later", true);
+    }
+
+    //////////
+    ///  Initialise variables
+    //////////
+
+    const int buffer_frame_count = chunk_frame_count * 3;
+    const int main_scale = scale_vector[0];
+
+    verbose("[Video info - (%d x %d), %d Frames (offset %d), %.4f FPS]\n", info.w, info.h, total_frames, frame_offset, info.fps);
+
+    // streams
+
+    cudaStream_t stream_1, stream_2;
+
+    if (multistream) {
+        cudaStreamCreate(&stream_1);
+        cudaStreamCreate(&stream_2);
+    } else {
+        cudaStreamCreate(&stream_1);
+    }
+
+    // finished accumulators are reduced on their own stream, overlapping the next chunks
+    cudaStream_t analysis_stream;
+    cudaStreamCreate(&analysis_stream);
+
+
+    verbose("Initialise Variables Done.\n");
+    //////////
+    ///  Memory Allocations
+    //////////
+
+    size_t total_host_memory   = 0;
+    size_t total_device_memory = 0;
+
+    // main device buffer
+    size_t buffer_size  = sizeof(unsigned char) * buffer_frame_count * frameBytes(info);
+
+    unsigned char *d_buffer;
+    deviceAlloc(cache, &d_buffer, buffer_size);
+
+    total_device_memory += buffer_size;
+
+    // host buffer, ring of prefetched chunks (none if frames are decoded on device)
+    size_t chunk_size  = sizeof(unsigned char) * chunk_frame_count * frameBytes(info);
+    int host_slots     = (decoder != NULL) ? 0 : prefetch_depth;
+
+    unsigned char *h_chunks = NULL;
+    if (host_slots > 0)
+        hostAlloc(cache, &h_chunks, chunk_size * host_slots);
+    total_host_memory += host_slots * chunk_size;
+
+    if (benchmark_mode) {
+    	verbose("Benchmark mode - filling host buffer with random data.\n");
+    	for (int c = 0; c < host_slots; c++) {
+    		for (size_t i = 0; i < frameBytes(info); i++) {
+    			h_chunks[c * chunk_size + i] = static_cast<unsigned char>(rand() % 255);
+    		}
+    	}
+    }
+    // FFT input and output element sizes
+    size_t sample_size   = half_precision ? sizeof(__half)  : sizeof(float);
+    size_t fft_elem_size = half_precision ? sizeof(__half2) : sizeof(cufftComplex);
+
+    // work space (multi-stream)
+    size_t workspace_size = sample_size * chunk_frame_count * main_scale * main_scale;
+
+    void *d_workspace_1;
+    void *d_workspace_2;
+
+    if (multistream) {
+        deviceAlloc(cache, &d_workspace_1, workspace_size);
+        deviceAlloc(cache, &d_workspace_2, workspace_size);
+        total_device_memory += 2 * workspace_size;
+    } else {
+        deviceAlloc(cache, &d_workspace_1, workspace_size);
+        d_workspace_2= d_workspace_1;
+        total_device_memory += 1 * workspace_size;
+    }
+
+    // FFT buffer
+    size_t fft_buffer_size = 0;
+    for (int s = 0; s < scale_count; s++) {
+        int scale = scale_vector[s];
+        int tiles_per_frame = tileCount(scale, main_scale, tile_overlap);
+        int tile_size = (scale / 2 + 1) * scale;
+
+        fft_buffer_size += fft_elem_size * tile_size * tiles_per_frame * buffer_frame_count;
+    }
+
+    void *d_fft_buffer;
+
+    deviceAlloc(cache, &d_fft_buffer, fft_buffer_size);
+
+    total_device_memory += fft_buffer_size;
+
+    // FFT intensity accumulator (multi-stream) - initial values set to zero
+    size_t accum_size = 0;
+    for (int s = 0; s < scale_count; s++) {
+        int scale = scale_vector[s];
+        int tiles_per_frame = tileCount(scale, main_scale, tile_overlap);
+        accum_size += sizeof(float) * (scale / 2 + 1) * scale * tiles_per_frame * tau_count;
+    }
+
+    // In single-pass mode every episode owns an accumulator set, otherwise episodes
+    // are processed one after another and share one set
+    int accum_set_count = single_pass ? episode_count : 1;
+    int accum_copies = multistream ? 2 : 1;
+    int accum_banks = 2; // one bank accumulates while the other is analysed
+
+    size_t accum_list_count = static_cast<size_t>(accum_set_count) * accum_banks * accum_copies;
+
+    // spilled accumulators are mapped pinned host memory, with unified addressing the host pointer is the device pointer
+    float *d_accum;
+    if (spill_accumulators) {
+        gpuErrorCheck(cudaHostAlloc((void **) &d_accum, accum_size * accum_list_count, cudaHostAllocMapped));
+        memset(d_accum, 0, accum_size * accum_list_count);
+        total_host_memory += accum_size * accum_list_count;
+    } else {
+        deviceAlloc(cache, &d_accum, accum_size * accum_list_count);
+        gpuErrorCheck(cudaMemset(d_accum, 0, accum_size * accum_list_count));
+        total_device_memory += accum_size * accum_list_count;
+    }
+
+    size_t free_memory = 0;
+    size_t total_memory = 0;
+    gpuErrorCheck(cudaMemGetInfo(&free_memory, &total_memory));
+
+    // tau-vector
+    int *d_tau_vector;
+    deviceAlloc(cache, &d_tau_vector, tau_count * sizeof(int));
+    gpuErrorCheck(cudaMemcpy(d_tau_vector, tau_vector, tau_count * sizeof(int), cudaMemcpyHostToDevice));
+    total_device_memory += sizeof(int) * tau_count;
+
+    // Multi-tau frame hierarchy, one per accumulator set. Lags were snapped to the multi-tau
+    // grid by runDDM, a lag's level is the number of halvings that bring it below the point count
+    int multitau_levels = 0;
+    std::vector<int> level_offsets;
+    int *d_level_offsets = NULL;
+    cufftComplex *d_multitau = NULL;
+    size_t multitau_set_elements = 0;
+    size_t multitau_size = 0;
+
+    if (multitau_points > 0) {
+        auto lagLevel = [&](int tau) {
+            int l = 0;
+            while ((tau >> l) >= multitau_points)
+                l++;
+            return l;
+        };
+
+        multitau_levels = lagLevel(tau_vector[tau_count - 1]) + 1;
+
+        level_offsets.assign(multitau_levels + 1, tau_count);
+        for (int k = tau_count - 1; k >= 0; k--) {
+            level_offsets[lagLevel(tau_vector[k])] = k;
+        }
+        for (int l = multitau_levels - 1; l >= 0; l--) { // levels without lags are empty ranges
+            level_offsets[l] = std::min(level_offsets[l], level_offsets[l + 1]);
+        }
+
+        deviceAlloc(cache, &d_level_offsets, sizeof(int) * (multitau_levels + 1));
+        gpuErrorCheck(cudaMemcpy(d_level_offsets, level_offsets.data(), sizeof(int) * (multitau_levels + 1), cudaMemcpyHostToDevice));
+
+        for (int s = 0; s < scale_count; s++) {
+            int scale = scale_vector[s];
+            int tiles_per_frame = tileCount(scale, main_scale, tile_overlap);
+            multitau_set_elements += static_cast<size_t>(multitau_levels) * multitau_points * (scale / 2 + 1) * scale * tiles_per_frame;
+        }
+
+        multitau_size = sizeof(cufftComplex) * multitau_set_elements * (single_pass ? episode_count : 1);
+        deviceAlloc(cache, &d_multitau, multitau_size);
+        total_device_memory += multitau_size + sizeof(int) * (multitau_levels + 1);
+
+        verbose("Multi-tau: %d levels of %d frames\n", multitau_levels, multitau_points);
+    }
+
+    // Wiener-Khinchin window store and temporal FFT buffers
+    wk_engine_struct wk;
+    wk.store_frames = 0;
+    wk.d_store = NULL;
+    wk.d_pad = NULL;
+    wk.d_sum = NULL;
+    wk.d_store_list = new void*[scale_count];
+
+    if (wk_engine) {
+        int max_window = 0;
+        int min_window = INT_MAX;
+        for (window_unit_struct &unit : task.windows) {
+            int window_size = episode_vector[unit.episode];
+            int frames_in_window = std::min(window_size, total_frames - unit.window * window_size);
+            max_window = std::max(max_window, frames_in_window);
+            min_window = std::min(min_window, frames_in_window);
+        }
+
+        // the spatial FFT always writes whole chunks
+        wk.store_frames = std::max(1, (max_window + chunk_frame_count - 1) / chunk_frame_count) * chunk_frame_count;
+
+        size_t store_elements = 0;
+        int max_batch = 1;
+        for (int s = 0; s < scale_count; s++) {
+            int scale = scale_vector[s];
+            int frame_size = (scale / 2 + 1) * scale * tileCount(scale, main_scale, tile_overlap);
+            store_elements += static_cast<size_t>(frame_size) * wk.store_frames;
+            if (min_window > 0)
+                max_batch = std::max(max_batch, std::min(frame_size, WK_BATCH_ELEMENTS / wkLength(min_window)));
+        }
+
+        size_t pad_elements = std::max(static_cast<size_t>(WK_BATCH_ELEMENTS), static_cast<size_t>(wkLength(std::max(max_window, 1))));
+
+        deviceAlloc(cache, &wk.d_store, sizeof(cufftComplex) * store_elements);
+        deviceAlloc(cache, &wk.d_pad, sizeof(cufftComplex) * pad_elements);
+        deviceAlloc(cache, &wk.d_sum, sizeof(float) * tau_count * max_batch);
+
+        total_device_memory += sizeof(cufftComplex) * (store_elements + pad_elements) + sizeof(float) * tau_count * max_batch;
+
+        wk.d_store_list[0] = wk.d_store;
+        for (int s = 0; s < scale_count - 1; s++) {
+            int scale = scale_vector[s];
+            int frame_size = (scale / 2 + 1) * scale * tileCount(scale, main_scale, tile_overlap);
+            wk.d_store_list[s+1] = static_cast<cufftComplex *>(wk.d_store_list[s]) + static_cast<size_t>(frame_size) * wk.store_frames;
+        }
+    }
+
+    verbose("Memory Allocations Done.\n"
+            "Total memory allocated\n"
+            "Device:\n\tExplictly allocated:\t %f GB \n\tTotal allocated:\t %f GB\n\tFree memory remaining:\t %f GB\n"
+            "Host:\t %f GB\n",
+            total_device_memory          / (float) 1073741824,
+            (total_memory - free_memory) / (float) 1073741824,
+            free_memory                  / (float) 1073741824,
+            total_host_memory            / (float) 1073741824);
+
+    //////////
+    ///  FFT Plan
+    //////////
+
+    std::string plan_key = std::to_string(chunk_frame_count) + (half_precision ? "h" : "f") + std::to_string(tile_overlap);
+    for (int s = 0; s < scale_count; s++)
+        plan_key += "," + std::to_string(scale_vector[s]);
+
+    fft_plan_set_struct fft_plans;
+    acquireFFTPlans(cache, plan_key, fft_plans, scale_vector, scale_count, chunk_frame_count, tile_overlap, half_precision);
+    total_device_memory += fft_plans.work_size + fft_plans.bands_size;
+
+    cufftHandle *FFT_plan_list = fft_plans.plans;
+
+    verbose("FFT Plan Done.\n");
+
+    //////////
+    ///  Pointer Allocation
+    //////////
+
+    // FFT buffer & FFT intensity accumulator are scale dependent so we define a array to hold values for each scale
+
+    // pointer to element [offset] of an FFT buffer, elements are float or half complex
+    auto fftOffset = [fft_elem_size](void *ptr, size_t offset) -> void * {
+        return static_cast<char *>(ptr) + offset * fft_elem_size;
+    };
+
+    void **d_fft_buffer_list = new void*[scale_count];
+    d_fft_buffer_list[0] = d_fft_buffer;
+
+    for (int s = 0; s < scale_count - 1; s++) {
+        int scale = scale_vector[s];
+
+        int tile_size = (scale/2 + 1) * scale;
+        int tiles_per_frame = tileCount(scale, main_scale, tile_overlap);
+
+        d_fft_buffer_list[s+1] = fftOffset(d_fft_buffer_list[s], static_cast<size_t>(tiles_per_frame) * tile_size * buffer_frame_count);
+    }
+
+    // Accumulator sets, each holds two banks of per-stream copies of the per-scale accumulators
+    float ***d_accum_lists = new float**[accum_list_count];
+
+    for (size_t a = 0; a < accum_list_count; a++) {
+        d_accum_lists[a] = new float*[scale_count];
+        d_accum_lists[a][0] = d_accum + (accum_size / sizeof(float)) * a;
+
+        for (int s = 0; s < scale_count - 1; s++) {
+            int scale = scale_vector[s];
+
+            int tile_size = (scale/2 + 1) * scale;
+            int tiles_per_frame = tileCount(scale, main_scale, tile_overlap);
+
+            d_accum_lists[a][s+1] = d_accum_lists[a][s] + tiles_per_frame * tile_size * tau_count;
+        }
+    }
+
+    episode_accum_struct *episodes = new episode_accum_struct[episode_count];
+
+    for (int e = 0; e < episode_count; e++) {
+        int set = single_pass ? e : 0;
+
+        episodes[e].window_size        = episode_vector[e];
+        episodes[e].window_first       = 0;
+        episodes[e].window_last        = 0;
+        episodes[e].pair_end           = INT_MAX;
+
+        for (int b = 0; b < accum_banks; b++) {
+            float ***d_bank = d_accum_lists + (set * accum_banks + b) * accum_copies;
+
+            episodes[e].d_bank_list[b][0] = d_bank[0];
+            episodes[e].d_bank_list[b][1] = d_bank[accum_copies - 1];
+            gpuErrorCheck(cudaEventCreateWithFlags(&episodes[e].bank_cleared[b], cudaEventDisableTiming));
+        }
+
+        episodes[e].bank               = 0;
+        episodes[e].d_accum_list_1     = episodes[e].d_bank_list[0][0];
+        episodes[e].d_accum_list_2     = episodes[e].d_bank_list[0][1];
+        episodes[e].frames_accumulated = 0;
+        episodes[e].chunks_accumulated = 0;
+        episodes[e].dump_count         = 0;
+        episodes[e].d_multitau_list    = NULL;
+
+        if (multitau_points > 0) {
+            episodes[e].d_multitau_list = new cufftComplex*[scale_count];
+            episodes[e].d_multitau_list[0] = d_multitau + multitau_set_elements * set;
+
+            for (int s = 0; s < scale_count - 1; s++) {
+                int scale = scale_vector[s];
+                int tiles_per_frame = tileCount(scale, main_scale, tile_overlap);
+                episodes[e].d_multitau_list[s+1] = episodes[e].d_multitau_list[s] + static_cast<size_t>(multitau_levels) * multitau_points * (scale / 2 + 1) * scale * tiles_per_frame;
+            }
+        }
+    }
+
+    chunk_pipeline_struct pipe;
+
+    pipe.scale_vector      = scale_vector;
+    pipe.scale_count       = scale_count;
+    pipe.tile_overlap      = tile_overlap;
+    pipe.tau_count         = tau_count;
+    pipe.d_tau_vector      = d_tau_vector;
+    pipe.chunk_frame_count = chunk_frame_count;
+    pipe.chunk_size        = chunk_size;
+    pipe.multistream       = multistream;
+    pipe.multitau_points   = multitau_points;
+    pipe.multitau_levels   = multitau_levels;
+    pipe.d_level_offsets   = d_level_offsets;
+
+    chunk_prefetch_struct prefetch;
+
+    prefetch.info              = info;
+    prefetch.use_moviefile     = use_moviefile;
+    prefetch.use_webcam        = use_webcam;
+    prefetch.benchmark_mode    = benchmark_mode;
+    prefetch.movie_index       = &movie_index;
+    prefetch.host_frames       = host_frames;
+    prefetch.cap               = cap;
+    prefetch.frame_offset      = frame_offset;
+    prefetch.next_frame        = 0; // video has been positioned at frame_offset during set-up
+    prefetch.chunk_frame_count = chunk_frame_count;
+    prefetch.depth             = host_slots;
+    prefetch.slots             = new chunk_slot_struct[host_slots];
+
+    for (int c = 0; c < host_slots; c++) {
+        prefetch.slots[c].h_chunk = h_chunks + c * chunk_size;
+        gpuErrorCheck(cudaEventCreateWithFlags(&prefetch.slots[c].copied, cudaEventDisableTiming));
+    }
+
+    pipe.info     = info;
+    pipe.prefetch = &prefetch;
+    pipe.decoder  = decoder;
+
+    // fused preprocessing, maps of the region read and the running background (filled from the first frame)
+    preprocess_struct pre;
+    float *d_gain       = NULL;
+    float *d_offset     = NULL;
+    float *d_background = NULL;
+    size_t map_size     = sizeof(float) * info.roi_w * info.roi_h;
+
+    if (!preprocess.gain_file.empty()) {
+        std::vector<float> map = loadPixelMap(preprocess.gain_file, info);
+        deviceAlloc(cache, &d_gain, map_size);
+        gpuErrorCheck(cudaMemcpy(d_gain, map.data(), map_size, cudaMemcpyHostToDevice));
+        total_device_memory += map_size;
+    }
+    if (!preprocess.offset_file.empty()) {
+        std::vector<float> map = loadPixelMap(preprocess.offset_file, info);
+        deviceAlloc(cache, &d_offset, map_size);
+        gpuErrorCheck(cudaMemcpy(d_offset, map.data(), map_size, cudaMemcpyHostToDevice));
+        total_device_memory += map_size;
+    }
+    if (preprocess.background_weight > 0.0f) {
+        deviceAlloc(cache, &d_background, sizeof(float) * main_scale * main_scale);
+        total_device_memory += sizeof(float) * main_scale * main_scale;
+    }
+
+    pre.d_gain            = d_gain;
+    pre.d_offset          = d_offset;
+    pre.d_background      = d_background;
+    pre.background_weight = preprocess.background_weight;
+    pre.background_reset  = true;
+    pre.binning           = preprocess.binning;
+
+    pipe.preprocess      = preprocessEnabled(preprocess) ? &pre : NULL;
+    pipe.background_next = -1;
+
+    pipe.fft_plan_list  = FFT_plan_list;
+    pipe.d_bands        = fft_plans.d_bands;
+    pipe.half_precision = half_precision;
+
+    pipe.d_start_list = new void*[scale_count];
+    pipe.d_end_list   = new void*[scale_count];
+    pipe.d_junk_list  = new void*[scale_count];
+
+    for (int s = 0; s < scale_count; s++) {
+        int tiles_per_frame = tileCount(scale_vector[s], main_scale, tile_overlap);
+        int tile_size  = (scale_vector[s]/2 + 1) * scale_vector[s];
+
+        pipe.d_start_list[s]  = d_fft_buffer_list[s];
+        pipe.d_end_list[s]    = fftOffset(d_fft_buffer_list[s], 1 * static_cast<size_t>(tiles_per_frame) * tile_size * chunk_frame_count);
+        pipe.d_junk_list[s]   = fftOffset(d_fft_buffer_list[s], 2 * static_cast<size_t>(tiles_per_frame) * tile_size * chunk_frame_count);
+    }
+
+    pipe.d_idle  = d_buffer;
+    pipe.d_ready = d_buffer + 1 * chunk_frame_count * frameBytes(info);
+    pipe.d_used  = d_buffer + 2 * chunk_frame_count * frameBytes(info);
+
+    // pointers to shuffle with stream
+
+    pipe.d_workspace_cur = d_workspace_1;
+    pipe.d_workspace_nxt = d_workspace_2;
+
+    pipe.stream_cur = &stream_1;
+    pipe.stream_nxt = multistream ? &stream_2 : &stream_1;
+
+    pipe.second_accum = false;
+
+    gpuErrorCheck(cudaEventCreateWithFlags(&pipe.parse_done, cudaEventDisableTiming));
+    gpuErrorCheck(cudaEventCreateWithFlags(&pipe.chunk_done, cudaEventDisableTiming));
+
+    // per-stage timing for the benchmark suite and the metrics export
+    stage_timer_struct timer;
+    for (int stage = 0; stage < STAGE_COUNT; stage++) {
+        timer.bytes[stage] = timer.flops[stage] = timer.host_ms[stage] = timer.drained_ms[stage] = 0.0;
+    }
+    pipe.timer = (report != NULL || metricsEnabled()) ? &timer : NULL;
+
+    std::string context_key = std::to_string(info.fps) + "|" + std::to_string(mask_tolerance) + "|" +
+                              std::to_string(enable_angle_analysis ? angle_count : 0) + "|" + std::to_string(fit_curves) + "|" +
+                              std::to_string(tile_overlap) + "|";
+    for (int s = 0; s < scale_count; s++)
+        context_key += std::to_string(scale_vector[s]) + ",";
+    for (int q = 0; q < lambda_count; q++)
+        context_key += std::to_string(lambda_arr[q]) + ",";
+    for (int t = 0; t < tau_count; t++)
+        context_key += std::to_string(tau_vector[t]) + ",";
+
+    analysis_context_struct analysis_ctx;
+    acquireAnalysisContext(cache, context_key, analysis_ctx, scale_vector, scale_count, tile_overlap, lambda_arr, lambda_count, tau_vector, tau_count,
+                           info.fps, mask_tolerance, enable_angle_analysis, angle_count, ISF_STAGING_SLOTS, fit_curves);
+
+    analysis_writer_struct writer;
+    startWriter(writer, analysis_ctx, [&](ISF_write_job &job) {
+        auto write_start = std::chrono::high_resolution_clock::now();
+
+        if (sink) {
+            ISF_block_struct block;
+            block.file_out        = job.file_out;
+            block.window_size     = job.window_size;
+            block.window_index    = job.window_index;
+            block.frames_analysed = job.frames_analysed;
+            block.fps             = info.fps;
+            block.scale_count     = scale_count;
+            block.scale_arr       = scale_vector;
+            block.tile_overlap    = tile_overlap;
+            block.ISF_offsets     = analysis_ctx.ISF_offsets;
+            block.ring_count      = analysis_ctx.ring_count;
+            block.tau_count       = tau_count;
+            block.tau_arr         = tau_vector;
+            block.ISF             = analysis_ctx.h_ISF + analysis_ctx.ISF_offsets[scale_count] * job.slot;
+            block.fit             = fit_curves ? analysis_ctx.h_fit + static_cast<size_t>(analysis_ctx.curve_count) * FIT_PARAM_COUNT * job.slot : NULL;
+
+            sink(block);
+        } else {
+            writeAccumResults(scale_vector, scale_count, lambda_arr, lambda_count, tau_vector, tau_count,
+                              analysis_ctx, job.slot, job.file_out, info.fps, job.window_size, job.window_index,
+                              enable_angle_analysis, angle_count);
+        }
+
+        // only the writer thread touches the output stage until it is joined
+        double write_ms = std::chrono::duration<double, std::milli>(std::chrono::high_resolution_clock::now() - write_start).count();
+        timer.host_ms[STAGE_OUTPUT] += write_ms;
+        addStageTime(STAGE_OUTPUT, write_ms);
+        timer.bytes[STAGE_OUTPUT] += sizeof(float) * analysis_ctx.ISF_offsets[scale_count];
+
+        verbose("\n[Results for analysis window size = %d frames]\n", job.frames_analysed);
+    });
+
+    cudaEvent_t accum_done_1, accum_done_2;
+    gpuErrorCheck(cudaEventCreateWithFlags(&accum_done_1, cudaEventDisableTiming));
+    gpuErrorCheck(cudaEventCreateWithFlags(&accum_done_2, cudaEventDisableTiming));
+
+    // Hand an episode's accumulators to the analysis stream and switch it to its other bank.
+    // Nothing here blocks the chunk pipeline unless every staging slot is still being written
+    flush_function flush = [&](episode_accum_struct &ep, int window_index, bool partial) {
+        profileRangePush(PROFILE_WINDOW, "flush " + std::to_string(ep.window_size) + "-" + std::to_string(window_index));
+
+        gpuErrorCheck(cudaEventRecord(accum_done_1, stream_1));
+        gpuErrorCheck(cudaStreamWaitEvent(analysis_stream, accum_done_1, 0));
+        if (multistream) {
+            gpuErrorCheck(cudaEventRecord(accum_done_2, stream_2));
+            gpuErrorCheck(cudaStreamWaitEvent(analysis_stream, accum_done_2, 0));
+
+            combineAccumulators(ep.d_accum_list_1, ep.d_accum_list_2, scale_vector, scale_count, tile_overlap, tau_count, analysis_stream);
+        }
+
+        ISF_write_job job;
+        job.file_out        = file_out;
+        job.window_size     = ep.window_size;
+        job.window_index    = window_index;
+        job.frames_analysed = ep.frames_accumulated;
+
+        if (partial) {
+            verbose("[Parsing Accumulator]\n");
+            job.file_out = file_out + "_t" + std::to_string(ep.dump_count++) + "_";
+        }
+
+        job.slot = acquireStagingSlot(writer);
+        countMetric(METRIC_ACCUM_FLUSHES, 1);
+
+        timeStage(pipe.timer, STAGE_REDUCTION, analysis_stream, accum_size * accum_copies, accum_size / sizeof(float), [&] {
+            analyse_accums(scale_vector, scale_count, tau_count, ep.frames_accumulated, analysis_ctx,
+                           ep.d_accum_list_1, job.slot, analysis_stream);
+        });
+
+        queueWriteJob(writer, job);
+
+        verbose("  [Clearing accumulators for next batch processing]\n");
+        for (int c = 0; c < accum_copies; c++) {
+            gpuErrorCheck(cudaMemsetAsync(ep.d_bank_list[ep.bank][c][0], 0, accum_size, analysis_stream));
+        }
+        gpuErrorCheck(cudaEventRecord(ep.bank_cleared[ep.bank], analysis_stream));
+
+        // Continue in the other bank once its previous analysis has cleared it
+        ep.bank = 1 - ep.bank;
+        ep.d_accum_list_1 = ep.d_bank_list[ep.bank][0];
+        ep.d_accum_list_2 = ep.d_bank_list[ep.bank][1];
+
+        gpuErrorCheck(cudaStreamWaitEvent(stream_1, ep.bank_cleared[ep.bank], 0));
+        if (multistream)
+            gpuErrorCheck(cudaStreamWaitEvent(stream_2, ep.bank_cleared[ep.bank], 0));
+
+        ep.frames_accumulated = 0;
+        profileRangePop();
+    };
+
+    // Frame-split mode: device 0 pulls every device's partial accumulator and analyses the sum
+    device_group_struct *group = task.group;
+    float *d_peer_accum = NULL;
+    float **d_peer_list = new float*[scale_count];
+
+    if (task.split_frames && group->device_count > 1 && dev == 0) {
+        gpuErrorCheck(cudaMalloc((void** ) &d_peer_accum, accum_size));
+        total_device_memory += accum_size;
+
+        d_peer_list[0] = d_peer_accum;
+        for (int s = 0; s < scale_count - 1; s++) {
+            int scale = scale_vector[s];
+            int tiles_per_frame = tileCount(scale, main_scale, tile_overlap);
+            d_peer_list[s+1] = d_peer_list[s] + tiles_per_frame * (scale/2 + 1) * scale * tau_count;
+        }
+
+        for (int d = 1; d < group->device_count; d++) {
+            int can_access = 0;
+            gpuErrorCheck(cudaDeviceCanAccessPeer(&can_access, dev, d));
+            if (!can_access)
+                continue; // copies fall back to staging through host
+
+            // enabled by an earlier run in this process (batch units, engine calls), clear the pending error
+            cudaError_t peer_status = cudaDeviceEnablePeerAccess(d, 0);
+            if (peer_status == cudaErrorPeerAccessAlreadyEnabled) {
+                cudaGetLastError();
+            } else {
+                gpuErrorCheck(peer_status);
+            }
+        }
+    }
+
+    flush_function flush_split = [&](episode_accum_struct &ep, int window_index, bool partial) {
+        // Collect this device's partial sums in the first accumulator copy
+        if (multistream) {
+            gpuErrorCheck(cudaEventRecord(accum_done_2, stream_2));
+            gpuErrorCheck(cudaStreamWaitEvent(stream_1, accum_done_2, 0));
+
+            combineAccumulators(ep.d_accum_list_1, ep.d_accum_list_2, scale_vector, scale_count, tile_overlap, tau_count, stream_1);
+            gpuErrorCheck(cudaMemsetAsync(ep.d_accum_list_2[0], 0, accum_size, stream_1));
+        }
+        gpuErrorCheck(cudaStreamSynchronize(stream_1));
+
+        group->d_accum[dev] = ep.d_accum_list_1[0];
+        group->frames[dev]  = ep.frames_accumulated;
+        groupBarrier(*group);
+
+        if (dev == 0) {
+            for (int d = 1; d < group->device_count; d++) {
+                gpuErrorCheck(cudaMemcpyPeerAsync(d_peer_accum, dev, group->d_accum[d], d, accum_size, stream_1));
+                combineAccumulators(ep.d_accum_list_1, d_peer_list, scale_vector, scale_count, tile_overlap, tau_count, stream_1);
+                ep.frames_accumulated += group->frames[d];
+            }
+            gpuErrorCheck(cudaStreamSynchronize(stream_1));
+        }
+
+        groupBarrier(*group); // every partial accumulator has been read
+
+        if (dev == 0) {
+            flush(ep, window_index, partial);
+        } else {
+            gpuErrorCheck(cudaMemset(ep.d_accum_list_1[0], 0, accum_size));
+            ep.frames_accumulated = 0;
+        }
+    };
+
+    const flush_function &window_flush = task.split_frames ? flush_split : flush;
+
+    verbose("Pointer Allocations Done\n");
+
+    //////////
+    ///  Main Loop 
+    //////////
+    
+    verbose("Main loop start.\n");
+
+    // The frame segments are known up front, so the prefetch thread can read ahead across windows.
+    // In frame-split mode this device only starts pairs in its slice of each window, the frames
+    // up to the largest tau after the slice are streamed as well as partners (tau halo)
+    const int max_tau = tau_vector[tau_count - 1];
+    std::vector<int> pair_ends;
+
+    if (single_pass || live_chunks > 0) {
+        prefetch.schedule.push_back({0, total_frames});
+    } else if (window_hop > 0) {
+        // sliding windows stream the video once per episode
+        for (int e = 0; e < episode_count; e++) {
+            if (episode_vector[e] > 0 && task.episode_owned[e])
+                prefetch.schedule.push_back({0, total_frames});
+        }
+    } else {
+        for (window_unit_struct &unit : task.windows) {
+            int window_size = episode_vector[unit.episode];
+            int window_start = unit.window * window_size;
+            int frames_in_window = std::min(window_size, total_frames - window_start);
+
+            int own_begin = window_start;
+            int own_end   = window_start + frames_in_window;
+
+            if (task.split_frames) {
+                own_begin = window_start + static_cast<int>((static_cast<long>(frames_in_window) * dev) / group->device_count);
+                own_end   = window_start + static_cast<int>((static_cast<long>(frames_in_window) * (dev + 1)) / group->device_count);
+            }
+
+            int stream_end = std::min(own_end + max_tau, window_start + frames_in_window);
+
+            prefetch.schedule.push_back({own_begin, (own_end > own_begin) ? stream_end - own_begin : 0});
+            pair_ends.push_back(own_end);
+        }
+    }
+
+    //////////
+    ///  Checkpoints
+    //////////
+
+    // A checkpoint holds every accumulator set and frame hierarchy of this device and the
+    // position in its window list, a resumed run skips the units already completed and
+    // streams the unit in progress from the checkpointed chunk on
+    size_t accum_total = accum_size * accum_list_count;
+    std::string checkpoint_path = file_out + "checkpoint" + (group->device_count > 1 ? std::to_string(dev) : "") + ".bin";
+
+    std::string description = file_in + "|" + std::to_string(total_frames) + "|" + std::to_string(frame_offset) + "|" +
+                              std::to_string(x_offset) + "|" + std::to_string(y_offset) + "|" + std::to_string(chunk_frame_count) + "|" +
+                              std::to_string(multistream) + std::to_string(single_pass) + std::to_string(half_precision) +
+                              std::to_string(wk_engine) + "|" + std::to_string(multitau_points) + "|" + std::to_string(dump_accum_after) + "|" +
+                              std::to_string(tile_overlap) + "|" + preprocess.gain_file + "|" + preprocess.offset_file + "|" +
+                              std::to_string(preprocess.background_weight) + "|" + std::to_string(preprocess.binning) + "|";
+    for (int s = 0; s < scale_count; s++)
+        description += std::to_string(scale_vector[s]) + ",";
+    for (int t = 0; t < tau_count; t++)
+        description += std::to_string(tau_vector[t]) + ",";
+    for (int e = 0; e < episode_count; e++)
+        description += std::to_string(episode_vector[e]) + ",";
+    for (window_unit_struct &unit : task.windows)
+        description += std::to_string(unit.episode) + ":" + std::to_string(unit.window) + ",";
+
+    uint64_t fingerprint = checkpointFingerprint(description);
+
+    checkpoint_state_struct resume_state;
+    bool resumed = false;
+
+    if (resume) {
+        std::vector<unsigned char> h_resume(accum_total + multitau_size);
+        resumed = readCheckpoint(checkpoint_path, fingerprint, episode_count, accum_total, multitau_size, resume_state, h_resume.data());
+
+        if (resumed) {
+            gpuErrorCheck(cudaMemcpy(d_accum, h_resume.data(), accum_total, cudaMemcpyHostToDevice));
+            if (multitau_size > 0)
+                gpuErrorCheck(cudaMemcpy(d_multitau, h_resume.data() + accum_total, multitau_size, cudaMemcpyHostToDevice));
+
+            // frames before the checkpoint are not read again
+            for (int u = 0; u < static_cast<int>(prefetch.schedule.size()); u++) {
+                frame_segment_struct &seg = prefetch.schedule[u];
+
+                if (u < resume_state.unit) {
+                    seg.frame_count = 0;
+                } else if (u == resume_state.unit && resume_state.next_frame >= 0) {
+                    seg.frame_count -= resume_state.next_frame - seg.first_frame;
+                    seg.first_frame  = resume_state.next_frame;
+                }
+            }
+
+            printf("[Resume] %s: continuing at unit %d, frame %d\n", checkpoint_path.c_str(),
+                   resume_state.unit, std::max(resume_state.next_frame, 0));
+        } else {
+            conditionAssert(false, "no checkpoint at " + checkpoint_path + ", starting from the beginning");
+        }
+    }
+
+    // Episode cursors are stored in the order of the episodes array once the run has set it up
+    // (single-pass mode moves the active episodes to the front)
+    auto restoreEpisodes = [&] {
+        for (int e = 0; resumed && e < episode_count; e++) {
+            episodes[e].frames_accumulated = resume_state.frames_accumulated[e];
+            episodes[e].chunks_accumulated = resume_state.chunks_accumulated[e];
+            episodes[e].dump_count         = resume_state.dump_count[e];
+            episodes[e].bank               = resume_state.bank[e];
+            episodes[e].d_accum_list_1     = episodes[e].d_bank_list[episodes[e].bank][0];
+            episodes[e].d_accum_list_2     = episodes[e].d_bank_list[episodes[e].bank][1];
+        }
+    };
+
+    checkpoint_writer_struct ckpt;
+    auto last_checkpoint = std::chrono::steady_clock::now();
+    int current_unit = 0;
+    int current_end  = total_frames; // end of the segment being streamed
+
+    auto takeCheckpoint = [&](int unit, int next_frame) {
+        waitCheckpointWriter(ckpt); // staging buffer free
+
+        // The copy follows every chunk accumulated so far, later chunks wait for it
+        gpuErrorCheck(cudaEventRecord(accum_done_1, stream_1));
+        gpuErrorCheck(cudaStreamWaitEvent(analysis_stream, accum_done_1, 0));
+        if (multistream) {
+            gpuErrorCheck(cudaEventRecord(accum_done_2, stream_2));
+            gpuErrorCheck(cudaStreamWaitEvent(analysis_stream, accum_done_2, 0));
+        }
+
+        gpuErrorCheck(cudaMemcpyAsync(ckpt.h_staging, d_accum, accum_total, cudaMemcpyDeviceToHost, analysis_stream));
+        if (multitau_size > 0)
+            gpuErrorCheck(cudaMemcpyAsync(ckpt.h_staging + accum_total, d_multitau, multitau_size, cudaMemcpyDeviceToHost, analysis_stream));
+        gpuErrorCheck(cudaEventRecord(ckpt.copied, analysis_stream));
+
+        gpuErrorCheck(cudaStreamWaitEvent(stream_1, ckpt.copied, 0));
+        if (multistream)
+            gpuErrorCheck(cudaStreamWaitEvent(stream_2, ckpt.copied, 0));
+
+        checkpoint_state_struct state;
+        state.unit       = unit;
+        state.next_frame = next_frame;
+        for (int e = 0; e < episode_count; e++) {
+            state.frames_accumulated.push_back(episodes[e].frames_accumulated);
+            state.chunks_accumulated.push_back(episodes[e].chunks_accumulated);
+            state.dump_count.push_back(episodes[e].dump_count);
+            state.bank.push_back(episodes[e].bank);
+        }
+
+        // windows completed before the checkpoint must be on disk before it is
+        size_t queued;
+        {
+            std::lock_guard<std::mutex> lock(writer.mtx);
+            queued = writer.queued_count;
+        }
+        queueCheckpoint(ckpt, state, [&writer, queued] { waitWritten(writer, queued); });
+
+        last_checkpoint = std::chrono::steady_clock::now();
+    };
+
+    if (checkpoint_interval > 0) {
+        openCheckpointWriter(ckpt, checkpoint_path, fingerprint, accum_total, multitau_size);
+
+        pipe.checkpoint = [&](int next_frame) {
+            auto elapsed = std::chrono::duration_cast<std::chrono::seconds>(std::chrono::steady_clock::now() - last_checkpoint);
+            if (elapsed.count() < checkpoint_interval)
+                return;
+
+            if (next_frame < current_end) {
+                takeCheckpoint(current_unit, next_frame);
+            } else if (!single_pass) {
+                takeCheckpoint(current_unit + 1, -1); // unit complete
+            }
+        };
+    }
+
+    if (decoder == NULL)
+        startPrefetch(prefetch);
+
+    if (live_chunks > 0) {
+        // Sliding window over the incoming frames, a snapshot of the window every
+        // dump_accum_after chunks. A snapshot is dropped rather than waited for when
+        // every staging slot is still being written, so the capture is never held up
+        verbose("\n[Live analysis, window of %d chunks (%d frames)]\n", live_chunks, live_chunks * chunk_frame_count);
+
+        live_accum_struct live;
+        initLiveAccum(live, live_chunks, accum_size, scale_vector, scale_count, tile_overlap, tau_count, false, spill_accumulators, analysis_stream);
+
+        int publish_every = std::max(1, dump_accum_after);
+        int dropped = 0;
+
+        publish_function publish = [&](live_accum_struct &l, int window_frames, int snapshot) {
+            int slot = tryAcquireStagingSlot(writer);
+            if (slot < 0) {
+                dropped++;
+                countMetric(METRIC_SNAPSHOTS_DROPPED, 1);
+                verbose("[Live] snapshot %d dropped, ISF writer busy\n", snapshot);
+                return;
+            }
 
-    info.x_off = x_offset;
-    info.y_off = y_offset;
+            countMetric(METRIC_ACCUM_FLUSHES, 1);
 
-    verbose("Video Setup Done.\n");
-    //////////
-    ///  Parameter check
-    //////////
+            ISF_write_job job;
+            job.slot            = slot;
+            job.file_out        = file_out;
+            job.window_size     = l.window_chunks * chunk_frame_count;
+            job.window_index    = snapshot;
+            job.frames_analysed = window_frames;
 
-    conditionAssert((scale_vector[0] + info.x_off <= info.w && scale_vector[0] + info.y_off <= info.h),
-            "the specified out dimensions must be smaller than actual image size", true);
+            timeStage(pipe.timer, STAGE_REDUCTION, analysis_stream, accum_size, accum_size / sizeof(float), [&] {
+                analyse_accums(scale_vector, scale_count, tau_count, window_frames, analysis_ctx,
+                               l.d_total_list, slot, analysis_stream);
+            });
 
-    conditionAssert((tau_vector[tau_count - 1] <= chunk_frame_count),
-            "the largest tau value must be smaller than number frames in a chunk", true);
+            queueWriteJob(writer, job);
+        };
 
-    //////////
-    ///  Initialise variables
-    //////////
+        live_stop = 0;
+        std::signal(SIGINT, liveStopHandler);
 
-    const int buffer_frame_count = chunk_frame_count * 3;
-    const int main_scale = scale_vector[0];
-    int chunks_already_parsed = 0;
+        profileRangePush(PROFILE_WINDOW, "live");
+        streamLive(pipe, live, total_frames, publish_every, publish);
+        profileRangePop();
 
-    verbose("[Video info - (%d x %d), %d Frames (offset %d), %.4f FPS]\n", info.w, info.h, total_frames, frame_offset, info.fps);
+        std::signal(SIGINT, SIG_DFL);
 
-    // streams
+        if (dropped > 0)
+            printf("[Live] %d snapshots dropped, the ISF writer could not keep up\n", dropped);
 
-    cudaStream_t stream_1, stream_2;
+        gpuErrorCheck(cudaStreamSynchronize(analysis_stream));
+        freeLiveAccum(live);
+    } else if (window_hop > 0) {
+        // Sliding windows, every hop of window_hop frames starts a window of each episode
+        for (int e = 0; e < episode_count; e++) {
+            if (episode_vector[e] == 0 || !task.episode_owned[e])
+                continue;
 
-    if (multistream) {
-        cudaStreamCreate(&stream_1);
-        cudaStreamCreate(&stream_2);
-    } else {
-        cudaStreamCreate(&stream_1);
-    }
+            int window_hops = episode_vector[e] / window_hop;
 
+            verbose("\n[Sliding windows of time window size=%d frames, hop %d frames]\n", episode_vector[e], window_hop);
 
-    verbose("Initialise Variables Done.\n");
-    //////////
-    ///  Memory Allocations
-    //////////
+            live_accum_struct slide;
+            initLiveAccum(slide, window_hops, accum_size, scale_vector, scale_count, tile_overlap, tau_count, true, spill_accumulators, analysis_stream);
 
-    size_t total_host_memory   = 0;
-    size_t total_device_memory = 0;
+            publish_function publish = [&](live_accum_struct &l, int window_frames, int window_index) {
+                countMetric(METRIC_ACCUM_FLUSHES, 1);
 
-    // main device buffer
-    size_t buffer_size  = sizeof(unsigned char) * buffer_frame_count * info.bpp * info.w * info.h;
+                ISF_write_job job;
+                job.slot            = acquireStagingSlot(writer);
+                job.file_out        = file_out;
+                job.window_size     = episode_vector[e];
+                job.window_index    = window_index;
+                job.frames_analysed = window_frames;
 
-    unsigned char *d_buffer;
-    gpuErrorCheck(cudaMalloc((void** )&d_buffer, buffer_size));
+                timeStage(pipe.timer, STAGE_REDUCTION, analysis_stream, accum_size, accum_size / sizeof(float), [&] {
+                    analyse_accums(scale_vector, scale_count, tau_count, window_frames, analysis_ctx,
+                                   l.d_total_list, job.slot, analysis_stream);
+                });
 
-    total_device_memory += buffer_size;
+                queueWriteJob(writer, job);
+            };
 
-    // host buffer (multi-stream)
-    size_t chunk_size  = sizeof(unsigned char) * chunk_frame_count * info.bpp * info.w * info.h;
+            profileRangePush(PROFILE_WINDOW, "sliding " + std::to_string(episode_vector[e]));
+            streamSliding(pipe, slide, window_hop / chunk_frame_count, total_frames, max_tau, publish);
+            profileRangePop();
 
-    unsigned char *h_chunk_1;
-    unsigned char *h_chunk_2;
+            gpuErrorCheck(cudaStreamSynchronize(analysis_stream));
+            freeLiveAccum(slide);
+        }
+    } else if (single_pass) {
+        // Stream the video once, every episode accumulates its open window from the same FFT
+        verbose("\n[Single-pass analysis of %d time window sizes]\n", episode_count);
+
+        int active_count = 0;
+        for (int e = 0; e < episode_count; e++) {
+            if (episode_vector[e] == 0 || !task.episode_owned[e]) // window of size 0 is skipped
+                continue;
+
+            std::swap(episodes[active_count], episodes[e]); // keep every episode's events for teardown
+            episodes[active_count].window_last = (total_frames + episode_vector[e] - 1) / episode_vector[e];
+            active_count++;
+        }
 
-    if (multistream) {
-        gpuErrorCheck(cudaHostAlloc((void **) &h_chunk_1, chunk_size, cudaHostAllocDefault));
-        gpuErrorCheck(cudaHostAlloc((void **) &h_chunk_2, chunk_size, cudaHostAllocDefault));
-        total_host_memory += 2 * chunk_size;
+        restoreEpisodes();
+
+        profileRangePush(PROFILE_WINDOW, "single pass");
+        streamFrames(pipe, prefetch.schedule[0].first_frame, prefetch.schedule[0].frame_count, episodes, active_count,
+                     dump_accum_after, window_flush);
+        profileRangePop();
     } else {
-        gpuErrorCheck(cudaHostAlloc((void **) &h_chunk_1, chunk_size, cudaHostAllocDefault));
-        h_chunk_2 = h_chunk_1;
-        total_host_memory += 1 * chunk_size;
-    }
+        restoreEpisodes();
 
+        for (size_t u = 0; u < task.windows.size(); u++) {
+            int e = task.windows[u].episode;
+            int w = task.windows[u].window;
+            frame_segment_struct &seg = prefetch.schedule[u];
 
-    if (benchmark_mode) {
-    	verbose("Benchmark mode - filling host buffer with random data.\n");
-    	for (int i = 0; i < info.bpp * info.w * info.h; i++) {
-    		h_chunk_1[i] = static_cast<unsigned char>(rand() % 255);
-    		h_chunk_2[i] = static_cast<unsigned char>(rand() % 255);
-    	}
-    }
-    // work space (multi-stream)
-    size_t workspace_size = sizeof(float) * chunk_frame_count * main_scale * main_scale;
+            if (resumed && static_cast<int>(u) < resume_state.unit)
+                continue; // completed before the checkpoint
 
-    float *d_workspace_1;
-    float *d_workspace_2;
+            current_unit = static_cast<int>(u);
+            current_end  = seg.first_frame + seg.frame_count;
 
-    if (multistream) {
-        gpuErrorCheck(cudaMalloc((void** ) &d_workspace_1, workspace_size));
-        gpuErrorCheck(cudaMalloc((void** ) &d_workspace_2, workspace_size));
-        total_device_memory += 2 * workspace_size;
-    } else {
-        gpuErrorCheck(cudaMalloc((void** ) &d_workspace_1, workspace_size));
-        d_workspace_2= d_workspace_1;
-        total_device_memory += 1 * workspace_size;
-    }
+            verbose("\n[Processing window %d of time window size=%d frames: frame range %d-%d (total %d frames)]\n",
+                   w+1, episode_vector[e], seg.first_frame, seg.first_frame + seg.frame_count - 1, seg.frame_count);
 
-    // FFT buffer
-    size_t fft_buffer_size = 0;
-    for (int s = 0; s < scale_count; s++) {
-        int scale = scale_vector[s];
-        int tiles_per_frame = (main_scale / scale) * (main_scale / scale);
-        int tile_size = (scale / 2 + 1) * scale;
+            episodes[e].window_first = w;
+            episodes[e].window_last  = w + 1;
+            episodes[e].pair_end     = pair_ends[u];
 
-        fft_buffer_size += sizeof(cufftComplex) * tile_size * tiles_per_frame * buffer_frame_count;
-    }
+            profileRangePush(PROFILE_WINDOW, "window " + std::to_string(episode_vector[e]) + "-" + std::to_string(w));
 
-    cufftComplex *d_fft_buffer;
+            if (seg.frame_count > 0 && wk_engine) {
+                streamWindowWK(pipe, wk, seg.first_frame, seg.frame_count, episodes[e], w, window_flush);
+            } else if (seg.frame_count > 0) {
+                streamFrames(pipe, seg.first_frame, seg.frame_count, &episodes[e], 1, dump_accum_after, window_flush);
+            } else {
+                window_flush(episodes[e], w, false); // empty slice, still takes part in the reduction
+            }
 
-    gpuErrorCheck(cudaMalloc((void** ) &d_fft_buffer, fft_buffer_size));
+            profileRangePop();
 
-    total_device_memory += fft_buffer_size;
+            if (pipe.checkpoint)
+                pipe.checkpoint(current_end);
 
-    // FFT intensity accumulator (multi-stream) - initial values set to zero
-    size_t accum_size = 0;
-    for (int s = 0; s < scale_count; s++) {
-        int scale = scale_vector[s];
-        int tiles_per_frame = (main_scale / scale) * (main_scale / scale);
-        accum_size += sizeof(float) * (scale / 2 + 1) * scale * tiles_per_frame * tau_count;
+            verbose("[Window %d processing completed]\n", w+1);
+        }
     }
 
-    float *d_accum_1;
-    float *d_accum_2;
+    if (decoder == NULL)
+        stopPrefetch(prefetch);
+    stopWriter(writer);
 
-    if (multistream) {
-        gpuErrorCheck(cudaMalloc((void** ) &d_accum_1, accum_size));
-        gpuErrorCheck(cudaMalloc((void** ) &d_accum_2, accum_size));
+    if (checkpoint_interval > 0)
+        closeCheckpointWriter(ckpt);
 
-        gpuErrorCheck(cudaMemset(d_accum_1, 0, accum_size));
-        gpuErrorCheck(cudaMemset(d_accum_2, 0, accum_size));
+    // also the checkpoint resumed from when no newer one was written (or -k is not set)
+    if (checkpoint_interval > 0 || resume)
+        removeCheckpoint(checkpoint_path);
 
-        total_device_memory += 2 * accum_size; 
-    } else {
-        gpuErrorCheck(cudaMalloc((void** ) &d_accum_1, accum_size));
+    cudaDeviceSynchronize();
+    auto end_main = std::chrono::high_resolution_clock::now();
+
+    drainStageTimes(pipe.timer);
+    if (report != NULL) {
+        collectStageTimes(timer, *report);
+        report->frames        = total_frames;
+        report->total_seconds = std::chrono::duration<double>(end_main - start_time).count();
+    }
 
-        gpuErrorCheck(cudaMemset(d_accum_1, 0, accum_size));
-        d_accum_2 = d_accum_1;
+    releaseFFTPlans(cache, plan_key, fft_plans);
 
-        total_device_memory += 1 * accum_size;
+    for (auto &plan : wk.plans) {
+        cufftDestroy(plan.second);
     }
+    deviceRelease(cache, wk.d_store);
+    deviceRelease(cache, wk.d_pad);
+    deviceRelease(cache, wk.d_sum);
+    delete[] wk.d_store_list;
 
-    size_t free_memory = 0;
-    size_t total_memory = 0;
-    gpuErrorCheck(cudaMemGetInfo(&free_memory, &total_memory));
+    // Free memory locations we no longer need
 
-    // tau-vector
-    int *d_tau_vector;
-    gpuErrorCheck(cudaMalloc((void** ) &d_tau_vector, tau_count * sizeof(int)));
-    gpuErrorCheck(cudaMemcpy(d_tau_vector, tau_vector, tau_count * sizeof(int), cudaMemcpyHostToDevice));
-    total_device_memory += sizeof(int) * tau_count;
+    if (h_chunks != NULL)
+        hostRelease(cache, h_chunks);
+    for (int c = 0; c < host_slots; c++) {
+        cudaEventDestroy(prefetch.slots[c].copied);
+    }
+    delete[] prefetch.slots;
+    closeGPUDecoder(decoder);
 
-    verbose("Memory Allocations Done.\n"
-            "Total memory allocated\n"
-            "Device:\n\tExplictly allocated:\t %f GB \n\tTotal allocated:\t %f GB\n\tFree memory remaining:\t %f GB\n"
-            "Host:\t %f GB\n",
-            total_device_memory          / (float) 1073741824,
-            (total_memory - free_memory) / (float) 1073741824,
-            free_memory                  / (float) 1073741824,
-            total_host_memory            / (float) 1073741824);
+    if (use_moviefile && !benchmark_mode) {
+        closeMovieIndex(movie_index);
+    }
+    deviceRelease(cache, d_buffer);
+    deviceRelease(cache, d_gain);
+    deviceRelease(cache, d_offset);
+    deviceRelease(cache, d_background);
+    deviceRelease(cache, d_fft_buffer);
+    deviceRelease(cache, d_workspace_1);
+    if (multistream)
+        deviceRelease(cache, d_workspace_2);
+    if (spill_accumulators) {
+        cudaFreeHost(d_accum);
+    } else {
+        deviceRelease(cache, d_accum);
+    }
+    deviceRelease(cache, d_tau_vector);
+    deviceRelease(cache, d_multitau);
+    deviceRelease(cache, d_level_offsets);
+    cudaEventDestroy(pipe.parse_done);
+    cudaEventDestroy(pipe.chunk_done);
 
-    //////////
-    ///  FFT Plan
-    //////////
+    releaseAnalysisContext(cache, context_key, analysis_ctx, scale_count);
 
-    cufftHandle *FFT_plan_list = new cufftHandle[scale_count];
+    for (int e = 0; e < episode_count; e++) {
+        for (int b = 0; b < accum_banks; b++) {
+            cudaEventDestroy(episodes[e].bank_cleared[b]);
+        }
+        delete[] episodes[e].d_multitau_list;
+    }
+    cudaEventDestroy(accum_done_1);
+    cudaEventDestroy(accum_done_2);
+    cudaStreamDestroy(analysis_stream);
 
-    int rank = 2;
-    int istride = 1;
-    int ostride = 1;
+    if (d_peer_accum != NULL)
+        cudaFree(d_peer_accum);
+    delete[] d_peer_list;
 
-    for (int s = 0; s < scale_count; s++) {
-        int scale = scale_vector[s];
+    //////////
+    ///  Analysis
+    //////////
+    verbose("Analysis.\n");
 
-        int tiles_per_frame = (main_scale / scale) * (main_scale / scale);
-        int batch_count = chunk_frame_count * tiles_per_frame;
-        int n[2] = {scale, scale};
+    auto end_out = std::chrono::high_resolution_clock::now();
 
-        int idist = scale * scale;
-        int odist = scale * (scale/2+1);
+    auto duration1 = std::chrono::duration_cast < std::chrono::microseconds
+            > (end_main - start_time).count();
+    auto duration2 = std::chrono::duration_cast < std::chrono::microseconds
+            > (end_out - end_main).count();
 
-        int inembed[] = {scale, scale};
-        int onembed[] = {scale, scale/2+1};
+    printf("[Time elapsed] "
+           "\n\tMain:\t\t%f s, "
+           "\n\tRadial Average:\t%f s,"
+           "\n\tTotal\t\t%f s,\t(%f frame / second)\n",
+           (float) duration1 / 1e6,
+           (float) duration2 / 1e6,
+           ((float) duration1 + (float) duration2) / 1e6,
+           (float) (total_frames * 1e6) / ((float) duration1 + (float) duration2));
+}
 
-        size_t mem_usage;
 
-        verbose("FFT Plan Info:\n");
-        verbose("\tn: (%d, %d), inembed: (%d, %d), onembed: (%d, %d), idist, odist: (%d, %d), batch: %d\n", n[0], n[1], inembed[0], inembed[1], onembed[0], onembed[1], idist, odist, batch_count);
+////////////////////////////////////////////////////////////////////////////////
+//  Runs the analysis on device_count GPUs, one thread and complete pipeline per
+//  device. Without split_frames the windows (or, in single-pass mode, the
+//  episodes) are shared out between the devices, longest first to the least
+//  loaded device. With split_frames every window is split into contiguous frame
+//  slices, one per device, and the accumulators are reduced on device 0.
+//
+//  If only_episode >= 0 just windows [window_begin, window_end) of that episode
+//  are analysed (batch work units). A non-empty sink receives the ISF of every
+//  window in place of the per-tile text files. half_precision stores the FFT
+//  ring in half precision, validate_precision runs single and half precision
+//  and only reports the largest relative difference of the ISF. wk_engine
+//  selects the Wiener-Khinchin engine in place of the direct differences.
+//  multitau_points > 0 selects the multi-tau correlator, the tau values are
+//  moved to the nearest lag of its grid first. Tiles of a scale are scale /
+//  tile_overlap pixels apart, window_hop > 0 analyses sliding windows starting
+//  every window_hop frames instead of disjoint ones. gpu_decode decodes
+//  compressed videos on the GPU, frames are never staged in host memory.
+//  preprocess selects the flat-field, binning and background steps fused
+//  into the parse.
+////////////////////////////////////////////////////////////////////////////////
+void runDDM(std::string file_in,
+            std::string file_out,
+            int *tau_vector,
+			int tau_count,
+            float *lambda_arr,
+			int lambda_count,
+            int *scale_vector,
+			int scale_count,
+            int x_offset,
+			int y_offset,
+            int *episode_vector,
+            int episode_count,
+            int total_frames,
+			int frame_offset,
+            int chunk_frame_count,
+            bool multistream,
+            bool use_webcam,
+            int webcam_idx,
+            float mask_tolerance,
+			bool use_moviefile,
+			bool use_index_fps,
+			bool use_explicit_fps,
+			float explicit_fps,
+            int dump_accum_after,
+			bool benchmark_mode,
+            bool enable_angle_analysis,
+            int angle_count,
+            bool single_pass,
+            int prefetch_depth,
+            int device_count,
+            bool split_frames,
+            int only_episode,
+            int window_begin,
+            int window_end,
+            const ISF_sink_function &sink,
+            bool half_precision,
+            bool validate_precision,
+            bool wk_engine,
+            int multitau_points,
+            bool binary_output,
+            bool fit_curves,
+            int live_chunks,
+            int checkpoint_interval,
+            bool resume,
+            bool map_output,
+            bool map_images,
+            int tile_overlap,
+            int window_hop,
+            bool gpu_decode,
+            const preprocess_params_struct &preprocess,
+            benchmark_report_struct *report,
+            const engine_run_struct *engine) {
 
-        int plan_code = cufftPlanMany(&FFT_plan_list[s], rank, n, inembed, istride, idist, onembed, ostride, odist, CUFFT_R2C, batch_count);
-        int esti_code = cufftEstimateMany(rank, n, inembed, istride, idist, onembed, ostride, odist, CUFFT_R2C, batch_count, &mem_usage);
+    //////////
+    ///  Sort Parameter Arrays
+    //////////
 
-        conditionAssert(plan_code == CUFFT_SUCCESS, "main cuFFT plan failure", true);
-        conditionAssert(esti_code == CUFFT_SUCCESS, "error estimating cuFFT plan memory usage", true);
-    }
+    // Can make assumptions later if tau / q / scale arrays are in known order
 
-    verbose("FFT Plan Done.\n");
+    std::sort(tau_vector, tau_vector + tau_count);
+    std::sort(lambda_arr, lambda_arr + lambda_count);
+    std::sort(scale_vector, scale_vector + scale_count, std::greater<int>());
+    // Sort window sizes in ascending order for efficient processing (starting with smaller windows) but could also be descending
+    std::sort(episode_vector, episode_vector + episode_count);
 
     //////////
-    ///  Pointer Allocation
+    ///  Multi-tau Lags
     //////////
 
-    // FFT buffer & FFT intensity accumulator are scale dependent so we define a array to hold values for each scale
+    // A multi-tau lag is j * 2^l with j < points at level l (j >= points / 2 above level 0),
+    // every tau value is rounded to the nearest such lag at the finest level that can hold it
+    std::vector<int> multitau_lags;
 
-    float **d_accum_list_1 = new float*[scale_count];
-    float **d_accum_list_2 = new float*[scale_count];
-    cufftComplex **d_fft_buffer_list    = new cufftComplex*[scale_count];
+    if (multitau_points > 0) {
+        conditionAssert(multitau_points >= 4 && multitau_points % 2 == 0, "multi-tau points per level must be even and at least 4", true);
+        conditionAssert(!wk_engine, "multi-tau mode can not be combined with the Wiener-Khinchin engine", true);
 
-    d_accum_list_1[0] = d_accum_1;
-    d_accum_list_2[0] = d_accum_2;
-    d_fft_buffer_list[0] = d_fft_buffer;
+        for (int t = 0; t < tau_count; t++) {
+            int l = 0;
+            while (((tau_vector[t] + ((1 << l) >> 1)) >> l) >= multitau_points)
+                l++;
 
-    for (int s = 0; s < scale_count - 1; s++) {
-        int scale = scale_vector[s];
+            int lag = ((tau_vector[t] + ((1 << l) >> 1)) >> l) << l;
+            if (lag != tau_vector[t])
+                verbose("Multi-tau: tau %d analysed as %d\n", tau_vector[t], lag);
 
-        int tile_size = (scale/2 + 1) * scale;
-        int tiles_per_frame = (main_scale / scale) * (main_scale / scale);
+            multitau_lags.push_back(lag);
+        }
 
-        d_accum_list_1[s+1] = d_accum_list_1[s] + tiles_per_frame * tile_size * tau_count;
-        d_accum_list_2[s+1] = d_accum_list_2[s] + tiles_per_frame * tile_size * tau_count;
+        multitau_lags.erase(std::unique(multitau_lags.begin(), multitau_lags.end()), multitau_lags.end());
 
-        d_fft_buffer_list[s+1] = d_fft_buffer_list[s] + tiles_per_frame * tile_size * buffer_frame_count;
+        tau_vector = multitau_lags.data();
+        tau_count  = static_cast<int>(multitau_lags.size());
     }
 
-    cufftComplex **d_start_list = new cufftComplex*[scale_count];
-    cufftComplex **d_end_list   = new cufftComplex*[scale_count];
-    cufftComplex **d_junk_list  = new cufftComplex*[scale_count];
+    //////////
+    ///  Device Check
+    //////////
+
+    int available_devices = 0;
+    gpuErrorCheck(cudaGetDeviceCount(&available_devices));
 
-    for (int s = 0; s < scale_count; s++) {
-        int tiles_per_frame = (main_scale / scale_vector[s]) * (main_scale / scale_vector[s]);
-        int tile_size  = (scale_vector[s]/2 + 1) * scale_vector[s];
+    conditionAssert(device_count >= 1 && device_count <= available_devices,
+                    "requested number of GPUs is not available", true);
 
-        d_start_list[s]  = d_fft_buffer_list[s];
-        d_end_list[s]    = d_fft_buffer_list[s] + 1 * tiles_per_frame * tile_size * chunk_frame_count;
-        d_junk_list[s]   = d_fft_buffer_list[s] + 2 * tiles_per_frame * tile_size * chunk_frame_count;
+    if (device_count > 1) {
+        conditionAssert(!use_webcam, "a web-camera can not be shared between GPUs", true);
     }
 
-    unsigned char *d_idle  = d_buffer;
-    unsigned char *d_ready = d_buffer + 1 * chunk_frame_count * info.bpp * info.w * info.h;
-    unsigned char *d_used  = d_buffer + 2 * chunk_frame_count * info.bpp * info.w * info.h;
+    if (split_frames) {
+        conditionAssert(!single_pass, "frame-split multi-GPU mode does not support single-pass mode", true);
+        conditionAssert(dump_accum_after == 0, "frame-split multi-GPU mode does not support rolling purge", true);
+    }
 
-    // pointers to shuffle with stream
+    if (live_chunks > 0) {
+        conditionAssert(device_count == 1 && !single_pass && !wk_engine && multitau_points == 0,
+                        "live mode runs on one GPU with the direct engine", true);
+        conditionAssert(!binary_output && !map_output && !validate_precision && !sink, "live mode writes ISF snapshots as text files", true);
 
-    float *d_workspace_cur = d_workspace_1;
-    float *d_workspace_nxt = d_workspace_2;
+        if (total_frames == 0) { // until interrupted
+            conditionAssert(use_webcam || benchmark_mode, "a live run without frame count needs a camera source", true);
+            total_frames = LIVE_UNBOUNDED_FRAMES;
+        }
+    }
 
-    float **d_accum_list_cur = d_accum_list_1;
-    float **d_accum_list_nxt = d_accum_list_2;
+    if (window_hop > 0) {
+        conditionAssert(live_chunks == 0 && !single_pass && !split_frames && dump_accum_after == 0,
+                        "sliding windows can not be combined with live mode, -P, -K or -G", true);
+        conditionAssert(!wk_engine && multitau_points == 0, "sliding windows are analysed with the direct engine", true);
+        conditionAssert(only_episode < 0, "sliding windows can only be analysed in complete runs", true);
+    }
 
-    unsigned char *h_chunk_cur = h_chunk_1;
-    unsigned char *h_chunk_nxt = h_chunk_2;
+    if (checkpoint_interval > 0 || resume) {
+        conditionAssert(live_chunks == 0 && !use_webcam, "live and web-camera runs can not be checkpointed", true);
+        conditionAssert(window_hop == 0, "sliding window runs can not be checkpointed", true);
+        conditionAssert(!split_frames, "frame-split multi-GPU mode does not support checkpoints", true);
+        conditionAssert(!binary_output && !map_output && !validate_precision && !sink, "checkpoints are supported with text file output only", true);
+        conditionAssert(preprocess.background_weight <= 0.0f, "the running background (-e) is not part of the checkpoint, runs subtracting it can not be checkpointed", true);
+    }
 
-    cudaStream_t *stream_cur = &stream_1;
-    cudaStream_t *stream_nxt = &stream_2;
+    if (report != NULL) {
+        conditionAssert(device_count == 1 && !validate_precision, "stage timing is reported for single GPU runs only", true);
+    }
 
-    if (!multistream) {
-        d_workspace_nxt = d_workspace_cur;
-        d_accum_list_nxt = d_accum_list_cur;
-        h_chunk_nxt = h_chunk_cur;
-        stream_nxt = stream_cur;
+    if (engine != NULL) {
+        conditionAssert(device_count == 1 && live_chunks == 0 && !use_webcam, "engines analyse files or frames on one GPU", true);
+        conditionAssert(!validate_precision && checkpoint_interval == 0 && !resume, "engines do not support -V, -k or -r", true);
     }
 
-    verbose("Pointer Allocations Done\n");
+    if (only_episode >= 0) {
+        conditionAssert(!single_pass, "single-pass mode can only analyse complete runs", true);
+        conditionAssert(only_episode < episode_count && window_begin <= window_end, "invalid window range", true);
+    }
 
     //////////
-    ///  Main Loop 
+    ///  Work Distribution
     //////////
-    
-    verbose("Main loop start.\n");
 
-    for (int e = 0; e < episode_count; e++) {
+    std::vector<window_unit_struct> all_windows;
+    for (int e = 0; live_chunks == 0 && window_hop == 0 && e < episode_count; e++) {
         int window_size = episode_vector[e];
-        //printf("\t%d\n", window_size);
-        conditionAssert(window_size >= 0, "Window size should be non-negative", true);
-        
-        if (e < episode_count - 1) {
-            conditionAssert(window_size < episode_vector[e + 1], "Window sizes should be in ascending order", true);
-        }
-        
-        if (window_size == 0) {
-            verbose("Warning: Window with size 0 at position %d will be skipped\n", e+1);
-        } else if (window_size > total_frames) {
-            verbose("Warning: Window size %d exceeds total frame count %d, will analyze all available frames\n", 
-                    window_size, total_frames);
+
+        for (int w = 0; window_size > 0 && w * window_size < total_frames; w++) {
+            if (only_episode < 0 || (e == only_episode && w >= window_begin && w < window_end))
+                all_windows.push_back({e, w});
         }
-        
-        verbose("\n[Processing analysis for time window size=%d frames (%d out of total %d)]\n", 
-               window_size, e+1, episode_count);
-        
-        // Calculate how many windows we need to process for this episode
-        int window_count = (total_frames + window_size - 1) / window_size;
-        
-        verbose("[Total %d windows to process]\n", window_count);
-        
-        for (int w = 0; w < window_count; w++) {
-            // Calculate the starting frame of the current window
-            int window_start = w * window_size;
-            // Calculate actual frames in this window (handles edge case at the end of video)
-            int frames_in_window = std::min(window_size, total_frames - w * window_size);
-            
-            verbose("\n[Processing window %d out of total %d: frame range %d-%d (total %d frames)]\n", 
-                   w+1, window_count, window_start, window_start + frames_in_window - 1, frames_in_window);
-            
-            // Position video to the start of current window
-            if (!benchmark_mode) {
-                if (use_moviefile) {
-                    fseek(moviefile, 0, SEEK_SET);
-                    video_info_struct tmp_info = initFile(moviefile, window_start);
-                    verbose("  Positioned movie file to frame %d\n", window_start);
-                } else {
-                    cap.set(cv::CAP_PROP_POS_FRAMES, window_start);
-                    verbose("  Positioned video to frame %d\n", window_start);
-                }
-            }
-            
-            // Calculate number of chunks needed for this window
-            int window_chunks = (frames_in_window + chunk_frame_count - 1) / chunk_frame_count;
-            
-            // === Initialize triple-buffer system for each window ===
-            // Preload first two chunks of data to initialize the buffer system
-            int first_chunk_frames = std::min(chunk_frame_count, frames_in_window);
-            loadVideoToHost(use_moviefile, moviefile, cap, h_chunk_nxt, info, first_chunk_frames, benchmark_mode);
-            loadVideoToHost(use_moviefile, moviefile, cap, h_chunk_cur, info, first_chunk_frames, benchmark_mode);
-            
-            // Pre-process the first buffer to initialize the start_list
-            // This is crucial for the triple-buffer pattern to work correctly
-            gpuErrorCheck(cudaMemcpyAsync(d_idle, h_chunk_nxt, chunk_size, cudaMemcpyHostToDevice, *stream_cur));
-            parseChunk(d_idle, d_start_list, d_workspace_cur, scale_vector, scale_count, first_chunk_frames, 
-                      info, FFT_plan_list, *stream_cur);
-            gpuErrorCheck(cudaStreamSynchronize(*stream_cur));
-            
-            // Process all chunks in the current window
-            for (int chunk_index = 0; chunk_index < window_chunks; chunk_index++) {
-                // Calculate actual frames in this chunk (handles edge case at the end of window)
-                int frames_in_chunk = std::min(chunk_frame_count, frames_in_window - chunk_index * chunk_frame_count);
-                
-                verbose("  [Processing chunk %d out of total %d (window frames %d-%d)]\n", 
-                       chunk_index + 1, window_chunks, 
-                       chunk_index * chunk_frame_count,
-                       chunk_index * chunk_frame_count + frames_in_chunk - 1);
-                
-                // Process current chunk data - copy to device and perform FFT
-                gpuErrorCheck(cudaMemcpyAsync(d_ready, h_chunk_cur, chunk_size, cudaMemcpyHostToDevice, *stream_cur));
-                parseChunk(d_ready, d_end_list, d_workspace_cur, scale_vector, scale_count, frames_in_chunk, 
-                          info, FFT_plan_list, *stream_cur);
-
-                // Analyze each frame in the chunk - compare with previous frames to calculate ISFs
-                for (int frame_offset = 0; frame_offset < frames_in_chunk; frame_offset++) {
-                    analyseChunk(d_start_list, d_end_list, d_accum_list_cur, scale_count, scale_vector,
-                                frames_in_chunk, chunk_frame_count, frame_offset, 
-                                tau_count, tau_vector, *stream_cur);
-                }
+    }
 
-                // Ensure next stream operations don't start until current operations complete
-                // This prevents data races in the triple-buffer system
-                gpuErrorCheck(cudaStreamSynchronize(*stream_nxt));
-
-                // Preload next chunk if needed
-                if (window_chunks - chunk_index > 2) {
-                    // Normal case - load next full chunk
-                    int next_frames = std::min(chunk_frame_count, frames_in_window - (chunk_index + 2) * chunk_frame_count);
-                    loadVideoToHost(use_moviefile, moviefile, cap, h_chunk_nxt, info, next_frames, benchmark_mode);
-                } else if (chunk_index + 2 == window_chunks && frames_in_window % chunk_frame_count != 0) {
-                    // Edge case - load remaining frames for the last partial chunk
-                    int remaining_frames = frames_in_window % chunk_frame_count;
-                    loadVideoToHost(use_moviefile, moviefile, cap, h_chunk_nxt, info, remaining_frames, benchmark_mode);
-                }
+    device_group_struct group;
+    group.device_count = device_count;
+    group.arrived      = 0;
+    group.generation   = 0;
+    group.d_accum.resize(device_count);
+    group.frames.resize(device_count);
 
-                // Rotate pointers for triple-buffer pattern
-                // This swaps current and next pointers for host and device buffers
-                swap<unsigned char>(h_chunk_cur, h_chunk_nxt);
-                swap<float>(d_workspace_cur, d_workspace_nxt);
-                swap<float*>(d_accum_list_cur, d_accum_list_nxt);
-                swap<cudaStream_t>(stream_cur, stream_nxt);
-
-                // Rotate the three-pointer circular buffers for FFT data and raw frame data
-                rotateThreePtr<cufftComplex*>(d_junk_list, d_start_list, d_end_list);
-                rotateThreePtr<unsigned char>(d_used, d_ready, d_idle);
-
-                verbose("  [Chunk %d out of total %d completed]\n", chunk_index + 1, window_chunks);
-
-                // Periodic accumulator processing if enabled
-                if (dump_accum_after != 0 && chunk_index != 0 && chunk_index % dump_accum_after == 0) {
-                    verbose("[Parsing Accumulator]\n");
-                    cudaDeviceSynchronize();
-                    if (multistream) {
-                        combineAccumulators(d_accum_list_cur, d_accum_list_nxt, scale_vector, scale_count, tau_count);
-                    }
+    std::vector<device_task_struct> tasks(device_count);
+
+    for (int d = 0; d < device_count; d++) {
+        tasks[d].device = d;
+        tasks[d].split_frames = split_frames;
+        tasks[d].group = &group;
+        tasks[d].episode_owned.assign(episode_count, device_count == 1 || split_frames);
+    }
 
-                    int tmp_frame_count = chunk_frame_count * dump_accum_after;
-                    std::string tmp_name = file_out + "_t" + std::to_string(chunks_already_parsed / dump_accum_after) + "_";
+    if (device_count == 1 || split_frames) {
+        for (int d = 0; d < device_count; d++) {
+            tasks[d].windows = all_windows;
+        }
+    } else if (single_pass || window_hop > 0) {
+        // every device streams the whole video for its own episodes
+        int active = 0;
+        for (int e = 0; e < episode_count; e++) {
+            if (episode_vector[e] > 0)
+                tasks[active++ % device_count].episode_owned[e] = true;
+        }
+    } else {
+        // Longest processing time first: each window goes to the device with the fewest frames so far
+        std::vector<window_unit_struct> by_cost = all_windows;
+        auto windowFrames = [&](const window_unit_struct &u) {
+            int window_size = episode_vector[u.episode];
+            return std::min(window_size, total_frames - u.window * window_size);
+        };
+        std::stable_sort(by_cost.begin(), by_cost.end(), [&](const window_unit_struct &a, const window_unit_struct &b) {
+            return windowFrames(a) > windowFrames(b);
+        });
+
+        std::vector<long> load(device_count, 0);
+        for (window_unit_struct &u : by_cost) {
+            int d = static_cast<int>(std::min_element(load.begin(), load.end()) - load.begin());
+            tasks[d].windows.push_back(u);
+            load[d] += windowFrames(u);
+        }
 
-                    analyse_accums(scale_vector, scale_count, lambda_arr, lambda_count, 
-                                 tau_vector, tau_count, tmp_frame_count, mask_tolerance, 
-                                 tmp_name, d_accum_list_cur, info.fps, window_size, w,
-                                 enable_angle_analysis, angle_count);
+        // Process in video order on each device to keep reads sequential
+        for (int d = 0; d < device_count; d++) {
+            std::sort(tasks[d].windows.begin(), tasks[d].windows.end(), [](const window_unit_struct &a, const window_unit_struct &b) {
+                return (a.episode != b.episode) ? a.episode < b.episode : a.window < b.window;
+            });
+        }
+    }
 
-                    verbose("  [Clearing accumulators for next batch processing]\n");
-                    if (multistream) {
-                        gpuErrorCheck(cudaMemset(d_accum_1, 0, accum_size));
-                        gpuErrorCheck(cudaMemset(d_accum_2, 0, accum_size));
-                    } else {
-                        gpuErrorCheck(cudaMemset(d_accum_1, 0, accum_size));
-                    }
+    auto runTask = [&](device_task_struct &task, bool half, const ISF_sink_function &task_sink) {
+        runDDMDevice(task, file_in, file_out, tau_vector, tau_count, lambda_arr, lambda_count, scale_vector, scale_count,
+                     x_offset, y_offset, episode_vector, episode_count, total_frames, frame_offset, chunk_frame_count,
+                     multistream, use_webcam, webcam_idx, mask_tolerance, use_moviefile, use_index_fps, use_explicit_fps,
+                     explicit_fps, dump_accum_after, benchmark_mode, enable_angle_analysis, angle_count, single_pass,
+                     prefetch_depth, half, wk_engine, multitau_points, fit_curves, live_chunks, checkpoint_interval, resume,
+                     tile_overlap, window_hop, gpu_decode, preprocess, task_sink, report, engine);
+    };
+
+    auto runAll = [&](bool half, const ISF_sink_function &task_sink) {
+        if (device_count == 1) {
+            runTask(tasks[0], half, task_sink);
+        } else {
+            verbose("[Multi-GPU] %d devices, %s mode\n", device_count, split_frames ? "frame-split" : "window");
 
-                    chunks_already_parsed += dump_accum_after;
-                }
+            std::vector<std::thread> threads;
+            for (int d = 0; d < device_count; d++) {
+                threads.emplace_back(runTask, std::ref(tasks[d]), half, std::cref(task_sink));
             }
-            
-            // Process the accumulated data for this window
-            analyse_accums(scale_vector, scale_count, lambda_arr, lambda_count, 
-                         tau_vector, tau_count, frames_in_window, mask_tolerance, 
-                         file_out, d_accum_list_cur, info.fps, window_size, w,
-                         enable_angle_analysis, angle_count);
-            
-            // Reset accumulators for the next window
-            if (multistream) {
-                gpuErrorCheck(cudaMemset(d_accum_1, 0, accum_size));
-                gpuErrorCheck(cudaMemset(d_accum_2, 0, accum_size));
-            } else {
-                gpuErrorCheck(cudaMemset(d_accum_1, 0, accum_size));
+            for (std::thread &t : threads) {
+                t.join();
             }
-
-            verbose("[Window %d out of total %d processing completed]\n", w+1, window_count);
         }
+    };
 
-        verbose("\n[Completed analysis for time window size=%d frames]\n\n", window_size);
-    }
+    if (!validate_precision && binary_output) {
+        conditionAssert(!sink, "binary output can not be combined with batch mode", true);
+        conditionAssert(dump_accum_after == 0, "binary output does not support rolling purge", true);
 
-    
-    cudaDeviceSynchronize();
-    auto end_main = std::chrono::high_resolution_clock::now();
+        // engine runs keep the tensors in memory for the caller
+        ISF_binary_store_struct file_store;
+        ISF_binary_store_struct &store = (engine != NULL && engine->result != NULL) ? *engine->result : file_store;
+        openBinaryStore(store, file_out, episode_vector, episode_count, total_frames, window_hop, scale_vector, scale_count,
+                        tile_overlap, lambda_arr, lambda_count, tau_vector, tau_count, enable_angle_analysis, angle_count, fit_curves,
+                        &store != &file_store);
 
-    for (int s = 0; s < scale_count; s++) {
-        cufftDestroy(FFT_plan_list[s]);
+        runAll(half_precision, [&](const ISF_block_struct &block) {
+            writeBinaryBlock(store, block);
+        });
+
+        closeBinaryStore(store);
+        return;
     }
 
-    // Free memory locations we no longer need
+    if (!validate_precision && map_output) {
+        conditionAssert(!sink && !binary_output, "map mode can not be combined with batch mode or binary output", true);
 
-    cudaFree(h_chunk_1);
-    cudaFree(h_chunk_2);
-    cudaFree(d_buffer);
-    cudaFree(d_fft_buffer);
-    cudaFree(d_workspace_1);
-    cudaFree(d_workspace_2);
+        ISF_map_writer_struct maps;
+        openMapWriter(maps, file_out, lambda_arr, lambda_count, tau_vector, tau_count, enable_angle_analysis, angle_count,
+                      tile_overlap, map_images);
 
-    if (multistream) {
-        combineAccumulators(d_accum_list_cur, d_accum_list_nxt, scale_vector, scale_count, tau_count);
-        //cudaFree(d_accum_2);
+        runAll(half_precision, [&](const ISF_block_struct &block) {
+            writeISFMaps(maps, block);
+        });
+
+        closeMapWriter(maps, scale_vector, scale_count);
+        return;
+    }
+
+    if (!validate_precision) {
+        runAll(half_precision, sink);
+        return;
     }
 
     //////////
-    ///  Analysis
+    ///  Precision Validation
     //////////
-    verbose("Analysis.\n");
 
-    auto end_out = std::chrono::high_resolution_clock::now();
+    // The analysis is run in single and then in half precision, nothing is written
+    // out, the ISF of every window is compared element by element instead.
 
-    auto duration1 = std::chrono::duration_cast < std::chrono::microseconds
-            > (end_main - start_time).count();
-    auto duration2 = std::chrono::duration_cast < std::chrono::microseconds
-            > (end_out - end_main).count();
+    conditionAssert(!use_webcam, "precision validation needs a video that can be read twice", true);
+    conditionAssert(!sink, "precision validation can not be combined with batch mode", true);
 
-    printf("[Time elapsed] "
-           "\n\tMain:\t\t%f s, "
-           "\n\tRadial Average:\t%f s,"
-           "\n\tTotal\t\t%f s,\t(%f frame / second)\n",
-           (float) duration1 / 1e6,
-           (float) duration2 / 1e6,
-           ((float) duration1 + (float) duration2) / 1e6,
-           (float) (total_frames * 1e6) / ((float) duration1 + (float) duration2));
+    std::mutex results_mtx;
+    std::map<std::string, std::vector<float>> reference;
+
+    auto blockKey = [](const ISF_block_struct &block) {
+        return block.file_out + "episode" + std::to_string(block.window_size) + "-" + std::to_string(block.window_index);
+    };
+
+    srand(1); // benchmark mode fills the host buffers from rand()
+    runAll(false, [&](const ISF_block_struct &block) {
+        std::lock_guard<std::mutex> lock(results_mtx);
+        reference[blockKey(block)].assign(block.ISF, block.ISF + block.ISF_offsets[block.scale_count]);
+    });
+
+    double max_rel_error   = 0.0;
+    double sum_rel_error   = 0.0;
+    size_t compared_count  = 0;
+    std::string worst_block;
+
+    srand(1);
+    runAll(true, [&](const ISF_block_struct &block) {
+        std::lock_guard<std::mutex> lock(results_mtx);
+        const std::vector<float> &ref = reference[blockKey(block)];
+        size_t count = block.ISF_offsets[block.scale_count];
+
+        conditionAssert(ref.size() == count, "no single precision result for " + blockKey(block), true);
+
+        // elements far below the block's largest value are dominated by absolute rounding, skip them
+        float ref_max = 0.0f;
+        for (size_t i = 0; i < count; i++)
+            ref_max = std::max(ref_max, std::fabs(ref[i]));
+
+        for (size_t i = 0; i < count; i++) {
+            if (std::fabs(ref[i]) <= PRECISION_VALIDATION_FLOOR * ref_max)
+                continue;
+
+            double rel_error = std::fabs(block.ISF[i] - ref[i]) / std::fabs(ref[i]);
+            sum_rel_error += rel_error;
+            compared_count++;
+
+            if (rel_error > max_rel_error) {
+                max_rel_error = rel_error;
+                worst_block = blockKey(block);
+            }
+        }
+    });
+
+    printf("[Precision Validation] %zu ISF values compared, half vs single precision FFT:\n"
+           "\tmax relative error:  %e (%s)\n"
+           "\tmean relative error: %e\n",
+           compared_count, max_rel_error, worst_block.c_str(),
+           compared_count ? sum_rel_error / compared_count : 0.0);
 }
@@ -0,0 +1,281 @@
+#include <string>
+#include <vector>
+#include <functional>
+
+#ifndef _DDM_H_
+#define _DDM_H_
+
+///////////////////////////////////////////////////////
+// Preprocessing fused into the parse of every chunk (-c, -d,
+// -e, -i), in place of an offline pass over the video. Raw
+// samples are flat-field corrected, (sample - offset) * gain,
+// binned to the mean of binning x binning raw pixels (the
+// region read is binning * main scale pixels wide) and, with
+// background_weight > 0, a running mean background
+// B += background_weight * (sample - B) is subtracted. The
+// background restarts from the first frame wherever the
+// frames streamed do not follow on. Map files hold one row
+// of pixels per line, either of the region read or of the
+// whole frame (cropped at the -x / -y offset).
+///////////////////////////////////////////////////////
+struct preprocess_params_struct {
+	std::string gain_file;				// empty: gain 1
+	std::string offset_file;			// empty: offset 0
+	float background_weight = 0.0f;		// 0: no background subtraction
+	int   binning = 1;
+};
+
+inline bool preprocessEnabled(const preprocess_params_struct &pre) {
+	return !pre.gain_file.empty() || !pre.offset_file.empty() || pre.background_weight > 0.0f || pre.binning > 1;
+}
+
+struct DDMparams {
+	std::string     file_in;
+	std::string     file_out;
+	std::string     q_file_name;	// file-path for q-vector
+	std::string     t_file_name;	// file-path for tau-vector
+	std::string		s_file_name;	// file-path for scale-vector
+	std::string     e_file_name;    // file-path for episode-vector
+
+	int    frame_count;				// number of frames to analyse
+	int    frame_offset     = 0;    // number of frames to skip at start
+	int    x_off 			= 0;    // number of pixels to offset x=0 by in frame
+	int    y_off 			= 0;	// number of pixels to offset y=0 by in frame
+	int    chunk_length		= 30;   // number of frames in frame buffer, default is 30
+	int    rolling_purge	= 0;    // purge and analyse accumulators after number of frames
+
+	bool   use_webcam 		= false;
+	int    webcam_idx 		= 0;
+	bool   use_movie_file	= false;
+	bool   use_index_fps 	= false; // if flag set to false, use frame-indcies not frame-rate
+	bool   use_explicit_fps = false;
+	float  explicit_fps 	= 1.0;
+	bool   multi_stream 	= true;
+	float  q_tolerance		= 1.2;  // tolerance factor for q-vector mask: values between q and q*tolerance are included in the mask
+	bool   benchmark_mode 	= false;
+    bool   use_episodes = false;            // Whether to use time windows from episode file
+	bool enable_angle_analysis = false;   // Whether to enable angle sector analysis, disabled by default
+	int angle_count = 8;                 // Number of angle sections, default is 8
+	bool single_pass = false;            // Stream the video once for all episode sizes
+	int prefetch_depth = 4;              // Number of host chunks the reader thread loads ahead
+	int device_count = 1;                // Number of GPUs to use
+	bool split_frames = false;           // Multi-GPU: split each window's frames rather than the windows
+	std::string manifest_file;           // batch mode: one line of arguments per run
+	bool half_precision = false;         // FFT and FFT ring in half precision (8-bit video)
+	bool validate_precision = false;     // compare half against single precision ISF, no output
+	bool wk_engine = false;              // structure function from temporal FFT autocorrelation
+	int multitau_points = 0;             // multi-tau correlator with this many frames per level (0 = off)
+	bool binary_output = false;          // one float32 ISF tensor file instead of per-tile text files
+	bool fit_curves = false;             // fit the ISF model to every curve on the GPU
+	int live_chunks = 0;                 // live mode: sliding window of this many chunks (0 = off)
+	std::string benchmark_suite_file;    // benchmark sweep, JSON report written here
+	std::string metrics_file;            // periodic counter export (JSON, Prometheus text if *.prom)
+	int checkpoint_interval = 0;         // seconds between checkpoints (0 = off)
+	bool resume = false;                 // continue from the checkpoint of a previous run
+	bool map_output = false;             // one dense [tile_y][tile_x][q][angle][tau] map per scale and window
+	bool map_images = false;             // heatmap images next to the maps
+	int tile_overlap = 1;                // tiles of a scale are scale / tile_overlap pixels apart
+	int window_hop = 0;                  // sliding windows start every window_hop frames (0 = disjoint)
+	bool gpu_decode = false;             // decode compressed video on the GPU (NVDEC), no host staging
+	preprocess_params_struct preprocess; // flat-field, binning and background fused into the parse
+};
+
+// Values read from the lambda / tau / scale / episode files of a run
+struct parameter_lists_struct {
+	std::vector<float> lambda;
+	std::vector<int>   tau;
+	std::vector<int>   scale;
+	std::vector<int>   episode;
+};
+
+///////////////////////////////////////////////////////
+// Tiles and windows. Neighbouring tiles of a scale are
+// scale / tile_overlap pixels apart (tile_overlap 1: the
+// tiles cover the frame without overlap), tiles are
+// numbered row-major. Windows of an episode start every
+// window_hop frames (0: every window_size frames), the
+// last window may be partial. Scales may have any size that
+// divides the main scale, cuFFT is fastest for sizes of the
+// form 2^a 3^b 5^c 7^d (7-smooth).
+///////////////////////////////////////////////////////
+inline bool isPowerOfTwo(int n) {
+	return n > 0 && !(n & (n - 1));
+}
+
+inline bool isSmoothSize(int n) {
+	const int primes[] = {2, 3, 5, 7};
+	for (int p : primes) {
+		while (n > 1 && n % p == 0)
+			n /= p;
+	}
+	return n == 1;
+}
+
+inline int tilesPerSide(int scale, int main_scale, int tile_overlap) {
+	return tile_overlap * (main_scale / scale - 1) + 1;
+}
+
+inline int tileCount(int scale, int main_scale, int tile_overlap) {
+	return tilesPerSide(scale, main_scale, tile_overlap) * tilesPerSide(scale, main_scale, tile_overlap);
+}
+
+inline int windowCount(int total_frames, int window_size, int window_hop) {
+	if (window_size <= 0 || total_frames <= 0)
+		return 0;
+
+	int hop = (window_hop > 0) ? window_hop : window_size;
+	int hop_count = (total_frames + hop - 1) / hop;
+	int count = hop_count - window_size / hop + 1;
+	return (count > 1) ? count : 1;
+}
+
+///////////////////////////////////////////////////////
+// One analysed window handed to an ISF sink: the ISF of every
+// scale, tile, ring and tau, stored as
+// ISF[ISF_offsets[s] + (tile * ring_count + ring) * tau_count + tau],
+// and with the GPU fit the model parameters of every curve,
+// fit[(ISF_offsets[s] / tau_count + tile * ring_count + ring) * FIT_PARAM_COUNT + param].
+// Pointers are only valid during the call.
+///////////////////////////////////////////////////////
+struct ISF_block_struct {
+	std::string  file_out;		// output prefix of the window (includes rolling purge suffix)
+	int          window_size;
+	int          window_index;
+	int          frames_analysed;
+	float        fps;
+	int          scale_count;
+	const int    *scale_arr;
+	int          tile_overlap;
+	const size_t *ISF_offsets;
+	int          ring_count;
+	int          tau_count;
+	const int    *tau_arr;		// lags analysed, in frames (rounded to multi-tau lags with -m)
+	const float  *ISF;
+	const float  *fit;			// NULL without the GPU fit
+};
+
+// Receives analysed windows instead of the per-tile text files being written. Called from
+// the writer thread of each GPU, so must be thread-safe when more than one GPU is used
+typedef std::function<void(const ISF_block_struct &block)> ISF_sink_function;
+
+// Pipeline stages timed by the benchmark suite
+enum pipeline_stage {
+	STAGE_H2D,			// raw chunk host to device copy
+	STAGE_PARSE,		// raw frames to FFT input samples
+	STAGE_FFT,			// spatial cuFFT of every scale
+	STAGE_DIFFERENCE,	// difference / correlation accumulation
+	STAGE_REDUCTION,	// azimuthal average of the accumulators
+	STAGE_OUTPUT,		// ISF written out (host, writer thread)
+	STAGE_COUNT
+};
+
+// Timing of one run (single GPU): GPU time of each stage summed over all of its
+// launches and the memory traffic and arithmetic the stage is modelled to do
+struct benchmark_report_struct {
+	int    frames;
+	double total_seconds;
+	double stage_ms[STAGE_COUNT];
+	double stage_bytes[STAGE_COUNT];
+	double stage_flops[STAGE_COUNT];
+};
+
+///////////////////////////////////////////////////////
+// Runs of a DDMEngine (ddm_engine.hpp). The cache keeps the
+// device and pinned buffers, FFT plans and ring indices of a
+// run for the next one, frames (optional) replaces the video
+// file: frame_count frames of w x h pixels in host memory,
+// frame f at frames + f * w * h * bpp, read in place. With
+// binary output the ISF tensors are kept in result.
+///////////////////////////////////////////////////////
+struct engine_cache_struct;		// DDM.cu
+struct ISF_binary_store_struct;	// isf_store.hpp
+
+struct host_frames_struct {
+	const unsigned char *frames;
+	int   frame_count;
+	int   w;
+	int   h;
+	int   bpp;					// bytes per pixel, 1 (uchar) or 2 (uint16)
+	float fps;
+};
+
+struct engine_run_struct {
+	engine_cache_struct      *cache;
+	const host_frames_struct *frames;		// NULL to read params.file_in
+	ISF_binary_store_struct  *result;		// opened in memory by runDDM
+};
+
+engine_cache_struct *createEngineCache(int device);
+void destroyEngineCache(engine_cache_struct *cache);
+
+void printHelp();
+bool parseArguments(int argc, char **argv, DDMparams &params, bool require_input);
+void readParameterFiles(DDMparams &params, parameter_lists_struct &lists);
+
+// Runs runDDM on the parsed parameters, optionally only windows [window_begin, window_end)
+// of episode only_episode (only_episode < 0 runs everything)
+void runFromParams(DDMparams &params, parameter_lists_struct &lists,
+                   int only_episode, int window_begin, int window_end,
+                   const ISF_sink_function &sink,
+                   benchmark_report_struct *report,
+                   const engine_run_struct *engine);
+
+int runBatch(DDMparams &params, int *argc, char ***argv);
+
+int runBenchmarkSuite(DDMparams &params, parameter_lists_struct &lists);
+
+// main DDM function
+void runDDM(std::string file_in,
+            std::string file_out,
+            int *tau_arr,
+            int tau_count,
+            float *lambda_arr,
+            int lambda_count,
+            int *scale_arr,
+            int scale_count,
+            int x_off,
+            int y_off,
+            int *episode_vector,
+            int episode_count,
+            int frame_count,
+            int frame_offset,
+            int chunk_frame_count,
+            bool multistream,
+            bool use_webcam,
+            int webcam_idx,
+            float q_tolerance,
+            bool use_movie_file,
+            bool use_index_fps,
+            bool use_explicit_fps,
+            float explicit_fps,
+            int dump_accum_after,
+            bool benchmark_mode,
+            bool enable_angle_analysis,
+            int angle_count,
+            bool single_pass,
+            int prefetch_depth,
+            int device_count,
+            bool split_frames,
+            int only_episode,
+            int window_begin,
+            int window_end,
+            const ISF_sink_function &sink,
+            bool half_precision,
+            bool validate_precision,
+            bool wk_engine,
+            int multitau_points,
+            bool binary_output,
+            bool fit_curves,
+            int live_chunks,
+            int checkpoint_interval,
+            bool resume,
+            bool map_output,
+            bool map_images,
+            int tile_overlap,
+            int window_hop,
+            bool gpu_decode,
+            const preprocess_params_struct &preprocess,
+            benchmark_report_struct *report,
+            const engine_run_struct *engine);
+
+#endif
@@ -1,4 +1,6 @@
 #include <cuda_runtime.h>
+#include <cufft.h>
+#include <cuda_fp16.h>
 #include "constants.hpp"
 #include "video_reader.hpp"
 
@@ -36,12 +38,28 @@ __global__ void parseBufferScale(const unsigned char* __restrict__ d_buffer,
     }
 }
 
+// Byte order swap of one sample, used for big-endian 16-bit video
+__device__ __forceinline__ unsigned char swapBytes(unsigned char v) { return v; }
+__device__ __forceinline__ unsigned short swapBytes(unsigned short v) { return static_cast<unsigned short>((v >> 8) | (v << 8)); }
+
+// Store of one parsed sample as FFT input, float or half precision
+__device__ __forceinline__ void storeSample(float *dst, float v) { *dst = v; }
+__device__ __forceinline__ void storeSample(__half *dst, float v) { *dst = __float2half(v); }
+
+// Load of one FFT coefficient from the ring, float or half precision
+__device__ __forceinline__ float2 loadComplex(const cufftComplex &v) { return v; }
+__device__ __forceinline__ float2 loadComplex(const __half2 &v) { return __half22float2(v); }
+
 ///////////////////////////////////////////////////////
 // More optimised GPU function to parse the input video to get ready for FFT,
 // Only works if frame size is a power of 2 - we take shortcut to avoid modulo operation
+// Samples are uchar or uint16 (T), channel_pp is counted in samples. If swap_bytes
+// is set, samples are converted from big-endian. Output is float or half (P), each
+// sample is multiplied by sample_scale.
 ///////////////////////////////////////////////////////
-__global__ void parseBufferScalePow2(const unsigned char* __restrict__ d_buffer,
-                                    float* __restrict__ d_parsed,
+template <typename T, bool swap_bytes, typename P>
+__global__ void parseBufferScalePow2(const T* __restrict__ d_buffer,
+                                    P* __restrict__ d_parsed,
                                     const unsigned int channel_pp,
                                     const unsigned int channel_idx,
                                     const unsigned int img_width,
@@ -50,7 +68,8 @@ __global__ void parseBufferScalePow2(const unsigned char* __restrict__ d_buffer,
                                     const unsigned int y_offset,
                                     const unsigned int scale,
                                     const unsigned int main_scale,
-                                    const unsigned int frame_count) {
+                                    const unsigned int frame_count,
+                                    const float sample_scale) {
 
     const unsigned int x = blockIdx.x * BLOCKSIZE_X + threadIdx.x;
     const unsigned int y = blockIdx.y * BLOCKSIZE_Y + threadIdx.y;
@@ -71,34 +90,402 @@ __global__ void parseBufferScalePow2(const unsigned char* __restrict__ d_buffer,
 //            d_parsed[f * main_scale * main_scale + new_idx] = dk_uchar_float_lookup
 //            		[d_buffer[channel_pp * (f * img_width * img_height + (y + y_offset) * img_width + (x + x_offset)) + channel_idx]];
 
-            d_parsed[f * main_scale * main_scale + new_idx] = static_cast<float>(
-            		d_buffer[channel_pp * (f * img_width * img_height + (y + y_offset) * img_width + (x + x_offset)) + channel_idx]);
+            T sample = d_buffer[channel_pp * (f * img_width * img_height + (y + y_offset) * img_width + (x + x_offset)) + channel_idx];
+
+            if (swap_bytes)
+                sample = swapBytes(sample);
+
+            storeSample(&d_parsed[f * main_scale * main_scale + new_idx], sample_scale * static_cast<float>(sample));
         }
     }
 }
 
 
 ///////////////////////////////////////////////////////
-// GPU function to add the absolute magnitude of FFT to accumulator array
+// Preprocessing fused into the parse (see preprocess_params_struct).
+// Maps hold one value per raw pixel of the region read, the
+// background one value per main scale pixel, carried from
+// chunk to chunk. Passed by value to the kernel.
 ///////////////////////////////////////////////////////
-__global__ void processFFT(const cufftComplex* __restrict__ d_dataA,
-                           const cufftComplex* __restrict__ d_dataB,
-                           float * __restrict__ d_odata,
-                           float fft_norm,
-                           int frame_size) {
+struct preprocess_struct {
+    const float *d_gain;        // NULL: gain 1
+    const float *d_offset;      // NULL: offset 0
+    float *d_background;        // running mean, NULL: no background subtraction
+    float background_weight;    // weight of the newest frame in the running mean
+    bool background_reset;      // the background starts from the first frame of the chunk
+    unsigned int binning;       // binning x binning raw pixels per sample
+};
 
-    unsigned int i = blockIdx.x * BLOCKSIZE + threadIdx.x;
+///////////////////////////////////////////////////////
+// Parse with preprocessing, output row-major at the main scale
+// as parseChunk uses the parse. Every sample is the mean of
+// binning x binning raw samples, each corrected as
+// (sample - offset) * gain, minus the running mean background
+// (updated after the sample is taken), times sample_scale.
+// Frames of a pixel are visited in order by one thread, so
+// the background is a register between loads and stores.
+// With no preprocessing (binning 1, no maps or background)
+// it is also the parse of main scales that are no power of
+// two, the row-major output needs no tile index arithmetic.
+///////////////////////////////////////////////////////
+template <typename T, bool swap_bytes, typename P>
+__global__ void parseBufferPreprocess(const T* __restrict__ d_buffer,
+                                      P* __restrict__ d_parsed,
+                                      const unsigned int channel_pp,
+                                      const unsigned int img_width,
+                                      const unsigned int img_height,
+                                      const unsigned int main_scale,
+                                      const unsigned int frame_count,
+                                      const float sample_scale,
+                                      const preprocess_struct pre) {
+
+    const unsigned int x = blockIdx.x * BLOCKSIZE_X + threadIdx.x;
+    const unsigned int y = blockIdx.y * BLOCKSIZE_Y + threadIdx.y;
+
+    if (x < main_scale && y < main_scale) {
+        const unsigned int idx = y * main_scale + x;
+        const float bin_norm = 1.0f / (pre.binning * pre.binning);
+
+        float background = (pre.d_background != NULL && !pre.background_reset) ? pre.d_background[idx] : 0.0f;
+
+        for (unsigned int f = 0; f < frame_count; f++) {
+            float value = 0.0f;
+
+            for (unsigned int by = 0; by < pre.binning; by++) {
+                for (unsigned int bx = 0; bx < pre.binning; bx++) {
+                    const unsigned int px = (y * pre.binning + by) * img_width + x * pre.binning + bx;
+
+                    T sample = d_buffer[channel_pp * (f * img_width * img_height + px)];
+
+                    if (swap_bytes)
+                        sample = swapBytes(sample);
+
+                    float v = static_cast<float>(sample);
+                    if (pre.d_offset != NULL)
+                        v -= pre.d_offset[px];
+                    if (pre.d_gain != NULL)
+                        v *= pre.d_gain[px];
+
+                    value += v;
+                }
+            }
+            value *= bin_norm;
+
+            if (pre.d_background != NULL) {
+                if (f == 0 && pre.background_reset)
+                    background = value;
+
+                float foreground = value - background;
+                background += pre.background_weight * (value - background);
+                value = foreground;
+            }
+
+            storeSample(&d_parsed[f * main_scale * main_scale + idx], sample_scale * value);
+        }
+
+        if (pre.d_background != NULL)
+            pre.d_background[idx] = background;
+    }
+}
+
+
+///////////////////////////////////////////////////////
+// Overlapping tiles: copies the rows of every band of tiles
+// (tile row band_index, rows band_index * stride to
+// band_index * stride + scale of the parsed main scale
+// frame) into a buffer of its own, bands of a frame after
+// one another, so the FFT plans read all tiles of a band at
+// a fixed distance as for non-overlapping tiles. blockIdx.z
+// is the band.
+///////////////////////////////////////////////////////
+template <typename P>
+__global__ void gatherTileBands(const P* __restrict__ d_frames,
+                                P* __restrict__ d_bands,
+                                int main_scale,
+                                int scale,
+                                int stride,
+                                int band_count,
+                                int frame_count) {
+
+    const int x = blockIdx.x * BLOCKSIZE_X + threadIdx.x;
+    const int y = blockIdx.y * BLOCKSIZE_Y + threadIdx.y;
+    const int band = blockIdx.z;
+
+    if (x < main_scale && y < scale) {
+        for (int f = 0; f < frame_count; f++) {
+            d_bands[((static_cast<size_t>(f) * band_count + band) * scale + y) * main_scale + x] =
+                    d_frames[(static_cast<size_t>(f) * main_scale + band * stride + y) * main_scale + x];
+        }
+    }
+}
+
+
+///////////////////////////////////////////////////////
+// GPU function to accumulate |FFT(t + tau) - FFT(t)|^2 for frames t in
+// [frame_begin, frame_end) of a chunk and a batch of TAU_BATCH tau values in a
+// single launch (blockIdx.y selects the tau batch). Frame t is read once per batch
+// and kept in registers, as are the partial sums, so the accumulator is only
+// touched once per tau at the end. Frames t + tau beyond the current chunk are
+// taken from the next chunk of the circular buffer (d_next), pairs are only
+// counted if partner_begin <= t + tau < frame_limit (frame_limit <= 2 *
+// chunk_frame_count).
+// The ring holds float (cufftComplex) or half (__half2) coefficients (C), the
+// differences are always formed and accumulated in float.
+///////////////////////////////////////////////////////
+template <typename C>
+__global__ void processFFTChunk(const C* __restrict__ d_current,
+                                const C* __restrict__ d_next,
+                                float* __restrict__ d_accum,
+                                const int* __restrict__ d_tau,
+                                int tau_count,
+                                float fft_norm,
+                                int frame_size,
+                                int frame_begin,
+                                int frame_end,
+                                int partner_begin,
+                                int frame_limit,
+                                int chunk_frame_count) {
+
+    const unsigned int i = blockIdx.x * BLOCKSIZE + threadIdx.x;
+    const int tau_base = blockIdx.y * TAU_BATCH;
+
+    if (i < frame_size) {
+        int   tau[TAU_BATCH];
+        float sum[TAU_BATCH];
+
+        #pragma unroll
+        for (int k = 0; k < TAU_BATCH; k++) {
+            // unused slots get a lag that can never be satisfied
+            tau[k] = (tau_base + k < tau_count) ? d_tau[tau_base + k] : frame_limit;
+            sum[k] = 0.0f;
+        }
+
+        for (int f = frame_begin; f < frame_end; f++) {
+            const float2 a = loadComplex(d_current[static_cast<size_t>(f) * frame_size + i]);
+
+            #pragma unroll
+            for (int k = 0; k < TAU_BATCH; k++) {
+                const int g = f + tau[k];
+
+                if (g >= partner_begin && g < frame_limit) {
+                    const float2 b = loadComplex((g < chunk_frame_count)
+                            ? d_current[static_cast<size_t>(g) * frame_size + i]
+                            : d_next[static_cast<size_t>(g - chunk_frame_count) * frame_size + i]);
+
+                    const float dx = fft_norm * (a.x - b.x);
+                    const float dy = fft_norm * (a.y - b.y);
+
+                    sum[k] += dx * dx + dy * dy;
+                }
+            }
+        }
+
+        #pragma unroll
+        for (int k = 0; k < TAU_BATCH; k++) {
+            if (tau_base + k < tau_count) {
+                d_accum[static_cast<size_t>(tau_base + k) * frame_size + i] += sum[k];
+            }
+        }
+    }
+}
+
+///////////////////////////////////////////////////////
+// Multi-tau correlator. Frames [frame_begin, frame_end) of a chunk are
+// pushed, in order, into a hierarchy of rings of [points] frames per
+// pixel (d_ring, [level][slot][pixel]). Level l holds the averages of
+// 2^l consecutive frames, a level's frame is complete every second
+// frame of the level below. A lag tau = j * 2^l (j < points) is taken
+// at level l as |F_l(n) - F_l(n - j)|^2, weighted by 2^l so every tau
+// is normalised like the direct difference. first_index is the index of
+// frame_begin within its window, no pairs cross a window start.
+// Lags of level l are d_tau[d_level_offsets[l] .. d_level_offsets[l+1]).
+///////////////////////////////////////////////////////
+template <typename C>
+__global__ void processMultiTauChunk(const C* __restrict__ d_chunk,
+                                     cufftComplex* __restrict__ d_ring,
+                                     float* __restrict__ d_accum,
+                                     const int* __restrict__ d_tau,
+                                     const int* __restrict__ d_level_offsets,
+                                     int level_count,
+                                     int points,
+                                     float fft_norm,
+                                     int frame_size,
+                                     int frame_begin,
+                                     int frame_end,
+                                     int first_index) {
+
+    const unsigned int i = blockIdx.x * BLOCKSIZE + threadIdx.x;
 
     if (i < frame_size) {
-        cufftComplex val;
-        val.x = fft_norm * (d_dataA[i].x - d_dataB[i].x);
-        val.y = fft_norm * (d_dataA[i].y - d_dataB[i].y);
+        for (int f = frame_begin; f < frame_end; f++) {
+            const float2 a = loadComplex(d_chunk[static_cast<size_t>(f) * frame_size + i]);
+            cufftComplex v = make_float2(fft_norm * a.x, fft_norm * a.y);
+
+            int n = first_index + (f - frame_begin); // frame index at the current level
+
+            for (int l = 0; l < level_count; l++) {
+                cufftComplex *ring = d_ring + static_cast<size_t>(l) * points * frame_size;
+                const float weight = static_cast<float>(1 << l);
+
+                for (int k = d_level_offsets[l]; k < d_level_offsets[l + 1]; k++) {
+                    const int j = d_tau[k] >> l;
+
+                    if (j > 0 && n >= j) {
+                        const cufftComplex b = ring[static_cast<size_t>((n - j) % points) * frame_size + i];
+                        const float dx = v.x - b.x;
+                        const float dy = v.y - b.y;
+
+                        d_accum[static_cast<size_t>(k) * frame_size + i] += weight * (dx * dx + dy * dy);
+                    }
+                }
+
+                ring[static_cast<size_t>(n % points) * frame_size + i] = v;
+
+                if (!(n & 1)) // next level's frame is the average of this and the previous frame
+                    break;
+
+                const cufftComplex prev = ring[static_cast<size_t>((n - 1) % points) * frame_size + i];
+                v = make_float2(0.5f * (prev.x + v.x), 0.5f * (prev.y + v.y));
+                n >>= 1;
+            }
+        }
+    }
+}
+
+
+///////////////////////////////////////////////////////
+// Wiener-Khinchin engine, step 1. For pixels [base, base + pixel_count)
+// of a window of frame_count FFT frames (d_store, frame-major), copies
+// the mean-free time series of each pixel into column p of d_pad
+// (L x batch_stride, zero padded from frame_count to L) and stores
+//     d_sum[k][p] = sum_{t >= tau_k} |F(t)|^2 + sum_{t < N - tau_k} |F(t)|^2
+// i.e. the two intensity terms of
+//     D(tau) = sum_t |F(t + tau) - F(t)|^2.
+// Removing the mean does not change D but avoids cancellation in float.
+// Tau values must be ascending.
+///////////////////////////////////////////////////////
+__global__ void kernelWKLoad(const cufftComplex* __restrict__ d_store,
+                             cufftComplex* __restrict__ d_pad,
+                             float* __restrict__ d_sum,
+                             const int* __restrict__ d_tau,
+                             int tau_count,
+                             int frame_size,
+                             int base,
+                             int pixel_count,
+                             int batch_stride,
+                             int frame_count,
+                             int L) {
+
+    const int p = blockIdx.x * BLOCKSIZE + threadIdx.x;
+
+    if (p < pixel_count) {
+        const int i = base + p;
+
+        cufftComplex mean = {0.0f, 0.0f};
+        for (int t = 0; t < frame_count; t++) {
+            cufftComplex v = d_store[static_cast<size_t>(t) * frame_size + i];
+            mean.x += v.x;
+            mean.y += v.y;
+        }
+        mean.x /= frame_count;
+        mean.y /= frame_count;
+
+        for (int k = 0; k < tau_count; k++) {
+            d_sum[static_cast<size_t>(k) * batch_stride + p] = 0.0f;
+        }
+
+        // prefix = sum_{t' < t} |F(t')|^2, the lag pointers fire when t reaches tau_k (ascending)
+        // and N - tau_k (descending)
+        float prefix = 0.0f;
+        int ka = 0;
+        int kb = tau_count - 1;
+
+        for (int t = 0; t <= frame_count; t++) {
+            while (ka < tau_count && d_tau[ka] <= t) {
+                d_sum[static_cast<size_t>(ka) * batch_stride + p] -= prefix;
+                ka++;
+            }
+            while (kb >= 0 && frame_count - d_tau[kb] <= t) {
+                d_sum[static_cast<size_t>(kb) * batch_stride + p] += prefix;
+                kb--;
+            }
+
+            if (t < frame_count) {
+                cufftComplex v = d_store[static_cast<size_t>(t) * frame_size + i];
+                v.x -= mean.x;
+                v.y -= mean.y;
+
+                d_pad[static_cast<size_t>(t) * batch_stride + p] = v;
+                prefix += v.x * v.x + v.y * v.y;
+            }
+        }
+
+        for (int k = 0; k < tau_count; k++) {
+            d_sum[static_cast<size_t>(k) * batch_stride + p] += prefix;
+        }
 
-        d_odata[i] += val.x * val.x + val.y * val.y;
+        for (int t = frame_count; t < L; t++) {
+            d_pad[static_cast<size_t>(t) * batch_stride + p] = make_float2(0.0f, 0.0f);
+        }
+    }
+}
+
+
+///////////////////////////////////////////////////////
+// Wiener-Khinchin engine, step 2: replaces the temporal
+// spectrum by its power spectrum |X|^2
+///////////////////////////////////////////////////////
+__global__ void kernelWKPower(cufftComplex* __restrict__ d_pad,
+                              size_t element_count) {
+
+    const size_t i = static_cast<size_t>(blockIdx.x) * BLOCKSIZE + threadIdx.x;
+
+    if (i < element_count) {
+        cufftComplex v = d_pad[i];
+        d_pad[i] = make_float2(v.x * v.x + v.y * v.y, 0.0f);
+    }
+}
+
+
+///////////////////////////////////////////////////////
+// Wiener-Khinchin engine, step 3. d_pad holds L times the
+// autocorrelation sum_t F*(t) F(t + tau) of every pixel, adds
+//     fft_norm^2 * (d_sum[k] - 2 Re(A(tau_k)))
+// to the accumulator, the same value the direct difference
+// kernel accumulates. Lags >= frame_count have no pairs.
+///////////////////////////////////////////////////////
+__global__ void kernelWKAccum(const cufftComplex* __restrict__ d_pad,
+                              const float* __restrict__ d_sum,
+                              float* __restrict__ d_accum,
+                              const int* __restrict__ d_tau,
+                              int tau_count,
+                              int frame_size,
+                              int base,
+                              int pixel_count,
+                              int batch_stride,
+                              int frame_count,
+                              int L,
+                              float fft_norm2) {
 
+    const int p = blockIdx.x * BLOCKSIZE + threadIdx.x;
+
+    if (p < pixel_count) {
+        const float inv_L = 1.0f / L;
+
+        for (int k = 0; k < tau_count; k++) {
+            const int tau = d_tau[k];
+
+            if (tau < frame_count) {
+                float corr = d_pad[static_cast<size_t>(tau) * batch_stride + p].x * inv_L;
+                float D = d_sum[static_cast<size_t>(k) * batch_stride + p] - 2.0f * corr;
+
+                d_accum[static_cast<size_t>(k) * frame_size + base + p] += fft_norm2 * D;
+            }
+        }
     }
 }
 
+
 ///////////////////////////////////////////////////////
 // Simple GPU function to combine two accumulator arrays - for use if using CUDA streams
 ///////////////////////////////////////////////////////
@@ -117,4 +504,27 @@ __global__ void combineAccum(float* __restrict__ d_dataA,
 }
 
 
+///////////////////////////////////////////////////////
+// Live mode: adds the newest sub-accumulator d_in to the
+// window total and subtracts (and zeroes) the expired one,
+// d_out, when it is not NULL. Accumulator sets are flat.
+///////////////////////////////////////////////////////
+__global__ void updateLiveAccum(float* __restrict__ d_total,
+                                const float* __restrict__ d_in,
+                                float* __restrict__ d_out,
+                                size_t count) {
+
+    size_t i = static_cast<size_t>(blockIdx.x) * BLOCKSIZE + threadIdx.x;
+
+    if (i < count) {
+        float value = d_total[i] + d_in[i];
+        if (d_out != NULL) {
+            value -= d_out[i];
+            d_out[i] = 0.0f;
+        }
+        d_total[i] = value;
+    }
+}
+
+
 #endif
\ No newline at end of file
@@ -1,27 +1,46 @@
 #include <string>
+#include <ostream>
+#include <cuda_runtime.h>
 
 #ifndef _AZIMUTHAL_AVERAGE_
 #define _AZIMUTHAL_AVERAGE_
 
-void buildAzimuthMask(bool *d_mask_out,
-					  int *h_pixel_counts,
-					  float *q_arr, int q_count,
-					  float q_tolerance,
-					  int w, int h,
+// Compact (CSR) list of the Fourier pixels of one tile that lie in
+// each azimuthal ring (q-value, or q-value and angular segment)
+struct ring_index_struct {
+	int ring_count;
+	int pixel_count;	// total number of entries over all rings
+	int *h_offsets;		// ring r holds entries [offsets[r], offsets[r + 1])
+	int *d_offsets;
+	int *d_pixels;		// pixel indices within the right half of a tile's FFT
+};
+
+void buildRingIndex(ring_index_struct &rings,
+					float *q_arr, int q_count,
+					float q_tolerance,
+					int w, int h,
+					bool enable_angle_analysis,
+					int angle_count);
+
+void freeRingIndex(ring_index_struct &rings);
+
+void analyseAccumDevice(float *d_accum,
+						ring_index_struct &rings,
+						float *d_ISF_out,
+						float norm_factor,
+						int tau_count,
+						int tile_count,
+						int w, int h,
+						cudaStream_t stream);
+
+void writeIqtToStream(std::ostream &out,
+					  const float *ISF,
+					  const float *lambda_arr, int lambda_count,
+					  const int   *tau_arr,	   int tau_count,
+					  float fps,
 					  bool enable_angle_analysis,
 					  int angle_count);
 
-float * analyseFFTDevice(float *d_data_in,
-                        bool *d_mask,
-                        int *h_px_count,
-                        float norm_factor,
-                        int tau_count,
-                        int q_count,
-                        int tile_count,
-                        int w, int h,
-                        bool enable_angle_analysis,
-                        int angle_count);
-
 void writeIqtToFile(std::string filename,
 					float *ISF,
 					float *lambda_arr, int lambda_count,
@@ -1,7 +1,7 @@
 //////////////////////////////////////
 //  Reduction code is based heavily on the reduction_example from Nvidia's CUDA SDK examples
 //  See "Optimizing parallel reduction in CUDA" - M. Harris for more details
-//  some tweaks in regard to adding Boolean mask made
+//  reduction is done over the pixel lists of a compact ring index
 //////////////////////////////////////
 
 #include <stdio.h>
@@ -10,40 +10,6 @@
 #ifndef AZIMUTH_KERNEL
 #define AZIMUTH_KERNEL
 
-// Utility class used to avoid linker errors with extern
-// unsized shared memory arrays with templated type
-template <class T>
-struct SharedMemory {
-  __device__ inline operator T *() {
-    extern __shared__ int __smem[];
-    return (T *)__smem;
-  }
-
-  __device__ inline operator const T *() const {
-    extern __shared__ int __smem[];
-    return (T *)__smem;
-  }
-};
-
-// Specialise for double to avoid unaligned memory
-// access compile errors
-template <>
-struct SharedMemory<double> {
-  __device__ inline operator double *() {
-    extern __shared__ double __smem_d[];
-    return (double *)__smem_d;
-  }
-
-  __device__ inline operator const double *() const {
-    extern __shared__ double __smem_d[];
-    return (double *)__smem_d;
-  }
-};
-
-
-bool isPow2(unsigned int x) { return ((x & (x - 1)) == 0); }
-
-
 template <class T>
 __device__ __forceinline__ T warpReduceSum(unsigned int mask, T mySum) {
 	for (int offset = warpSize / 2; offset > 0; offset /= 2) {
@@ -65,175 +31,182 @@ __device__ __forceinline__ int warpReduceSum<int>(unsigned int mask,
 #endif
 
 
-template <typename T, unsigned int blockSize, bool nIsPow2>
-__global__ void kernelMaskReduce(const T* __restrict__ d_idata,
-						const bool* __restrict d_mask,
-						T* __restrict__ d_odata,
-						unsigned int n) {
+///////////////////////////////////////////////////////
+// Returns true if Fourier pixel [idx] of a (w/2 + 1) x h half
+// plane lies in ring [ring], a ring being a q-value annulus or,
+// with angle analysis, one angular segment of that annulus.
+///////////////////////////////////////////////////////
+__device__ __forceinline__ bool pixelInRing(unsigned int idx,
+                                            unsigned int ring,
+                                            const float* __restrict__ d_q2,
+                                            float tol2,
+                                            int w, int h,
+                                            int angle_count) {
+
+	int half_w = w / 2 + 1;
+	int half_h = h / 2;
+
+	int x = idx % half_w;
+	int y = idx / half_w;
+
+	int x_shift = x;
+	int y_shift = (y + half_h) % h - half_h;
+
+	int q_idx = (angle_count > 0) ? ring / angle_count : ring;
+
+	float r2 = x_shift * x_shift + y_shift * y_shift;
+	float r2q2_ratio = r2 / d_q2[q_idx];
+
+	// Check if pixel is within the annular region for this q-value
+	if (!((1 <= r2q2_ratio) && (r2q2_ratio <= tol2)))
+		return false;
+
+	if (angle_count == 0)
+		return true;
+
+	// Calculate pixel angle (-π/2 to π/2), normalise to 0-1 range and find its segment
+	float angle = atan2(static_cast<double>(y_shift), static_cast<double>(x_shift));
+	float normalized_angle = (angle + M_PI/2) / M_PI;
+
+	int angle_idx = min((int)(normalized_angle * angle_count), angle_count - 1);
+
+	return angle_idx == static_cast<int>(ring % angle_count);
+}
 
-	T *sdata = SharedMemory<T>();
 
-	// perform first level of reduction,
-	// reading from global memory, writing to shared memory
-	unsigned int tid = threadIdx.x;
-	unsigned int gridSize = blockSize * gridDim.x;
-	unsigned int maskLength = (blockSize & 31);  // 31 = warpSize-1
-	maskLength = (maskLength > 0) ? (32 - maskLength) : maskLength;
-	const unsigned int mask = (0xffffffff) >> maskLength;
+///////////////////////////////////////////////////////
+// First pass of the ring index build, one block per ring
+// counts the pixels inside the ring.
+///////////////////////////////////////////////////////
+__global__ void kernelRingCount(int* __restrict__ d_counts,
+                                const float* __restrict__ d_q2,
+                                float tol2,
+                                int w, int h,
+                                int angle_count) {
 
-	T mySum = 0;
+	const unsigned int element_count = (w / 2 + 1) * h;
+	int count = 0;
 
-	// we reduce multiple elements per thread.  The number is determined by the
-	// number of active thread blocks (via gridDim).  More blocks will result
-	// in a larger gridSize and therefore fewer elements per thread
+	for (unsigned int base = 0; base < element_count; base += blockDim.x) {
+		unsigned int idx = base + threadIdx.x;
+		bool in_ring = (idx < element_count) && pixelInRing(idx, blockIdx.x, d_q2, tol2, w, h, angle_count);
 
-	if (nIsPow2) {
-		unsigned int i = blockIdx.x * blockSize * 2 + threadIdx.x;
-		gridSize = gridSize << 1;
+		count += __syncthreads_count(in_ring);
+	}
 
-		while (i < n) {
-			if (d_mask[i]) { mySum += d_idata[i]; }
+	if (threadIdx.x == 0) { d_counts[blockIdx.x] = count; }
+}
 
-			// ensure we don't read out of bounds -- this is optimized away for
-			// powerOf2 sized arrays
-			if ((i + blockSize) < n) {
-				if (d_mask[i + blockSize]) { mySum += d_idata[i + blockSize]; }
+
+///////////////////////////////////////////////////////
+// Second pass of the ring index build, one block per ring
+// writes the indices of the ring's pixels in ascending order
+// starting at d_offsets[ring]. Compaction is done with a
+// block-wide prefix sum built from warp ballots.
+///////////////////////////////////////////////////////
+template <unsigned int blockSize>
+__global__ void kernelRingFill(int* __restrict__ d_pixels,
+                               const int* __restrict__ d_offsets,
+                               const float* __restrict__ d_q2,
+                               float tol2,
+                               int w, int h,
+                               int angle_count) {
+
+	__shared__ int warp_offsets[(blockSize + 31) / 32];
+	__shared__ int chunk_total;
+
+	const unsigned int element_count = (w / 2 + 1) * h;
+	const unsigned int lane = threadIdx.x % warpSize;
+	const unsigned int warp = threadIdx.x / warpSize;
+
+	int out = d_offsets[blockIdx.x];
+
+	for (unsigned int base = 0; base < element_count; base += blockSize) {
+		unsigned int idx = base + threadIdx.x;
+		bool in_ring = (idx < element_count) && pixelInRing(idx, blockIdx.x, d_q2, tol2, w, h, angle_count);
+
+		unsigned int ballot = __ballot_sync(0xffffffff, in_ring);
+		int lane_offset = __popc(ballot & ((1u << lane) - 1));
+
+		if (lane == 0) { warp_offsets[warp] = __popc(ballot); }
+		__syncthreads();
+
+		// exclusive scan of the (few) warp totals
+		if (threadIdx.x == 0) {
+			int total = 0;
+			for (unsigned int i = 0; i < (blockSize + 31) / 32; i++) {
+				int tmp = warp_offsets[i];
+				warp_offsets[i] = total;
+				total += tmp;
 			}
-			i += gridSize;
+			chunk_total = total;
 		}
-	} else {
-	    unsigned int i = blockIdx.x * blockSize + threadIdx.x;
-	    while (i < n) {
-			if (d_mask[i]) { mySum += d_idata[i]; }
-			i += gridSize;
-	    }
+		__syncthreads();
+
+		if (in_ring) { d_pixels[out + warp_offsets[warp] + lane_offset] = idx; }
+
+		out += chunk_total;
+		__syncthreads();
 	}
+}
 
-	// Reduce within warp using shuffle or reduce_add if T==int & CUDA_ARCH ==
-	// SM 8.0
-	mySum = warpReduceSum<T>(mask, mySum);
 
-  // each thread puts its local sum into shared memory
-	if ((tid % warpSize) == 0) {
-		sdata[tid / warpSize] = mySum;
+///////////////////////////////////////////////////////
+// Batched azimuthal reduction, one block per (ring, tau, tile)
+// i.e. blockIdx.x = ring, blockIdx.y = tau, blockIdx.z = tile.
+// Each block sums the accumulator over the pixels listed for its
+// ring in the compact (CSR) ring index and writes the normalised
+// average to ISF[tile][ring][tau]. Rings only overlap when q-values
+// are closer than the mask tolerance, so each accumulator element
+// is generally read at most once and pixels outside every ring
+// are never read.
+///////////////////////////////////////////////////////
+template <unsigned int blockSize>
+__global__ void kernelRingReduce(const float* __restrict__ d_accum,
+                                 const int* __restrict__ d_ring_offsets,
+                                 const int* __restrict__ d_ring_pixels,
+                                 float* __restrict__ d_ISF,
+                                 unsigned int tile_size,
+                                 unsigned int frame_size,
+                                 float norm_factor) {
+
+	__shared__ float warp_sums[(blockSize + 31) / 32];
+
+	const unsigned int tid = threadIdx.x;
+	const unsigned int ring = blockIdx.x;
+	const unsigned int tau = blockIdx.y;
+	const unsigned int tile = blockIdx.z;
+
+	const int begin = d_ring_offsets[ring];
+	const int end = d_ring_offsets[ring + 1];
+
+	const float *d_tile = d_accum + static_cast<size_t>(tau) * frame_size + static_cast<size_t>(tile) * tile_size;
+
+	float mySum = 0;
+	for (int i = begin + tid; i < end; i += blockSize) {
+		mySum += d_tile[d_ring_pixels[i]];
 	}
 
-	__syncthreads();
+	mySum = warpReduceSum<float>(0xffffffff, mySum);
 
-	const unsigned int shmem_extent =
-			(blockSize / warpSize) > 0 ? (blockSize / warpSize) : 1;
-	const unsigned int ballot_result = __ballot_sync(mask, tid < shmem_extent);
-	if (tid < shmem_extent) {
-		mySum = sdata[tid];
-		// Reduce final warp using shuffle or reduce_add if T==int & CUDA_ARCH ==
-		// SM 8.0
-		mySum = warpReduceSum<T>(ballot_result, mySum);
+	// each warp puts its local sum into shared memory
+	if ((tid % warpSize) == 0) {
+		warp_sums[tid / warpSize] = mySum;
 	}
 
-	// write result for this block to global mem
-	if (tid == 0) { d_odata[blockIdx.x] = mySum; }
-}
+	__syncthreads();
 
+	if (tid < warpSize) {
+		mySum = (tid < (blockSize + 31) / 32) ? warp_sums[tid] : 0;
+		mySum = warpReduceSum<float>(0xffffffff, mySum);
+	}
 
-template <class T>
-void maskReduce(int size, int threads, int blocks, T *d_idata, bool *d_mask, T *d_odata) {
-	dim3 dimBlock(threads, 1, 1);
-	dim3 dimGrid(blocks, 1, 1);
-
-	// choose which of the optimized versions of reduction to launch
-	// For reduce kernel we require only blockSize/warpSize
-	// number of elements in shared memory
-	int smemSize = ((threads / 32) + 1) * sizeof(T);
-	if (isPow2(size)) {
-		switch (threads) {
-			case 512:
-				kernelMaskReduce<T, 512, true>
-				<<<dimGrid, dimBlock, smemSize>>>(d_idata, d_mask, d_odata, size);
-				break;
-			case 256:
-				kernelMaskReduce<T, 256, true>
-				<<<dimGrid, dimBlock, smemSize>>>(d_idata, d_mask, d_odata, size);
-				break;
-			case 128:
-				kernelMaskReduce<T, 128, true>
-				<<<dimGrid, dimBlock, smemSize>>>(d_idata, d_mask, d_odata, size);
-				break;
-			case 64:
-				kernelMaskReduce<T, 64, true>
-				<<<dimGrid, dimBlock, smemSize>>>(d_idata, d_mask, d_odata, size);
-				break;
-			case 32:
-				kernelMaskReduce<T, 32, true>
-				<<<dimGrid, dimBlock, smemSize>>>(d_idata, d_mask, d_odata, size);
-				break;
-			case 16:
-				kernelMaskReduce<T, 16, true>
-				<<<dimGrid, dimBlock, smemSize>>>(d_idata, d_mask, d_odata, size);
-				break;
-			case 8:
-				kernelMaskReduce<T, 8, true>
-				<<<dimGrid, dimBlock, smemSize>>>(d_idata, d_mask, d_odata, size);
-				break;
-			case 4:
-				kernelMaskReduce<T, 4, true>
-				<<<dimGrid, dimBlock, smemSize>>>(d_idata, d_mask, d_odata, size);
-				break;
-			case 2:
-				kernelMaskReduce<T, 2, true>
-				<<<dimGrid, dimBlock, smemSize>>>(d_idata, d_mask, d_odata, size);
-				break;
-			case 1:
-				kernelMaskReduce<T, 1, true>
-				<<<dimGrid, dimBlock, smemSize>>>(d_idata, d_mask, d_odata, size);
-				break;
-		}
-	} else {
-		switch (threads) {
-			case 512:
-				kernelMaskReduce<T, 512, false>
-				<<<dimGrid, dimBlock, smemSize>>>(d_idata, d_mask, d_odata, size);
-				break;
-			case 256:
-				kernelMaskReduce<T, 256, false>
-				<<<dimGrid, dimBlock, smemSize>>>(d_idata, d_mask, d_odata, size);
-				break;
-			case 128:
-				kernelMaskReduce<T, 128, false>
-				<<<dimGrid, dimBlock, smemSize>>>(d_idata, d_mask, d_odata, size);
-				break;
-			case 64:
-				kernelMaskReduce<T, 64, false>
-				<<<dimGrid, dimBlock, smemSize>>>(d_idata, d_mask, d_odata, size);
-				break;
-			case 32:
-				kernelMaskReduce<T, 32, false>
-				<<<dimGrid, dimBlock, smemSize>>>(d_idata, d_mask, d_odata, size);
-				break;
-			case 16:
-				kernelMaskReduce<T, 16, false>
-				<<<dimGrid, dimBlock, smemSize>>>(d_idata, d_mask, d_odata, size);
-				break;
-			case 8:
-				kernelMaskReduce<T, 8, false>
-				<<<dimGrid, dimBlock, smemSize>>>(d_idata, d_mask, d_odata, size);
-				break;
-			case 4:
-				kernelMaskReduce<T, 4, false>
-				<<<dimGrid, dimBlock, smemSize>>>(d_idata, d_mask, d_odata, size);
-				break;
-			case 2:
-				kernelMaskReduce<T, 2, false>
-				<<<dimGrid, dimBlock, smemSize>>>(d_idata, d_mask, d_odata, size);
-				break;
-			case 1:
-				kernelMaskReduce<T, 1, false>
-				<<<dimGrid, dimBlock, smemSize>>>(d_idata, d_mask, d_odata, size);
-				break;
-		}
+	if (tid == 0) {
+		// Multiply by 2 to account for FFT symmetry (only processing right half)
+		// and normalise by the ring's pixel count
+		float val = (end > begin) ? 2.0f * mySum / static_cast<float>(end - begin) * norm_factor : 0.0f;
+		d_ISF[(static_cast<size_t>(tile) * gridDim.x + ring) * gridDim.y + tau] = val;
 	}
 }
 
-template void maskReduce<float>(int size, int threads, int blocks, float *d_idata, bool *d_mask, float *d_odata);
-template void maskReduce<double>(int size, int threads, int blocks, double *d_idata, bool *d_mask, double *d_odata);
-
 #endif
\ No newline at end of file
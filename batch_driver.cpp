@@ -0,0 +1,366 @@
+////////////////////////////////////////////////////////////////////////////////
+//  Batch driver: runs every line of a manifest through runDDM in one process
+//  per rank. Work is cut into (video, episode, window range) units, which are
+//  handed out on demand, most expensive first, by rank 0. Rank 0 also gathers
+//  the ISF of every unit into one store file per manifest line.
+//
+//  Built with -DUSE_MPI (mpicxx) the units are shared between MPI ranks,
+//  otherwise, or with a single rank, they are run one after another.
+////////////////////////////////////////////////////////////////////////////////
+
+#include <stdio.h>
+#include <stdlib.h>
+
+#include <string>
+#include <vector>
+#include <fstream>
+#include <sstream>
+#include <algorithm>
+#include <mutex>
+
+#ifdef USE_MPI
+#include <mpi.h>
+#endif
+
+#include "debug.hpp"
+#include "constants.hpp"
+#include "azimuthal_average.cuh"
+#include "DDM.hpp"
+
+
+// One line of the manifest
+struct batch_entry_struct {
+    DDMparams params;
+    parameter_lists_struct lists;
+};
+
+
+// Windows [window_begin, window_end) of episode [episode] of entry [entry];
+// episode < 0 is the complete run of the entry
+struct batch_unit_struct {
+    int entry;
+    int episode;
+    int window_begin;
+    int window_end;
+    double cost;
+};
+
+
+///////////////////////////////////////////////////////
+// Splits a manifest line into arguments, double quotes
+// group arguments containing spaces
+///////////////////////////////////////////////////////
+std::vector<std::string> tokeniseLine(const std::string &line) {
+    std::vector<std::string> tokens;
+    std::string current;
+    bool in_quotes = false;
+    bool has_token = false;
+
+    for (char c : line) {
+        if (c == '"') {
+            in_quotes = !in_quotes;
+            has_token = true;
+        } else if (!in_quotes && (c == ' ' || c == '\t' || c == '\r')) {
+            if (has_token)
+                tokens.push_back(current);
+            current.clear();
+            has_token = false;
+        } else {
+            current += c;
+            has_token = true;
+        }
+    }
+
+    if (has_token)
+        tokens.push_back(current);
+
+    return tokens;
+}
+
+
+///////////////////////////////////////////////////////
+// Reads the manifest, every non-empty line not starting
+// with # is the argument list of one run
+///////////////////////////////////////////////////////
+std::vector<batch_entry_struct> readManifest(const std::string &manifest_file, const char *program_name) {
+    std::ifstream manifest(manifest_file);
+    conditionAssert(manifest.is_open(), "cannot open batch manifest.", true);
+
+    std::vector<batch_entry_struct> entries;
+    std::string line;
+
+    while (std::getline(manifest, line)) {
+        std::vector<std::string> tokens = tokeniseLine(line);
+        if (tokens.empty() || tokens[0][0] == '#')
+            continue;
+
+        std::vector<char *> entry_argv;
+        entry_argv.push_back(const_cast<char *>(program_name));
+        for (std::string &t : tokens) {
+            entry_argv.push_back(&t[0]);
+        }
+        entry_argv.push_back(nullptr);
+
+        batch_entry_struct entry;
+        bool parsed = parseArguments(static_cast<int>(tokens.size()) + 1, entry_argv.data(), entry.params, true);
+        conditionAssert(parsed, "manifest line requests help: " + line, true);
+        conditionAssert(entry.params.manifest_file.empty(), "manifest lines can not contain -R", true);
+
+        readParameterFiles(entry.params, entry.lists);
+        entries.push_back(entry);
+    }
+
+    conditionAssert(!entries.empty(), "batch manifest contains no runs.", true);
+
+    return entries;
+}
+
+
+///////////////////////////////////////////////////////
+// Cuts the entries into work units. Consecutive windows
+// of an episode are grouped until they cover BATCH_UNIT_FRAMES
+// frames so setup cost stays small next to the analysis.
+// Single-pass, sliding window and web-camera runs can not
+// be divided.
+///////////////////////////////////////////////////////
+std::vector<batch_unit_struct> buildUnits(const std::vector<batch_entry_struct> &entries) {
+    std::vector<batch_unit_struct> units;
+
+    for (int i = 0; i < static_cast<int>(entries.size()); i++) {
+        const DDMparams &p = entries[i].params;
+        const parameter_lists_struct &lists = entries[i].lists;
+
+        // difference work per frame, every scale covers main_scale^2 pixels (tile_overlap^2 times with overlap)
+        int main_scale = lists.scale.empty() ? 0 : lists.scale[0];
+        double frame_cost = static_cast<double>(main_scale) * main_scale * lists.scale.size() * lists.tau.size() *
+                            p.tile_overlap * p.tile_overlap;
+
+        auto windowFrames = [&](int window_size, int w) {
+            return std::min(window_size, p.frame_count - w * window_size);
+        };
+
+        if (p.single_pass || p.use_webcam || p.window_hop > 0) {
+            double frames = 0;
+            for (int window_size : lists.episode) {
+                for (int w = 0; window_size > 0 && w * window_size < p.frame_count; w++)
+                    frames += windowFrames(window_size, w);
+            }
+            units.push_back({i, -1, 0, 0, frames * frame_cost});
+            continue;
+        }
+
+        for (int e = 0; e < static_cast<int>(lists.episode.size()); e++) {
+            int window_size = lists.episode[e];
+            int w = 0;
+
+            while (window_size > 0 && w * window_size < p.frame_count) {
+                batch_unit_struct unit = {i, e, w, w, 0.0};
+                int frames = 0;
+
+                while (unit.window_end * window_size < p.frame_count && frames < BATCH_UNIT_FRAMES) {
+                    frames += windowFrames(window_size, unit.window_end);
+                    unit.window_end++;
+                }
+
+                unit.cost = frames * frame_cost;
+                units.push_back(unit);
+                w = unit.window_end;
+            }
+        }
+    }
+
+    // Longest first, so the last units handed out are the short ones
+    std::stable_sort(units.begin(), units.end(), [](const batch_unit_struct &a, const batch_unit_struct &b) {
+        return a.cost > b.cost;
+    });
+
+    return units;
+}
+
+
+///////////////////////////////////////////////////////
+// Runs one unit and returns its ISF as sections of the
+// store, each headed by the name the per-tile file of
+// the non-batch program would have had.
+///////////////////////////////////////////////////////
+std::string runUnit(batch_entry_struct &entry, const batch_unit_struct &unit) {
+    std::ostringstream out;
+    std::mutex out_mtx; // one writer thread per GPU
+
+    DDMparams &p = entry.params;
+    parameter_lists_struct &lists = entry.lists;
+
+    ISF_sink_function sink = [&](const ISF_block_struct &block) {
+        std::lock_guard<std::mutex> lock(out_mtx);
+
+        std::string prefix = block.file_out.substr(p.file_out.size()); // rolling purge suffix
+        int main_scale = block.scale_arr[0];
+
+        for (int s = 0; s < block.scale_count; s++) {
+            int scale = block.scale_arr[s];
+            int tile_count = tileCount(scale, main_scale, block.tile_overlap);
+
+            for (int tile_idx = 0; tile_idx < tile_count; tile_idx++) {
+                out << "# " << prefix << "episode" << block.window_size << "-" << block.window_index
+                    << "_scale" << scale << "-" << tile_idx << " frames " << block.frames_analysed << "\n";
+
+                const float *ISF = block.ISF + block.ISF_offsets[s] + static_cast<size_t>(tile_idx) * block.ring_count * block.tau_count;
+                writeIqtToStream(out, ISF, lists.lambda.data(), lists.lambda.size(), block.tau_arr, block.tau_count,
+                                 block.fps, p.enable_angle_analysis, p.angle_count);
+            }
+        }
+    };
+
+    if (unit.episode < 0) {
+        runFromParams(p, lists, -1, 0, 0, sink, NULL, NULL);
+    } else {
+        runFromParams(p, lists, unit.episode, unit.window_begin, unit.window_end, sink, NULL, NULL);
+    }
+
+    return out.str();
+}
+
+
+// Consolidated ISF store of every entry, opened (and truncated) by the writing rank only
+struct batch_store_struct {
+    std::vector<std::ofstream> files;
+};
+
+
+void openStores(batch_store_struct &store, const std::vector<batch_entry_struct> &entries) {
+    store.files.resize(entries.size());
+
+    for (size_t i = 0; i < entries.size(); i++) {
+        std::string filename = entries[i].params.file_out + "ISF_store.txt";
+        store.files[i].open(filename, std::ios::trunc);
+        conditionAssert(store.files[i].is_open(), "unable to open ISF store " + filename, true);
+    }
+}
+
+
+void appendToStore(batch_store_struct &store, const batch_unit_struct &unit, const std::string &data) {
+    store.files[unit.entry] << data;
+    store.files[unit.entry].flush();
+}
+
+
+#ifdef USE_MPI
+
+int const TAG_RESULT = 1;   // worker -> master, ISF of the last unit (empty on first request)
+int const TAG_UNIT   = 2;   // master -> worker, next unit index or -1 when done
+
+///////////////////////////////////////////////////////
+// Rank 0: hands out units on request and writes the
+// results it gets back to the store
+///////////////////////////////////////////////////////
+void batchMaster(const std::vector<batch_unit_struct> &units, batch_store_struct &store, int rank_count) {
+    std::vector<int> assigned(rank_count, -1);
+    int next_unit = 0;
+    int active_workers = rank_count - 1;
+    std::string data;
+
+    while (active_workers > 0) {
+        MPI_Status status;
+        MPI_Probe(MPI_ANY_SOURCE, TAG_RESULT, MPI_COMM_WORLD, &status);
+
+        int byte_count = 0;
+        MPI_Get_count(&status, MPI_CHAR, &byte_count);
+        data.resize(byte_count);
+
+        int worker = status.MPI_SOURCE;
+        MPI_Recv(&data[0], byte_count, MPI_CHAR, worker, TAG_RESULT, MPI_COMM_WORLD, MPI_STATUS_IGNORE);
+
+        if (assigned[worker] >= 0) {
+            appendToStore(store, units[assigned[worker]], data);
+            verbose("[Batch] unit %d done on rank %d\n", assigned[worker], worker);
+        }
+
+        int unit_idx = (next_unit < static_cast<int>(units.size())) ? next_unit++ : -1;
+        assigned[worker] = unit_idx;
+        MPI_Send(&unit_idx, 1, MPI_INT, worker, TAG_UNIT, MPI_COMM_WORLD);
+
+        if (unit_idx < 0)
+            active_workers--;
+    }
+}
+
+
+void batchWorker(std::vector<batch_entry_struct> &entries, const std::vector<batch_unit_struct> &units) {
+    std::string data;
+
+    for (;;) {
+        MPI_Send(data.data(), static_cast<int>(data.size()), MPI_CHAR, 0, TAG_RESULT, MPI_COMM_WORLD);
+
+        int unit_idx;
+        MPI_Recv(&unit_idx, 1, MPI_INT, 0, TAG_UNIT, MPI_COMM_WORLD, MPI_STATUS_IGNORE);
+
+        if (unit_idx < 0)
+            break;
+
+        data = runUnit(entries[units[unit_idx].entry], units[unit_idx]);
+    }
+}
+
+#endif
+
+
+////////////////////////////////////////////////////////////////////////////////
+//  Batch mode entry point (-R). Every rank reads the manifest and builds the
+//  same unit list, so only unit indices and results travel between ranks.
+////////////////////////////////////////////////////////////////////////////////
+int runBatch(DDMparams &params, int *argc, char ***argv) {
+    int rank = 0;
+    int rank_count = 1;
+
+#ifdef USE_MPI
+    MPI_Init(argc, argv);
+    MPI_Comm_rank(MPI_COMM_WORLD, &rank);
+    MPI_Comm_size(MPI_COMM_WORLD, &rank_count);
+
+    // One GPU per analysing rank: ranks sharing a node are given one device each. The master
+    // (rank 0, the first rank of its node) analyses nothing, so its node's workers start at device 0
+    MPI_Comm node_comm;
+    int local_rank;
+    MPI_Comm_split_type(MPI_COMM_WORLD, MPI_COMM_TYPE_SHARED, rank, MPI_INFO_NULL, &node_comm);
+    MPI_Comm_rank(node_comm, &local_rank);
+
+    int master_node = (rank == 0);
+    MPI_Bcast(&master_node, 1, MPI_INT, 0, node_comm);
+    MPI_Comm_free(&node_comm);
+
+    if (rank_count > 1 && rank != 0 && getenv("CUDA_VISIBLE_DEVICES") == nullptr) {
+        int device = master_node ? local_rank - 1 : local_rank;
+        setenv("CUDA_VISIBLE_DEVICES", std::to_string(device).c_str(), 1);
+    }
+#endif
+
+    std::vector<batch_entry_struct> entries = readManifest(params.manifest_file, (*argv)[0]);
+    std::vector<batch_unit_struct> units = buildUnits(entries);
+
+    batch_store_struct store;
+    if (rank == 0) {
+        openStores(store, entries);
+        printf("[Batch] %zu runs, %zu work units, %d rank(s)\n", entries.size(), units.size(), rank_count);
+    }
+
+    if (rank_count == 1) {
+        for (size_t u = 0; u < units.size(); u++) {
+            appendToStore(store, units[u], runUnit(entries[units[u].entry], units[u]));
+            verbose("[Batch] unit %zu of %zu done\n", u + 1, units.size());
+        }
+    }
+#ifdef USE_MPI
+    else if (rank == 0) {
+        batchMaster(units, store, rank_count);
+    } else {
+        batchWorker(entries, units);
+    }
+
+    MPI_Finalize();
+#endif
+
+    if (rank == 0)
+        printf("[Batch] ISF stores written\n");
+
+    return 0;
+}
@@ -0,0 +1,212 @@
+////////////////////////////////////////////////////////////////////////////////
+//  Benchmark suite (-J): sweeps the synthetic benchmark input over scale sets,
+//  tau counts, chunk sizes, angle analysis and single / dual stream, times every
+//  pipeline stage with CUDA events and writes the achieved bandwidth and
+//  arithmetic rate of each stage against the device peaks as JSON.
+////////////////////////////////////////////////////////////////////////////////
+
+#include <stdio.h>
+#include <stdlib.h>
+
+#include <string>
+#include <vector>
+#include <fstream>
+#include <algorithm>
+
+#include "debug.hpp"
+#include "constants.hpp"
+#include "DDM.hpp"
+#include "instrumentation.hpp"
+
+
+// Theoretical peaks of the current device
+struct device_peak_struct {
+    std::string name;
+    double bandwidth;	// bytes / s
+    double flops;		// single precision FLOP / s
+};
+
+
+// FP32 cores per multiprocessor by compute capability
+static int coresPerSM(int major, int minor) {
+    switch (major) {
+        case 3:  return 192;
+        case 5:  return 128;
+        case 6:  return (minor == 0) ? 64 : 128;
+        case 7:  return 64;
+        case 8:  return (minor == 0) ? 64 : 128;
+        default: return 128;
+    }
+}
+
+
+static device_peak_struct devicePeaks() {
+    int device = 0;
+    gpuErrorCheck(cudaGetDevice(&device));
+
+    cudaDeviceProp prop;
+    gpuErrorCheck(cudaGetDeviceProperties(&prop, device));
+
+    int clock_khz = 0, mem_clock_khz = 0, bus_width = 0, sm_count = 0;
+    gpuErrorCheck(cudaDeviceGetAttribute(&clock_khz, cudaDevAttrClockRate, device));
+    gpuErrorCheck(cudaDeviceGetAttribute(&mem_clock_khz, cudaDevAttrMemoryClockRate, device));
+    gpuErrorCheck(cudaDeviceGetAttribute(&bus_width, cudaDevAttrGlobalMemoryBusWidth, device));
+    gpuErrorCheck(cudaDeviceGetAttribute(&sm_count, cudaDevAttrMultiProcessorCount, device));
+
+    device_peak_struct peak;
+    peak.name      = prop.name;
+    peak.bandwidth = 2.0 * mem_clock_khz * 1e3 * (bus_width / 8.0);                              // double data rate
+    peak.flops     = 2.0 * sm_count * coresPerSM(prop.major, prop.minor) * (clock_khz * 1e3); // one FMA per core and cycle
+    return peak;
+}
+
+
+// One point of the sweep
+struct benchmark_case_struct {
+    int  scale_count;
+    int  tau_count;
+    int  chunk_length;
+    bool angle_analysis;
+    bool multistream;
+    benchmark_report_struct report;
+};
+
+
+static void writeCase(std::ofstream &out, const benchmark_case_struct &c, const parameter_lists_struct &lists,
+                      const device_peak_struct &peak, bool last) {
+
+    const benchmark_report_struct &r = c.report;
+
+    out << "    {\n";
+    out << "      \"scales\": [";
+    for (int s = 0; s < c.scale_count; s++)
+        out << (s ? ", " : "") << lists.scale[s];
+    out << "],\n";
+    out << "      \"tau_count\": " << c.tau_count << ",\n";
+    out << "      \"chunk_length\": " << c.chunk_length << ",\n";
+    out << "      \"angle_analysis\": " << (c.angle_analysis ? "true" : "false") << ",\n";
+    out << "      \"multistream\": " << (c.multistream ? "true" : "false") << ",\n";
+    out << "      \"frames\": " << r.frames << ",\n";
+    out << "      \"total_seconds\": " << r.total_seconds << ",\n";
+    out << "      \"frames_per_second\": " << (r.total_seconds > 0.0 ? r.frames / r.total_seconds : 0.0) << ",\n";
+    out << "      \"stages\": {\n";
+
+    for (int stage = 0; stage < STAGE_COUNT; stage++) {
+        double seconds   = r.stage_ms[stage] / 1e3;
+        double bandwidth = (seconds > 0.0) ? r.stage_bytes[stage] / seconds : 0.0;
+        double flops     = (seconds > 0.0) ? r.stage_flops[stage] / seconds : 0.0;
+        double intensity = (r.stage_bytes[stage] > 0.0) ? r.stage_flops[stage] / r.stage_bytes[stage] : 0.0;
+
+        out << "        \"" << stageName(stage) << "\": {"
+            << "\"ms\": " << r.stage_ms[stage]
+            << ", \"bytes\": " << r.stage_bytes[stage]
+            << ", \"flops\": " << r.stage_flops[stage]
+            << ", \"GBps\": " << bandwidth / 1e9
+            << ", \"GFLOPps\": " << flops / 1e9
+            << ", \"bandwidth_fraction\": " << bandwidth / peak.bandwidth
+            << ", \"flops_fraction\": " << flops / peak.flops
+            << ", \"arithmetic_intensity\": " << intensity
+            << "}" << (stage + 1 < STAGE_COUNT ? ",\n" : "\n");
+    }
+
+    out << "      }\n";
+    out << "    }" << (last ? "\n" : ",\n");
+}
+
+
+///////////////////////////////////////////////////////
+// Runs the sweep on the synthetic benchmark input and
+// writes the report to params.benchmark_suite_file.
+// Scale sets and tau counts are prefixes of the lists
+// read from file, chunk sizes are half, once and twice
+// the -C value.
+///////////////////////////////////////////////////////
+int runBenchmarkSuite(DDMparams &params, parameter_lists_struct &lists) {
+    conditionAssert(params.device_count == 1 && !params.validate_precision && params.live_chunks == 0,
+                    "the benchmark suite runs on one GPU", true);
+    conditionAssert(!lists.scale.empty() && !lists.tau.empty(), "the benchmark suite needs scale and tau lists", true);
+
+    device_peak_struct peak = devicePeaks();
+
+    std::vector<int> tau_counts;
+    for (int divisor : {4, 2, 1}) {
+        int count = std::max(1, static_cast<int>(lists.tau.size()) / divisor);
+        if (std::find(tau_counts.begin(), tau_counts.end(), count) == tau_counts.end())
+            tau_counts.push_back(count);
+    }
+
+    int base_chunk = (params.chunk_length > 0) ? params.chunk_length : 30;
+    std::vector<int> chunk_lengths = {std::max(1, base_chunk / 2), base_chunk, 2 * base_chunk};
+
+    std::vector<benchmark_case_struct> cases;
+
+    for (int scale_count = 1; scale_count <= static_cast<int>(lists.scale.size()); scale_count++) {
+        for (int tau_count : tau_counts) {
+            for (int chunk_length : chunk_lengths) {
+                if (lists.tau[tau_count - 1] > chunk_length) // every tau must fit in a chunk
+                    continue;
+
+                for (bool angle_analysis : {false, true}) {
+                    for (bool multistream : {false, true}) {
+                        benchmark_case_struct c = {};
+                        c.scale_count    = scale_count;
+                        c.tau_count      = tau_count;
+                        c.chunk_length   = chunk_length;
+                        c.angle_analysis = angle_analysis;
+                        c.multistream    = multistream;
+                        cases.push_back(c);
+                    }
+                }
+            }
+        }
+    }
+
+    conditionAssert(!cases.empty(), "no benchmark case fits the chunk sizes, lower the tau values or raise -C", true);
+
+    printf("[Benchmark suite] %zu cases on %s (peak %.1f GB/s, %.1f GFLOP/s)\n",
+           cases.size(), peak.name.c_str(), peak.bandwidth / 1e9, peak.flops / 1e9);
+    printf("  scales  taus  chunk  angle  streams      fps");
+    for (int stage = 0; stage < STAGE_COUNT; stage++)
+        printf("  %10s", stageName(stage));
+    printf("   (ms)\n");
+
+    for (benchmark_case_struct &c : cases) {
+        DDMparams p = params;
+        p.chunk_length          = c.chunk_length;
+        p.enable_angle_analysis = c.angle_analysis;
+        p.multi_stream          = c.multistream;
+        p.benchmark_mode        = true;
+
+        parameter_lists_struct l = lists;
+        l.scale.resize(c.scale_count);
+        l.tau.resize(c.tau_count);
+
+        runFromParams(p, l, -1, 0, 0, ISF_sink_function(), &c.report, NULL);
+
+        const benchmark_report_struct &r = c.report;
+        printf("  %6d  %4d  %5d  %5s  %7d  %7.1f", c.scale_count, c.tau_count, c.chunk_length,
+               c.angle_analysis ? "on" : "off", c.multistream ? 2 : 1,
+               r.total_seconds > 0.0 ? r.frames / r.total_seconds : 0.0);
+        for (int stage = 0; stage < STAGE_COUNT; stage++)
+            printf("  %10.2f", r.stage_ms[stage]);
+        printf("\n");
+    }
+
+    std::ofstream out(params.benchmark_suite_file);
+    conditionAssert(out.is_open(), "unable to open " + params.benchmark_suite_file, true);
+
+    out << "{\n";
+    out << "  \"device\": {\"name\": \"" << peak.name << "\""
+        << ", \"peak_GBps\": " << peak.bandwidth / 1e9
+        << ", \"peak_GFLOPps\": " << peak.flops / 1e9
+        << ", \"ridge_point\": " << peak.flops / peak.bandwidth << "},\n";
+    out << "  \"frames\": " << params.frame_count << ",\n";
+    out << "  \"cases\": [\n";
+    for (size_t i = 0; i < cases.size(); i++)
+        writeCase(out, cases[i], lists, peak, i + 1 == cases.size());
+    out << "  ]\n";
+    out << "}\n";
+
+    printf("[Benchmark suite] report written to %s\n", params.benchmark_suite_file.c_str());
+    return 0;
+}
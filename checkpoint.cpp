@@ -0,0 +1,195 @@
+////////////////////////////////////////////////////////////////////////////////
+//  Checkpoint files: the accumulators of a run and the cursors needed to continue
+//  it, written periodically from a pinned staging buffer by a background thread.
+//  Layout (little endian, as written by the host):
+//      char[8]  magic "MDDMCKP1"
+//      uint64   parameter fingerprint
+//      int32    unit, next_frame, episode_count
+//      uint64   accumulator bytes, frame hierarchy bytes
+//      int32    frames_accumulated, chunks_accumulated, dump_count, bank per episode
+//      bytes    accumulators, frame hierarchies
+////////////////////////////////////////////////////////////////////////////////
+
+#include <stdio.h>
+#include <stdint.h>
+#include <string.h>
+
+#include <string>
+#include <vector>
+#include <fstream>
+
+#include "debug.hpp"
+#include "checkpoint.hpp"
+
+static const char checkpoint_magic[8] = {'M', 'D', 'D', 'M', 'C', 'K', 'P', '1'};
+
+
+uint64_t checkpointFingerprint(const std::string &description) {
+	uint64_t hash = 14695981039346656037ULL;
+	for (unsigned char c : description) {
+		hash ^= c;
+		hash *= 1099511628211ULL;
+	}
+	return hash;
+}
+
+
+static void writeCheckpointFile(checkpoint_writer_struct &ckpt) {
+	const checkpoint_state_struct &state = ckpt.state;
+	std::string tmp_path = ckpt.path + ".tmp";
+
+	std::ofstream out(tmp_path, std::ios::binary | std::ios::trunc);
+	conditionAssert(out.is_open(), "unable to open " + tmp_path, true);
+
+	int32_t cursors[3] = {state.unit, state.next_frame, static_cast<int32_t>(state.bank.size())};
+	uint64_t sizes[2] = {ckpt.accum_bytes, ckpt.multitau_bytes};
+
+	out.write(checkpoint_magic, sizeof(checkpoint_magic));
+	out.write(reinterpret_cast<const char *>(&ckpt.fingerprint), sizeof(uint64_t));
+	out.write(reinterpret_cast<const char *>(cursors), sizeof(cursors));
+	out.write(reinterpret_cast<const char *>(sizes), sizeof(sizes));
+
+	for (size_t e = 0; e < state.bank.size(); e++) {
+		int32_t episode[4] = {state.frames_accumulated[e], state.chunks_accumulated[e], state.dump_count[e], state.bank[e]};
+		out.write(reinterpret_cast<const char *>(episode), sizeof(episode));
+	}
+
+	out.write(reinterpret_cast<const char *>(ckpt.h_staging), ckpt.accum_bytes + ckpt.multitau_bytes);
+	out.close();
+	conditionAssert(!out.fail(), "unable to write " + tmp_path, true);
+
+	conditionAssert(rename(tmp_path.c_str(), ckpt.path.c_str()) == 0, "unable to replace " + ckpt.path, true);
+}
+
+
+///////////////////////////////////////////////////////
+// Allocates the staging buffer and starts the writer
+///////////////////////////////////////////////////////
+void openCheckpointWriter(checkpoint_writer_struct &ckpt, std::string path, uint64_t fingerprint,
+                          size_t accum_bytes, size_t multitau_bytes) {
+
+	ckpt.path           = path;
+	ckpt.fingerprint    = fingerprint;
+	ckpt.accum_bytes    = accum_bytes;
+	ckpt.multitau_bytes = multitau_bytes;
+	ckpt.pending        = false;
+	ckpt.stop           = false;
+	ckpt.written        = 0;
+
+	gpuErrorCheck(cudaHostAlloc((void **) &ckpt.h_staging, accum_bytes + multitau_bytes, cudaHostAllocDefault));
+	gpuErrorCheck(cudaEventCreateWithFlags(&ckpt.copied, cudaEventDisableTiming));
+
+	ckpt.thread = std::thread([&ckpt] {
+		while (true) {
+			{
+				std::unique_lock<std::mutex> lock(ckpt.mtx);
+				ckpt.cv.wait(lock, [&] { return ckpt.stop || ckpt.pending; });
+
+				if (!ckpt.pending)
+					return; // stopped, nothing outstanding
+			}
+
+			gpuErrorCheck(cudaEventSynchronize(ckpt.copied));
+			ckpt.before_write();
+			writeCheckpointFile(ckpt);
+
+			verbose("[Checkpoint] unit %d frame %d written to %s\n", ckpt.state.unit, ckpt.state.next_frame, ckpt.path.c_str());
+
+			{
+				std::lock_guard<std::mutex> lock(ckpt.mtx);
+				ckpt.pending = false;
+				ckpt.written++;
+			}
+			ckpt.cv.notify_all();
+		}
+	});
+
+	verbose("Checkpoints of %.2f GB written to %s\n", (accum_bytes + multitau_bytes) / (float) 1073741824, path.c_str());
+}
+
+
+void waitCheckpointWriter(checkpoint_writer_struct &ckpt) {
+	std::unique_lock<std::mutex> lock(ckpt.mtx);
+	ckpt.cv.wait(lock, [&] { return !ckpt.pending; });
+}
+
+
+void queueCheckpoint(checkpoint_writer_struct &ckpt, const checkpoint_state_struct &state,
+                     const std::function<void()> &before_write) {
+	{
+		std::lock_guard<std::mutex> lock(ckpt.mtx);
+		ckpt.state        = state;
+		ckpt.before_write = before_write;
+		ckpt.pending      = true;
+	}
+	ckpt.cv.notify_all();
+}
+
+
+void closeCheckpointWriter(checkpoint_writer_struct &ckpt) {
+	{
+		std::lock_guard<std::mutex> lock(ckpt.mtx);
+		ckpt.stop = true;
+	}
+	ckpt.cv.notify_all();
+	ckpt.thread.join();
+
+	cudaFreeHost(ckpt.h_staging);
+	cudaEventDestroy(ckpt.copied);
+}
+
+
+void removeCheckpoint(std::string path) {
+	if (remove(path.c_str()) == 0)
+		verbose("[Checkpoint] run complete, %s removed\n", path.c_str());
+}
+
+
+///////////////////////////////////////////////////////
+// Reads a checkpoint written by writeCheckpointFile
+///////////////////////////////////////////////////////
+bool readCheckpoint(std::string path, uint64_t fingerprint, int episode_count,
+                    size_t accum_bytes, size_t multitau_bytes,
+                    checkpoint_state_struct &state, unsigned char *h_staging) {
+
+	std::ifstream in(path, std::ios::binary);
+	if (!in.is_open())
+		return false;
+
+	char magic[8];
+	uint64_t file_fingerprint = 0;
+	int32_t cursors[3] = {};
+	uint64_t sizes[2] = {};
+
+	in.read(magic, sizeof(magic));
+	in.read(reinterpret_cast<char *>(&file_fingerprint), sizeof(uint64_t));
+	in.read(reinterpret_cast<char *>(cursors), sizeof(cursors));
+	in.read(reinterpret_cast<char *>(sizes), sizeof(sizes));
+
+	conditionAssert(!in.fail() && memcmp(magic, checkpoint_magic, sizeof(magic)) == 0, path + " is not a checkpoint file", true);
+	conditionAssert(file_fingerprint == fingerprint, path + " was written by a run with other parameters", true);
+	conditionAssert(cursors[2] == episode_count && sizes[0] == accum_bytes && sizes[1] == multitau_bytes,
+	                path + " does not match the accumulator layout of this run", true);
+
+	state.unit       = cursors[0];
+	state.next_frame = cursors[1];
+	state.frames_accumulated.resize(episode_count);
+	state.chunks_accumulated.resize(episode_count);
+	state.dump_count.resize(episode_count);
+	state.bank.resize(episode_count);
+
+	for (int e = 0; e < episode_count; e++) {
+		int32_t episode[4];
+		in.read(reinterpret_cast<char *>(episode), sizeof(episode));
+
+		state.frames_accumulated[e] = episode[0];
+		state.chunks_accumulated[e] = episode[1];
+		state.dump_count[e]         = episode[2];
+		state.bank[e]               = episode[3];
+	}
+
+	in.read(reinterpret_cast<char *>(h_staging), accum_bytes + multitau_bytes);
+	conditionAssert(!in.fail(), path + " is truncated", true);
+
+	return true;
+}
@@ -0,0 +1,78 @@
+#include <stdint.h>
+#include <string>
+#include <vector>
+#include <thread>
+#include <mutex>
+#include <condition_variable>
+#include <functional>
+#include <cuda_runtime.h>
+
+#ifndef _CHECKPOINT_H_
+#define _CHECKPOINT_H_
+
+///////////////////////////////////////////////////////
+// Checkpoint of one GPU's run (-k / -r). The file holds a
+// header with a fingerprint of the run parameters, the
+// cursors below, then the raw device accumulators and,
+// in multi-tau mode, the frame hierarchies. The device
+// data reaches the file through a pinned staging buffer:
+// the D2H copy is queued on a stream and a writer thread
+// waits for it and writes the file (tmp file + rename)
+// while the analysis continues.
+///////////////////////////////////////////////////////
+struct checkpoint_state_struct {
+	int unit;							// index into the device's window list (0 in single-pass mode)
+	int next_frame;						// first frame of the unit still to stream, -1 for the start of the unit
+	std::vector<int> frames_accumulated;	// per episode
+	std::vector<int> chunks_accumulated;
+	std::vector<int> dump_count;
+	std::vector<int> bank;
+};
+
+
+struct checkpoint_writer_struct {
+	std::string path;
+	uint64_t fingerprint;
+	size_t accum_bytes;
+	size_t multitau_bytes;
+
+	unsigned char *h_staging;			// pinned, accumulators followed by the frame hierarchies
+	cudaEvent_t copied;					// staging filled
+
+	checkpoint_state_struct state;
+	std::function<void()> before_write;	// waits for the ISF output the checkpoint depends on
+	bool pending;						// a checkpoint is queued or being written
+	bool stop;
+	int written;
+
+	std::thread thread;
+	std::mutex mtx;
+	std::condition_variable cv;
+};
+
+// FNV-1a hash of a description of everything the accumulator contents depend on
+uint64_t checkpointFingerprint(const std::string &description);
+
+void openCheckpointWriter(checkpoint_writer_struct &ckpt, std::string path, uint64_t fingerprint,
+                          size_t accum_bytes, size_t multitau_bytes);
+
+// Blocks until the previous checkpoint has been written, the staging buffer may then be refilled
+void waitCheckpointWriter(checkpoint_writer_struct &ckpt);
+
+// Writes [state] and the staging buffer once ckpt.copied has fired and before_write has returned
+void queueCheckpoint(checkpoint_writer_struct &ckpt, const checkpoint_state_struct &state,
+                     const std::function<void()> &before_write);
+
+// Writes the outstanding checkpoint
+void closeCheckpointWriter(checkpoint_writer_struct &ckpt);
+
+// Removes the checkpoint of a completed run, which must not be resumed again
+void removeCheckpoint(std::string path);
+
+// Reads the checkpoint at [path] into [state] and h_staging, false if there is none.
+// Aborts if the checkpoint belongs to a run with other parameters
+bool readCheckpoint(std::string path, uint64_t fingerprint, int episode_count,
+                    size_t accum_bytes, size_t multitau_bytes,
+                    checkpoint_state_struct &state, unsigned char *h_staging);
+
+#endif
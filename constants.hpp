@@ -12,6 +12,64 @@ int const BLOCKSIZE_X = 16;
 int const BLOCKSIZE_Y = 16;
 int const BLOCKSIZE = 256;
 
+// Number of tau values each thread of the difference kernel accumulates in
+// registers, the tau list is covered by ceil(tau_count / TAU_BATCH) blocks in y
+int const TAU_BATCH = 8;
+
+// Threads per block of the azimuthal ring reduction
+int const RING_BLOCKSIZE = 128;
+
+// Number of pinned host ISF buffers the analysis stream can fill ahead
+// of the writer thread before it has to wait for a buffer to be written out
+int const ISF_STAGING_SLOTS = 4;
+
+// Half precision FFT mode: samples are multiplied by HALF_FFT_SCALE / main_scale^2
+// before the FFT, which keeps even the DC coefficient of a saturated 8-bit tile
+// (at most 255 * HALF_FFT_SCALE) below the largest half value (65504). Up to a main
+// scale of 1024 a sample of 1 also stays a normal half (128 / 1024^2 ~ 1.2e-4, the
+// smallest normal is 6.1e-5), from 2048 on the smallest samples are subnormal and lose precision
+float const HALF_FFT_SCALE = 128.0f;
+
+// Precision validation skips ISF values smaller than this fraction of the
+// largest value of their window (relative error meaningless near zero)
+float const PRECISION_VALIDATION_FLOOR = 1e-4f;
+
+// Wiener-Khinchin engine: complex elements of the zero padded time series
+// transformed per batch, the pixels per batch are this divided by the FFT length
+int const WK_BATCH_ELEMENTS = 1 << 24;
+
+// GPU model fit (-L): parameters of I = A (1 - exp(-(Gamma tau)^beta)) + B, thread
+// block size, iteration limit, initial Levenberg-Marquardt damping, damping increases
+// tried per iteration, and relative cost decrease below which the fit has converged
+int const FIT_PARAM_COUNT = 4;
+int const FIT_BLOCKSIZE = 128;
+int const FIT_MAX_ITERATIONS = 100;
+float const FIT_INITIAL_DAMPING = 1e-3f;
+int const FIT_MAX_DAMPING_STEPS = 10;
+float const FIT_TOLERANCE = 1e-6f;
+
+// Live mode (-l): frame count streamed when no frame count is given (until interrupted),
+// and the window total is re-summed from its sub-accumulators every LIVE_REBUILD_CYCLES
+// passes through the ring, which bounds the rounding drift of adding and subtracting
+int const LIVE_UNBOUNDED_FRAMES = 1 << 30;
+int const LIVE_REBUILD_CYCLES = 16;
+
+// Memory planner: fraction of the free device memory the chunk and fixed buffers may take,
+// largest automatic chunk (-C 0) and chunk size the cuFFT work area is estimated at
+float const AUTO_CHUNK_MEMORY_FRACTION = 0.8f;
+int const AUTO_CHUNK_MAX_FRAMES = 1000;
+int const AUTO_CHUNK_PROBE_FRAMES = 16;
+
+// Map mode heatmaps (-u): tiles are drawn as square cells, at least this many pixels per image side
+int const MAP_IMAGE_MIN_SIZE = 256;
+
+// Metrics export (-X): seconds between two snapshots of the counters written to file
+float const METRICS_EXPORT_INTERVAL = 5.0f;
+
+// Batch mode groups consecutive windows of an episode into one work unit
+// until the unit covers at least this many frames
+int const BATCH_UNIT_FRAMES = 2000;
+
 // If we want to scale the pixel-values from input video then we create a look-up table
 //__constant__ float dk_uchar_float_lookup[256];
 
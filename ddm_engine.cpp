@@ -0,0 +1,168 @@
+////////////////////////////////////////////////////////////////////////////////
+//  DDM engine: the command line analysis as a reusable object, for callers that
+//  analyse many videos or frame stacks in one process (Python through the C
+//  interface below). Arguments are parsed and the parameter files read once,
+//  every run goes through runFromParams with the engine's cache, so buffers,
+//  plans and ring indices of the previous run of the same shape are reused.
+////////////////////////////////////////////////////////////////////////////////
+
+#include <stdio.h>
+#include <stdlib.h>
+
+#include <string>
+#include <memory>
+#include <sstream>
+
+#include "debug.hpp"
+#include "DDM.hpp"
+#include "isf_store.hpp"
+#include "instrumentation.hpp"
+#include "ddm_engine.hpp"
+
+
+DDMEngine::DDMEngine(int argc, char **argv) {
+	bool parsed = parseArguments(argc, argv, params, false);
+	conditionAssert(parsed, "engine arguments request help", true);
+	conditionAssert(params.manifest_file.empty() && params.benchmark_suite_file.empty(),
+	                "engines can not run batch manifests (-R) or the benchmark suite (-J)", true);
+	conditionAssert(params.device_count == 1 && params.live_chunks == 0 && !params.use_webcam,
+	                "engines analyse files or frames on one GPU", true);
+	conditionAssert(!params.map_output, "engines return the ISF tensors, map mode (-p / -u) writes files", true);
+
+	// every run is returned as the in-memory binary store
+	params.binary_output = true;
+
+	readParameterFiles(params, lists);
+	cache = createEngineCache(0);
+
+	if (!params.metrics_file.empty())
+		startMetricsExport(params.metrics_file);
+
+	verbose("[DDM Engine] %zu scales, %zu tau values, %zu episodes\n", lists.scale.size(), lists.tau.size(), lists.episode.size());
+}
+
+
+DDMEngine::~DDMEngine() {
+	destroyEngineCache(cache);
+	stopMetricsExport();
+}
+
+
+std::unique_ptr<ISF_binary_store_struct> DDMEngine::run(DDMparams &p, const host_frames_struct *frames) {
+	std::unique_ptr<ISF_binary_store_struct> result(new ISF_binary_store_struct);
+
+	engine_run_struct engine;
+	engine.cache  = cache;
+	engine.frames = frames;
+	engine.result = result.get();
+
+	runFromParams(p, lists, -1, 0, 0, ISF_sink_function(), NULL, &engine);
+	return result;
+}
+
+
+std::unique_ptr<ISF_binary_store_struct> DDMEngine::analyseFile(const std::string &path, int frame_count) {
+	DDMparams p = params;
+	p.file_in        = path;
+	p.frame_count    = frame_count;
+	p.benchmark_mode = false;
+
+	return run(p, NULL);
+}
+
+
+std::unique_ptr<ISF_binary_store_struct> DDMEngine::analyseFrames(const void *frames, int frame_count, int w, int h, int bpp, float fps) {
+	conditionAssert(frame_count > params.frame_offset, "no frames after the offset", true);
+
+	host_frames_struct host_frames;
+	host_frames.frames      = static_cast<const unsigned char *>(frames);
+	host_frames.frame_count = frame_count;
+	host_frames.w           = w;
+	host_frames.h           = h;
+	host_frames.bpp         = bpp;
+	host_frames.fps         = (fps > 0.0f) ? fps : 1.0f;
+
+	DDMparams p = params;
+	p.file_in        = "<host frames>";
+	p.frame_count    = frame_count - params.frame_offset;
+	p.use_movie_file = false;
+	p.benchmark_mode = false;
+
+	return run(p, &host_frames);
+}
+
+
+///////////////////////////////////////////////////////
+// C interface
+///////////////////////////////////////////////////////
+struct ddm_result_struct {
+	std::unique_ptr<ISF_binary_store_struct> store;
+	std::string json;
+};
+
+
+static ddm_result_struct *wrapResult(std::unique_ptr<ISF_binary_store_struct> store) {
+	ddm_result_struct *result = new ddm_result_struct;
+
+	std::ostringstream json;
+	writeBinaryStoreMeta(json, *store);
+
+	result->json  = json.str();
+	result->store = std::move(store);
+	return result;
+}
+
+
+extern "C" {
+
+DDMEngine *ddm_engine_create(int argc, char **argv) {
+	return new DDMEngine(argc, argv);
+}
+
+
+void ddm_engine_destroy(DDMEngine *engine) {
+	delete engine;
+}
+
+
+ddm_result_struct *ddm_engine_analyse_file(DDMEngine *engine, const char *path, int frame_count) {
+	return wrapResult(engine->analyseFile(path, frame_count));
+}
+
+
+ddm_result_struct *ddm_engine_analyse_frames(DDMEngine *engine, const void *frames, int frame_count,
+                                             int w, int h, int bpp, float fps) {
+	return wrapResult(engine->analyseFrames(frames, frame_count, w, h, bpp, fps));
+}
+
+
+void ddm_result_shape(const ddm_result_struct *result, size_t *shape) {
+	const ISF_binary_store_struct &store = *result->store;
+
+	shape[0] = store.episodes.size();
+	shape[1] = store.window_slots;
+	shape[2] = store.block_elements;
+	shape[3] = store.curve_count;
+}
+
+
+const float *ddm_result_isf(const ddm_result_struct *result) {
+	return result->store->data.data();
+}
+
+
+const float *ddm_result_fit(const ddm_result_struct *result) {
+	return result->store->fit_curves ? result->store->fit.data() : NULL;
+}
+
+
+const char *ddm_result_json(const ddm_result_struct *result) {
+	return result->json.c_str();
+}
+
+
+void ddm_result_free(ddm_result_struct *result) {
+	delete result;
+}
+
+}
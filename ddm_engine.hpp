@@ -0,0 +1,69 @@
+#include <stddef.h>
+#include <string>
+#include <memory>
+
+#include "DDM.hpp"
+#include "isf_store.hpp"
+
+#ifndef _DDM_ENGINE_H_
+#define _DDM_ENGINE_H_
+
+///////////////////////////////////////////////////////
+// An analysis set up once and run on many videos. The
+// arguments are those of the command line (input and -N
+// may be left out, they are given per run). Device and
+// pinned buffers, the cuFFT plans and the ring indices of
+// a run are kept and reused by the next run of the same
+// shape, so a stream of small videos pays allocation,
+// planning and mask building once. Results are the ISF
+// tensors of the binary store (-b), held in memory.
+// One GPU, one run at a time.
+///////////////////////////////////////////////////////
+class DDMEngine {
+public:
+	DDMEngine(int argc, char **argv);
+	~DDMEngine();
+
+	DDMEngine(const DDMEngine &) = delete;
+	DDMEngine &operator=(const DDMEngine &) = delete;
+
+	// frame_count frames of the video at [path] (after the -s offset)
+	std::unique_ptr<ISF_binary_store_struct> analyseFile(const std::string &path, int frame_count);
+
+	// frame_count single channel frames of w x h pixels, bpp 1 (uchar) or 2 (uint16),
+	// contiguous in host memory and read in place, the -s offset applies
+	std::unique_ptr<ISF_binary_store_struct> analyseFrames(const void *frames, int frame_count, int w, int h, int bpp, float fps);
+
+private:
+	std::unique_ptr<ISF_binary_store_struct> run(DDMparams &p, const host_frames_struct *frames);
+
+	DDMparams              params;
+	parameter_lists_struct lists;
+	engine_cache_struct    *cache;
+};
+
+///////////////////////////////////////////////////////
+// C interface of the engine (ctypes, see ddm_engine.py).
+// A result is [episode][window][block] float32 ISF values
+// and, with -L, [episode][window][curve][param] fit values,
+// described by the JSON of the binary store sidecar.
+///////////////////////////////////////////////////////
+extern "C" {
+	struct ddm_result_struct;
+
+	DDMEngine *ddm_engine_create(int argc, char **argv);
+	void ddm_engine_destroy(DDMEngine *engine);
+
+	ddm_result_struct *ddm_engine_analyse_file(DDMEngine *engine, const char *path, int frame_count);
+	ddm_result_struct *ddm_engine_analyse_frames(DDMEngine *engine, const void *frames, int frame_count,
+	                                             int w, int h, int bpp, float fps);
+
+	// shape[0..3] = episodes, windows, values per block, curves per block
+	void ddm_result_shape(const ddm_result_struct *result, size_t *shape);
+	const float *ddm_result_isf(const ddm_result_struct *result);
+	const float *ddm_result_fit(const ddm_result_struct *result);	// NULL without -L
+	const char *ddm_result_json(const ddm_result_struct *result);
+	void ddm_result_free(ddm_result_struct *result);
+}
+
+#endif
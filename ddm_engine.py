@@ -0,0 +1,120 @@
+"""
+multimultiDDM engine bindings (ctypes)
+
+The analysis is set up once and reused for many videos or frame stacks in the
+same process, device buffers, cuFFT plans and ring indices are kept between runs.
+Needs libmultiDDM.so, see "Library Build" in the README.
+
+Examples:
+  from ddm_engine import DDMEngine
+
+  engine = DDMEngine(["-Q", "lambda.txt", "-T", "tau.txt", "-S", "scale.txt", "-E", "episode.txt", "-o", "out_"])
+
+  for path in videos:
+      isf, fit, meta = engine.analyse_file(path, 1000)
+
+  # uint8 / uint16 stack of shape (frames, height, width), read in place
+  isf, fit, meta = engine.analyse_frames(stack, fps=100.0)
+"""
+
+import os
+import json
+import ctypes
+
+import numpy as np
+
+
+def _load_library(path=None):
+    if path is None:
+        path = os.environ.get("MULTIDDM_LIBRARY",
+                              os.path.join(os.path.dirname(os.path.abspath(__file__)), "libmultiDDM.so"))
+
+    lib = ctypes.CDLL(path)
+
+    lib.ddm_engine_create.argtypes = [ctypes.c_int, ctypes.POINTER(ctypes.c_char_p)]
+    lib.ddm_engine_create.restype = ctypes.c_void_p
+    lib.ddm_engine_destroy.argtypes = [ctypes.c_void_p]
+    lib.ddm_engine_destroy.restype = None
+
+    lib.ddm_engine_analyse_file.argtypes = [ctypes.c_void_p, ctypes.c_char_p, ctypes.c_int]
+    lib.ddm_engine_analyse_file.restype = ctypes.c_void_p
+    lib.ddm_engine_analyse_frames.argtypes = [ctypes.c_void_p, ctypes.c_void_p, ctypes.c_int,
+                                              ctypes.c_int, ctypes.c_int, ctypes.c_int, ctypes.c_float]
+    lib.ddm_engine_analyse_frames.restype = ctypes.c_void_p
+
+    lib.ddm_result_shape.argtypes = [ctypes.c_void_p, ctypes.POINTER(ctypes.c_size_t)]
+    lib.ddm_result_shape.restype = None
+    lib.ddm_result_isf.argtypes = [ctypes.c_void_p]
+    lib.ddm_result_isf.restype = ctypes.POINTER(ctypes.c_float)
+    lib.ddm_result_fit.argtypes = [ctypes.c_void_p]
+    lib.ddm_result_fit.restype = ctypes.POINTER(ctypes.c_float)
+    lib.ddm_result_json.argtypes = [ctypes.c_void_p]
+    lib.ddm_result_json.restype = ctypes.c_char_p
+    lib.ddm_result_free.argtypes = [ctypes.c_void_p]
+    lib.ddm_result_free.restype = None
+
+    return lib
+
+
+FIT_PARAM_COUNT = 4  # A, Gamma, beta, B
+
+
+class DDMEngine:
+    """Command line arguments of a run without input (-f) and frame count (-N)."""
+
+    def __init__(self, args, library=None):
+        self._lib = _load_library(library)
+
+        argv = [b"multiDDM"] + [str(a).encode() for a in args]
+        self._argv = (ctypes.c_char_p * (len(argv) + 1))(*argv, None)  # kept alive, getopt may permute it
+        self._engine = self._lib.ddm_engine_create(len(argv), self._argv)
+
+    def close(self):
+        if self._engine:
+            self._lib.ddm_engine_destroy(self._engine)
+            self._engine = None
+
+    def __enter__(self):
+        return self
+
+    def __exit__(self, *exc):
+        self.close()
+
+    def __del__(self):
+        self.close()
+
+    def _collect(self, result):
+        """Copies the result tensors into NumPy arrays and frees the result."""
+        try:
+            shape = (ctypes.c_size_t * 4)()
+            self._lib.ddm_result_shape(result, shape)
+            episodes, windows, block, curves = (int(v) for v in shape)
+
+            meta = json.loads(self._lib.ddm_result_json(result).decode())
+
+            isf = np.ctypeslib.as_array(self._lib.ddm_result_isf(result), shape=(episodes, windows, block)).copy()
+
+            fit = None
+            fit_ptr = self._lib.ddm_result_fit(result)
+            if fit_ptr:
+                fit = np.ctypeslib.as_array(fit_ptr, shape=(episodes, windows, curves, FIT_PARAM_COUNT)).copy()
+        finally:
+            self._lib.ddm_result_free(result)
+
+        return isf, fit, meta
+
+    def analyse_file(self, path, frame_count):
+        """ISF [episode][window][block], fit (or None) and the JSON description of one video."""
+        result = self._lib.ddm_engine_analyse_file(self._engine, os.fsencode(path), int(frame_count))
+        return self._collect(result)
+
+    def analyse_frames(self, frames, fps=1.0):
+        """Same for a (frames, height, width) uint8 or uint16 array, passed without a copy if C-contiguous."""
+        frames = np.ascontiguousarray(frames)
+        if frames.ndim != 3 or frames.dtype not in (np.uint8, np.uint16):
+            raise ValueError("frames must be a (frames, height, width) uint8 or uint16 array")
+
+        count, h, w = frames.shape
+        result = self._lib.ddm_engine_analyse_frames(self._engine, frames.ctypes.data_as(ctypes.c_void_p), count,
+                                                     w, h, frames.itemsize, float(fps))
+        return self._collect(result)
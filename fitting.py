@@ -1,5 +1,5 @@
 import numpy as np
-import os, math, re, argparse, glob
+import os, math, re, argparse, glob, json
 import time
 from collections import defaultdict
 import scipy.optimize as opt
@@ -79,6 +79,49 @@ def read_data_file(fname):
         print(f"Error reading file {fname}: {e}")
         return None, None, None
 
+# Open a binary ISF store (-b): returns the JSON metadata and a memory-mapped
+# float32 array [episode][window][block], no data is read until it is indexed
+def read_binary_store(bin_path):
+    meta_path = os.path.splitext(bin_path)[0] + ".json"
+    with open(meta_path, "r") as f:
+        meta = json.load(f)
+    blocks = np.memmap(bin_path, dtype=np.float32, mode="r", shape=tuple(meta["shape"]))
+    return meta, blocks
+
+# Entries (as built from text files) for every written window, scale and tile of a binary store
+def binary_store_entries(bin_path, specific_angle=None):
+    meta, blocks = read_binary_store(bin_path)
+    lambdas = np.array(meta["lambda"], dtype=float)
+    taus = np.array(meta["tau"], dtype=float)
+    q_count, angle_count, tau_count = meta["q_count"], meta["angle_count"], len(taus)
+    frames = np.array(meta["frames_analysed"]).reshape(meta["shape"][0], meta["shape"][1])
+    angle_width = 180.0 / angle_count
+
+    entries = []
+    for e, window_size in enumerate(meta["episodes"]):
+        for w in np.nonzero(frames[e])[0]:
+            for s, scale in enumerate(meta["scales"]):
+                begin, end = meta["scale_offsets"][s], meta["scale_offsets"][s + 1]
+                tiles = blocks[e, w, begin:end].reshape(meta["tiles_per_scale"][s], q_count, angle_count, tau_count)
+
+                for tile in range(tiles.shape[0]):
+                    if angle_count == 1:
+                        angle_info_list = [("Radial Average", tiles[tile, :, 0, :])]
+                    else:
+                        angle_info_list = [(f"Angle {a}: Center {a * angle_width - 90.0 + angle_width / 2:.1f}°, Range: {a * angle_width - 90.0:.1f}° to {(a + 1) * angle_width - 90.0:.1f}°",
+                                            tiles[tile, :, a, :]) for a in range(angle_count)]
+
+                    info = {'episode': window_size, 'window': int(w), 'scale': scale, 'tile': tile}
+                    if specific_angle is not None:
+                        if specific_angle >= len(angle_info_list):
+                            continue
+                        angle_info_list = [angle_info_list[specific_angle]]
+                        info['selected_angle'] = specific_angle
+
+                    entries.append({'file_path': f"episode{window_size}-{w}_scale{scale}-{tile}", 'info': info,
+                                    'lambdas': lambdas, 'taus': taus, 'angle_info_list': angle_info_list})
+    return entries
+
 # Extract metadata from filename
 def parse_filename(filename):
     info = {'episode': -1, 'window': -1, 'scale': -1, 'tile': -1}
@@ -391,7 +434,7 @@ def average_angle_data(angle_data_list, angle_desc_list, angle_idx, average):
 
 # Check if file is a valid ISF data file
 def is_valid_data_file(filepath):
-    excluded_extensions = ('.png', '.txt')
+    excluded_extensions = ('.png', '.txt', '.json', '_fit.bin')
     return not filepath.lower().endswith(excluded_extensions)
 
 # Main function to load and process multiple data files
@@ -408,7 +451,15 @@ def load_and_process_files(file_paths, average='individual', specific_angle=None
     print(f"Reading {len(file_paths)} files...")
     
     for file_path in file_paths:
+        # GPU fit results (-L) are stored next to the ISF store, they hold no ISF
+        if file_path.endswith('_fit.bin'):
+            continue
+
         try:
+            if file_path.endswith('.bin'):
+                all_data.extend(binary_store_entries(file_path, specific_angle))
+                continue
+
             # Read file data
             lambdas, taus, angle_info_list = read_data_file(file_path)
             if lambdas is None or not angle_info_list:
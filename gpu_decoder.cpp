@@ -0,0 +1,121 @@
+////////////////////////////////////////////////////////////////////////////////
+//  GPU video decoding: for MP4 / AVI input the CPU decode in the prefetch thread
+//  and the host to device copy of every chunk limit the frame rate, with -U the
+//  video is decoded by NVDEC and frames are cropped into the device chunk ring.
+////////////////////////////////////////////////////////////////////////////////
+
+#include <stdio.h>
+
+#include <string>
+
+#ifdef USE_NVDEC
+#include <opencv2/cudacodec.hpp>
+#include <opencv2/core/cuda_stream_accessor.hpp>
+#endif
+
+#include "debug.hpp"
+#include "instrumentation.hpp"
+#include "gpu_decoder.hpp"
+
+
+#ifdef USE_NVDEC
+
+struct gpu_decoder_struct {
+	std::string file_in;
+	int frame_offset;
+	int next_frame;				// frame (relative to frame_offset) the reader delivers next
+	video_info_struct info;
+
+	cv::Ptr<cv::cudacodec::VideoReader> reader;
+	cv::cuda::GpuMat frame;		// last decoded frame, reused
+};
+
+
+// (Re)opens the video and skips to the analysis offset
+static void rewindDecoder(gpu_decoder_struct &dec) {
+	dec.reader = cv::cudacodec::createVideoReader(dec.file_in);
+	conditionAssert(!dec.reader.empty(), "error opening video file with the GPU decoder", true);
+	dec.reader->set(cv::cudacodec::ColorFormat::GRAY);
+
+	for (int i = 0; i < dec.frame_offset; i++) {
+		conditionAssert(dec.reader->grab(), "video holds fewer frames than the offset", true);
+	}
+	dec.next_frame = 0;
+}
+
+
+gpu_decoder_struct *openGPUDecoder(const std::string &file_in, int frame_offset, video_info_struct &info) {
+	info.bpp = 1;
+	info.bytes_per_sample = 1;
+
+	gpu_decoder_struct *dec = new gpu_decoder_struct;
+	dec->file_in      = file_in;
+	dec->frame_offset = frame_offset;
+	dec->info         = info;
+
+	rewindDecoder(*dec);
+
+	cv::cudacodec::FormatInfo format = dec->reader->format();
+	conditionAssert(info.x_off + info.roi_w <= format.width && info.y_off + info.roi_h <= format.height,
+	                "region of interest exceeds the decoded frame", true);
+
+	verbose("GPU decoder opened, %d x %d frames decoded on device.\n", format.width, format.height);
+	return dec;
+}
+
+
+void closeGPUDecoder(gpu_decoder_struct *decoder) {
+	delete decoder;
+}
+
+
+void decodeChunkToDevice(gpu_decoder_struct *decoder, unsigned char *d_chunk, int first_frame, int frame_count, cudaStream_t stream) {
+	gpu_decoder_struct &dec = *decoder;
+	const video_info_struct &info = dec.info;
+
+	profileRangePush(PROFILE_LOAD, __FUNCTION__);
+
+	if (first_frame < dec.next_frame) {
+		rewindDecoder(dec);
+		verbose("  Reopened video for frame %d\n", first_frame);
+	}
+	for (; dec.next_frame < first_frame; dec.next_frame++) {
+		conditionAssert(dec.reader->grab(), "GPU decoder reached the end of the video", true);
+	}
+
+	// decode and crop on the same stream, so the reused frame is not overwritten before the copy out of it
+	cv::cuda::Stream cv_stream = cv::cuda::StreamAccessor::wrapStream(stream);
+
+	for (int f = 0; f < frame_count; f++) {
+		conditionAssert(dec.reader->nextFrame(dec.frame, cv_stream), "GPU decoder reached the end of the video", true);
+		conditionAssert(dec.frame.type() == CV_8UC1, "GPU decoder did not deliver 8-bit grey frames", true);
+
+		gpuErrorCheck(cudaMemcpy2DAsync(d_chunk + f * frameBytes(info), info.roi_w,
+		                                dec.frame.ptr(info.y_off) + info.x_off, dec.frame.step,
+		                                info.roi_w, info.roi_h, cudaMemcpyDeviceToDevice, stream));
+	}
+	dec.next_frame += frame_count;
+
+	profileRangePop();
+}
+
+#else
+
+struct gpu_decoder_struct {};
+
+
+gpu_decoder_struct *openGPUDecoder(const std::string &file_in, int frame_offset, video_info_struct &info) {
+	conditionAssert(false, "GPU decoding (-U) needs a build with -DUSE_NVDEC (OpenCV cudacodec)", true);
+	return NULL;
+}
+
+
+void closeGPUDecoder(gpu_decoder_struct *decoder) {
+	delete decoder;
+}
+
+
+void decodeChunkToDevice(gpu_decoder_struct *decoder, unsigned char *d_chunk, int first_frame, int frame_count, cudaStream_t stream) {
+}
+
+#endif
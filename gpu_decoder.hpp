@@ -0,0 +1,32 @@
+#include <cuda_runtime.h>
+
+#include <string>
+
+#include "video_reader.hpp"
+
+#ifndef _GPU_DECODER_H_
+#define _GPU_DECODER_H_
+
+///////////////////////////////////////////////////////
+// GPU video decoding (-U). Compressed videos (MP4, AVI ..)
+// are decoded by NVDEC through cv::cudacodec::VideoReader,
+// the region of interest of every decoded frame is copied
+// device to device into the raw chunk being filled, so no
+// frame passes through host memory. Frames are decoded as
+// 8-bit grey. The decoder is driven by the pipeline thread
+// in stream order, it seeks forward by skipping frames and
+// backward by reopening the video. Needs OpenCV (4.7 or
+// later) built with the cudacodec module, enabled with
+// -DUSE_NVDEC at compile time.
+///////////////////////////////////////////////////////
+struct gpu_decoder_struct;
+
+// Opens [file_in] at [frame_offset], info holds the frame size and region of interest
+// and is switched to single channel 8-bit samples
+gpu_decoder_struct *openGPUDecoder(const std::string &file_in, int frame_offset, video_info_struct &info);
+void closeGPUDecoder(gpu_decoder_struct *decoder);
+
+// Decodes frames [first_frame, first_frame + frame_count) (relative to the offset) into d_chunk, on [stream]
+void decodeChunkToDevice(gpu_decoder_struct *decoder, unsigned char *d_chunk, int first_frame, int frame_count, cudaStream_t stream);
+
+#endif
@@ -0,0 +1,212 @@
+////////////////////////////////////////////////////////////////////////////////
+//  Instrumentation: NVTX ranges of the multiDDM domain and the counters of a run.
+//  A background thread writes the counters to a file as JSON or in the Prometheus
+//  text format, so a run can be watched (or scraped through a node exporter's
+//  textfile collector) without rebuilding with extra output.
+////////////////////////////////////////////////////////////////////////////////
+
+#include <stdio.h>
+#include <stdint.h>
+#include <nvToolsExt.h>
+
+#include <string>
+#include <fstream>
+#include <atomic>
+#include <chrono>
+#include <thread>
+#include <mutex>
+#include <condition_variable>
+
+#include "debug.hpp"
+#include "constants.hpp"
+#include "instrumentation.hpp"
+
+
+static const char *stage_names[STAGE_COUNT] = {"h2d", "parse", "fft", "difference", "reduction", "output"};
+
+static const char *counter_names[METRIC_COUNTER_COUNT] = {
+	"frames_loaded", "frames_analysed", "chunks", "bytes_h2d", "accumulator_flushes", "isf_written", "snapshots_dropped"
+};
+
+static const char *gauge_names[METRIC_GAUGE_COUNT] = {"prefetch_queue_depth", "writer_queue_depth"};
+
+// ARGB colour of each range category
+static const uint32_t category_colours[PROFILE_CATEGORY_COUNT] = {
+	0xff4c72b0, 0xff55a868, 0xffc44e52, 0xff8172b2, 0xffccb974, 0xff64b5cd, 0xff8c8c8c, 0xffdd8452
+};
+
+
+const char *stageName(int stage) {
+	return stage_names[stage];
+}
+
+
+///////////////////////////////////////////////////////
+// NVTX
+///////////////////////////////////////////////////////
+static nvtxDomainHandle_t profileDomain() {
+	static nvtxDomainHandle_t domain = nvtxDomainCreateA("multiDDM");
+	return domain;
+}
+
+
+void profileRangePush(int category, const std::string &name) {
+	nvtxEventAttributes_t attributes = {};
+	attributes.version       = NVTX_VERSION;
+	attributes.size          = NVTX_EVENT_ATTRIB_STRUCT_SIZE;
+	attributes.category      = category;
+	attributes.colorType     = NVTX_COLOR_ARGB;
+	attributes.color         = category_colours[category];
+	attributes.messageType   = NVTX_MESSAGE_TYPE_ASCII;
+	attributes.message.ascii = name.c_str();
+
+	nvtxDomainRangePushEx(profileDomain(), &attributes);
+}
+
+
+void profileRangePop() {
+	nvtxDomainRangePop(profileDomain());
+}
+
+
+///////////////////////////////////////////////////////
+// Counters
+///////////////////////////////////////////////////////
+struct metrics_struct {
+	std::atomic<uint64_t> counters[METRIC_COUNTER_COUNT];
+	std::atomic<int64_t>  gauges[METRIC_GAUGE_COUNT];
+	std::atomic<uint64_t> stage_ns[STAGE_COUNT];	// GPU time of each stage
+
+	bool enabled;
+	std::string path;
+	std::chrono::steady_clock::time_point start;
+
+	std::thread thread;
+	std::mutex mtx;
+	std::condition_variable cv;
+	bool stop;
+};
+
+static metrics_struct metrics;
+
+
+void countMetric(int counter, uint64_t amount) {
+	metrics.counters[counter].fetch_add(amount, std::memory_order_relaxed);
+}
+
+
+void addGauge(int gauge, int64_t delta) {
+	metrics.gauges[gauge].fetch_add(delta, std::memory_order_relaxed);
+}
+
+
+void addStageTime(int stage, double ms) {
+	metrics.stage_ns[stage].fetch_add(static_cast<uint64_t>(ms * 1e6), std::memory_order_relaxed);
+}
+
+
+bool metricsEnabled() {
+	return metrics.enabled;
+}
+
+
+static void writeJSON(std::ofstream &out, double uptime) {
+	out << "{\n";
+	out << "  \"uptime_seconds\": " << uptime << ",\n";
+
+	out << "  \"counters\": {";
+	for (int c = 0; c < METRIC_COUNTER_COUNT; c++)
+		out << (c ? ", " : "") << "\"" << counter_names[c] << "\": " << metrics.counters[c].load();
+	out << "},\n";
+
+	out << "  \"gauges\": {";
+	for (int g = 0; g < METRIC_GAUGE_COUNT; g++)
+		out << (g ? ", " : "") << "\"" << gauge_names[g] << "\": " << metrics.gauges[g].load();
+	out << "},\n";
+
+	out << "  \"stage_seconds\": {";
+	for (int s = 0; s < STAGE_COUNT; s++)
+		out << (s ? ", " : "") << "\"" << stage_names[s] << "\": " << metrics.stage_ns[s].load() / 1e9;
+	out << "}\n";
+	out << "}\n";
+}
+
+
+static void writePrometheus(std::ofstream &out, double uptime) {
+	out << "# TYPE multiddm_uptime_seconds gauge\n";
+	out << "multiddm_uptime_seconds " << uptime << "\n";
+
+	for (int c = 0; c < METRIC_COUNTER_COUNT; c++) {
+		out << "# TYPE multiddm_" << counter_names[c] << "_total counter\n";
+		out << "multiddm_" << counter_names[c] << "_total " << metrics.counters[c].load() << "\n";
+	}
+
+	for (int g = 0; g < METRIC_GAUGE_COUNT; g++) {
+		out << "# TYPE multiddm_" << gauge_names[g] << " gauge\n";
+		out << "multiddm_" << gauge_names[g] << " " << metrics.gauges[g].load() << "\n";
+	}
+
+	out << "# TYPE multiddm_stage_seconds_total counter\n";
+	for (int s = 0; s < STAGE_COUNT; s++)
+		out << "multiddm_stage_seconds_total{stage=\"" << stage_names[s] << "\"} " << metrics.stage_ns[s].load() / 1e9 << "\n";
+}
+
+
+// Replaces the export file, readers never see a partly written snapshot
+static void exportMetrics() {
+	double uptime = std::chrono::duration<double>(std::chrono::steady_clock::now() - metrics.start).count();
+	bool prometheus = metrics.path.size() >= 5 && metrics.path.compare(metrics.path.size() - 5, 5, ".prom") == 0;
+
+	std::string tmp_path = metrics.path + ".tmp";
+	{
+		std::ofstream out(tmp_path);
+		if (!out.is_open()) {
+			conditionAssert(false, "unable to open " + tmp_path);
+			return;
+		}
+
+		if (prometheus) {
+			writePrometheus(out, uptime);
+		} else {
+			writeJSON(out, uptime);
+		}
+	}
+
+	if (rename(tmp_path.c_str(), metrics.path.c_str()) != 0)
+		conditionAssert(false, "unable to replace " + metrics.path);
+}
+
+
+void startMetricsExport(const std::string &path) {
+	metrics.path    = path;
+	metrics.start   = std::chrono::steady_clock::now();
+	metrics.stop    = false;
+	metrics.enabled = true;
+
+	metrics.thread = std::thread([] {
+		auto interval = std::chrono::duration<float>(METRICS_EXPORT_INTERVAL);
+
+		std::unique_lock<std::mutex> lock(metrics.mtx);
+		while (!metrics.cv.wait_for(lock, interval, [] { return metrics.stop; })) {
+			exportMetrics();
+		}
+	});
+
+	verbose("Metrics written to %s every %.1f s\n", path.c_str(), METRICS_EXPORT_INTERVAL);
+}
+
+
+void stopMetricsExport() {
+	if (!metrics.enabled)
+		return;
+
+	{
+		std::lock_guard<std::mutex> lock(metrics.mtx);
+		metrics.stop = true;
+	}
+	metrics.cv.notify_all();
+	metrics.thread.join();
+
+	exportMetrics();
+	metrics.enabled = false;
+}
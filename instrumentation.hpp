@@ -0,0 +1,60 @@
+#include <stdint.h>
+#include <string>
+
+#include "DDM.hpp"
+
+#ifndef _INSTRUMENTATION_H_
+#define _INSTRUMENTATION_H_
+
+///////////////////////////////////////////////////////
+// NVTX ranges of the "multiDDM" domain. The category of a
+// range is one of the pipeline stages or one of the
+// categories below, ranges of a category share a colour.
+// Ranges cost next to nothing unless a profiler is attached.
+///////////////////////////////////////////////////////
+enum profile_category {
+	PROFILE_LOAD = STAGE_COUNT,	// video read into host memory
+	PROFILE_WINDOW,				// window / snapshot / flush of the run
+	PROFILE_CATEGORY_COUNT
+};
+
+void profileRangePush(int category, const std::string &name);
+void profileRangePop();
+
+const char *stageName(int stage);
+
+///////////////////////////////////////////////////////
+// Process wide counters, gauges and GPU stage times, updated
+// from every GPU and thread of the run. Written to file every
+// METRICS_EXPORT_INTERVAL seconds while the export runs.
+///////////////////////////////////////////////////////
+enum metric_counter {
+	METRIC_FRAMES_LOADED,		// frames read by the prefetch thread(s)
+	METRIC_FRAMES_ANALYSED,		// frames copied to device
+	METRIC_CHUNKS,
+	METRIC_BYTES_H2D,
+	METRIC_ACCUM_FLUSHES,		// accumulators handed to the analysis stream
+	METRIC_ISF_WRITTEN,			// ISF blocks written out
+	METRIC_SNAPSHOTS_DROPPED,	// live snapshots dropped, writer busy
+	METRIC_COUNTER_COUNT
+};
+
+enum metric_gauge {
+	METRIC_PREFETCH_QUEUE,		// chunks loaded but not yet copied to device
+	METRIC_WRITER_QUEUE,		// ISF blocks waiting for the writer
+	METRIC_GAUGE_COUNT
+};
+
+void countMetric(int counter, uint64_t amount);
+void addGauge(int gauge, int64_t delta);
+void addStageTime(int stage, double ms);
+
+bool metricsEnabled();
+
+// Starts the periodic export to [path], Prometheus text format if the path ends in .prom, otherwise JSON
+void startMetricsExport(const std::string &path);
+
+// Writes a last snapshot and stops the export
+void stopMetricsExport();
+
+#endif
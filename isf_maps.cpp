@@ -0,0 +1,164 @@
+////////////////////////////////////////////////////////////////////////////////
+//  ISF maps: for small scales with thousands of tiles the per-tile text files
+//  dominate the run time, map mode writes every scale of a window as one dense
+//  NumPy array instead (and optionally heatmap images), straight from the ISF
+//  block the device reduction has produced for all tiles at once.
+////////////////////////////////////////////////////////////////////////////////
+
+#include <stdio.h>
+#include <stdint.h>
+
+#include <string>
+#include <vector>
+#include <fstream>
+#include <algorithm>
+
+#include <opencv2/opencv.hpp>
+
+#include "debug.hpp"
+#include "constants.hpp"
+#include "isf_store.hpp"
+#include "isf_maps.hpp"
+
+
+void openMapWriter(ISF_map_writer_struct &maps, std::string file_out,
+                   float *lambda_arr, int lambda_count,
+                   int *tau_vector, int tau_count,
+                   bool enable_angle_analysis, int angle_count,
+                   int tile_overlap,
+                   bool images) {
+
+	maps.file_out        = file_out;
+	maps.lambdas.assign(lambda_arr, lambda_arr + lambda_count);
+	maps.taus.assign(tau_vector, tau_vector + tau_count);
+	maps.q_count         = lambda_count;
+	maps.angle_count     = enable_angle_analysis ? angle_count : 1;
+	maps.tile_overlap    = tile_overlap;
+	maps.images          = images;
+	maps.fps             = 0.0f;
+	maps.windows_written = 0;
+}
+
+
+// NumPy .npy (version 1.0) file of little endian float32 values
+static void writeNpy(const std::string &path, const float *data, const std::vector<size_t> &shape) {
+	std::string header = "{'descr': '<f4', 'fortran_order': False, 'shape': (";
+	size_t count = 1;
+	for (size_t d = 0; d < shape.size(); d++) {
+		header += std::to_string(shape[d]) + ", ";
+		count *= shape[d];
+	}
+	header += "), }";
+
+	// magic, version and length take 10 bytes, the header is padded to a multiple of 64
+	size_t total = 10 + header.size() + 1;
+	header.append((64 - total % 64) % 64, ' ');
+	header += '\n';
+
+	std::ofstream out(path, std::ios::binary | std::ios::trunc);
+	conditionAssert(out.is_open(), "unable to open " + path, true);
+
+	uint16_t header_len = static_cast<uint16_t>(header.size());
+	out.write("\x93NUMPY\x01\x00", 8);
+	out.write(reinterpret_cast<const char *>(&header_len), sizeof(header_len));
+	out.write(header.data(), header.size());
+	out.write(reinterpret_cast<const char *>(data), sizeof(float) * count);
+
+	conditionAssert(!out.fail(), "unable to write " + path, true);
+}
+
+
+// Heatmap of the ISF at the largest tau of q-value [q], one cell per tile
+static void writeHeatmap(const std::string &path, const float *map, int tiles_per_side, int ring_count,
+                         int angle_count, int q, int tau_count) {
+
+	cv::Mat cells(tiles_per_side, tiles_per_side, CV_32F);
+
+	for (int t = 0; t < tiles_per_side * tiles_per_side; t++) {
+		float sum = 0.0f;
+		for (int a = 0; a < angle_count; a++) {
+			sum += map[(static_cast<size_t>(t) * ring_count + q * angle_count + a) * tau_count + tau_count - 1];
+		}
+		cells.at<float>(t / tiles_per_side, t % tiles_per_side) = sum / angle_count;
+	}
+
+	cv::Mat scaled, coloured;
+	cv::normalize(cells, scaled, 0, 255, cv::NORM_MINMAX, CV_8U);
+	cv::applyColorMap(scaled, coloured, cv::COLORMAP_VIRIDIS);
+
+	int cell_size = std::max(1, MAP_IMAGE_MIN_SIZE / tiles_per_side);
+	cv::resize(coloured, coloured, cv::Size(), cell_size, cell_size, cv::INTER_NEAREST);
+
+	conditionAssert(cv::imwrite(path, coloured), "unable to write " + path);
+}
+
+
+///////////////////////////////////////////////////////
+// One map per scale of the window, and its heatmaps
+///////////////////////////////////////////////////////
+void writeISFMaps(ISF_map_writer_struct &maps, const ISF_block_struct &block) {
+	int main_scale = block.scale_arr[0];
+	std::string prefix = block.file_out + "episode" + std::to_string(block.window_size) + "-" + std::to_string(block.window_index);
+
+	for (int s = 0; s < block.scale_count; s++) {
+		int scale = block.scale_arr[s];
+		int tiles_per_side = tilesPerSide(scale, main_scale, block.tile_overlap);
+		std::string name = prefix + "_scale" + std::to_string(scale);
+
+		const float *map = block.ISF + block.ISF_offsets[s];
+		std::vector<size_t> shape = {static_cast<size_t>(tiles_per_side), static_cast<size_t>(tiles_per_side),
+		                             static_cast<size_t>(maps.q_count), static_cast<size_t>(maps.angle_count),
+		                             static_cast<size_t>(block.tau_count)};
+		writeNpy(name + "_map.npy", map, shape);
+
+		if (block.fit != NULL) {
+			shape.back() = FIT_PARAM_COUNT;
+			writeNpy(name + "_fit_map.npy", block.fit + (block.ISF_offsets[s] / block.tau_count) * FIT_PARAM_COUNT, shape);
+		}
+
+		for (int q = 0; maps.images && q < maps.q_count; q++) {
+			writeHeatmap(name + "_q" + std::to_string(q) + "_map.png", map, tiles_per_side, block.ring_count,
+			             maps.angle_count, q, block.tau_count);
+		}
+	}
+
+	std::lock_guard<std::mutex> lock(maps.mtx);
+	maps.fps = block.fps;
+	maps.windows_written++;
+
+	verbose("ISF maps of episode %d window %d written to %s_scale*\n", block.window_size, block.window_index, prefix.c_str());
+}
+
+
+void closeMapWriter(ISF_map_writer_struct &maps, int *scale_vector, int scale_count) {
+	std::string path = maps.file_out + "maps.json";
+
+	std::vector<int> scales(scale_vector, scale_vector + scale_count);
+	std::vector<int> tiles_per_side;
+	for (int scale : scales)
+		tiles_per_side.push_back(tilesPerSide(scale, scales[0], maps.tile_overlap));
+
+	std::vector<float> tau_seconds;
+	for (int tau : maps.taus)
+		tau_seconds.push_back(maps.fps > 0.0f ? tau / maps.fps : static_cast<float>(tau));
+
+	std::ofstream out(path);
+	conditionAssert(out.is_open(), "unable to open " + path, true);
+
+	out << "{\n";
+	out << "  \"map_layout\": \"[tile_y][tile_x][q][angle][tau]\",\n";
+	out << "  \"fit_map_layout\": \"[tile_y][tile_x][q][angle][A, Gamma, beta, B]\",\n";
+	out << "  \"q_count\": " << maps.q_count << ",\n";
+	out << "  \"angle_count\": " << maps.angle_count << ",\n";
+	out << "  \"tile_overlap\": " << maps.tile_overlap << ",\n";
+	out << "  \"fps\": " << maps.fps << ",\n";
+	out << "  \"windows\": " << maps.windows_written << ",\n";
+	writeJSONArray(out, "scales", scales);
+	writeJSONArray(out, "tiles_per_side", tiles_per_side);
+	writeJSONArray(out, "lambda", maps.lambdas);
+	writeJSONArray(out, "tau_frames", maps.taus);
+	writeJSONArray(out, "tau", tau_seconds, true);
+	out << "}\n";
+
+	verbose("ISF map axes written to %s\n", path.c_str());
+}
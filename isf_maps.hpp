@@ -0,0 +1,53 @@
+#include <string>
+#include <vector>
+#include <mutex>
+
+#include "DDM.hpp"
+
+#ifndef _ISF_MAPS_H_
+#define _ISF_MAPS_H_
+
+///////////////////////////////////////////////////////
+// Spatially resolved ISF maps (-p). Every analysed window
+// is written as one dense array per scale,
+// <prefix>episode<size>-<index>_scale<scale>_map.npy of shape
+// [tile_y][tile_x][q][angle][tau] (float32, NumPy .npy), and
+// with the GPU fit <...>_fit_map.npy of shape
+// [tile_y][tile_x][q][angle][param]. The ISF block of a
+// window already holds the tiles of a scale in row-major
+// tile order, so a map is a contiguous slice of the block.
+// With images set a heatmap PNG of every scale and q is
+// written as well: the ISF at the largest tau, averaged over
+// the angles, one tile per cell. Overlapping tiles are
+// scale / tile_overlap pixels apart, so neighbouring cells
+// of a map share pixels. The axes of the run are written
+// once to <out>maps.json.
+///////////////////////////////////////////////////////
+struct ISF_map_writer_struct {
+	std::string        file_out;
+	std::vector<float> lambdas;
+	std::vector<int>   taus;			// in frames
+	int                q_count;
+	int                angle_count;		// 1 without angle analysis
+	int                tile_overlap;
+	bool               images;
+
+	float              fps;				// of the last window written
+	int                windows_written;
+	std::mutex         mtx;
+};
+
+void openMapWriter(ISF_map_writer_struct &maps, std::string file_out,
+                   float *lambda_arr, int lambda_count,
+                   int *tau_vector, int tau_count,
+                   bool enable_angle_analysis, int angle_count,
+                   int tile_overlap,
+                   bool images);
+
+// ISF sink of the map writer, thread-safe
+void writeISFMaps(ISF_map_writer_struct &maps, const ISF_block_struct &block);
+
+// Writes <out>maps.json
+void closeMapWriter(ISF_map_writer_struct &maps, int *scale_vector, int scale_count);
+
+#endif
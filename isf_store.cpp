@@ -0,0 +1,208 @@
+////////////////////////////////////////////////////////////////////////////////
+//  Binary ISF store: the analysed windows of a run are written into one
+//  float32 tensor file instead of one text file per scale and tile. Blocks are
+//  written with pwrite from the writer thread(s) at their fixed position, so
+//  windows may arrive in any order and from any GPU. In memory the same tensors
+//  are held in host vectors (DDMEngine results).
+////////////////////////////////////////////////////////////////////////////////
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <fcntl.h>
+#include <unistd.h>
+
+#include <string>
+#include <vector>
+#include <fstream>
+#include <algorithm>
+
+#include "debug.hpp"
+#include "constants.hpp"
+#include "isf_store.hpp"
+
+
+///////////////////////////////////////////////////////
+// Creates the tensor file at its full (zero-filled) size,
+// or the zero-filled tensors when in_memory is set
+///////////////////////////////////////////////////////
+void openBinaryStore(ISF_binary_store_struct &store,
+                     std::string file_out,
+                     int *episode_vector, int episode_count,
+                     int total_frames,
+                     int window_hop,
+                     int *scale_vector, int scale_count,
+                     int tile_overlap,
+                     float *lambda_arr, int lambda_count,
+                     int *tau_vector, int tau_count,
+                     bool enable_angle_analysis,
+                     int angle_count,
+                     bool fit_curves,
+                     bool in_memory) {
+
+	store.data_path = file_out + "ISF.bin";
+	store.fit_path  = fit_curves ? file_out + "ISF_fit.bin" : "";
+	store.meta_path = file_out + "ISF.json";
+
+	store.episodes.assign(episode_vector, episode_vector + episode_count);
+	store.window_hop = window_hop;
+	store.scales.assign(scale_vector, scale_vector + scale_count);
+	store.tile_overlap = tile_overlap;
+	store.lambdas.assign(lambda_arr, lambda_arr + lambda_count);
+	store.taus.assign(tau_vector, tau_vector + tau_count);
+	store.q_count     = lambda_count;
+	store.angle_count = enable_angle_analysis ? angle_count : 1;
+	store.fps         = 0.0f;
+
+	store.window_slots = 0;
+	for (int window_size : store.episodes) {
+		store.window_slots = std::max(store.window_slots, windowCount(total_frames, window_size, window_hop));
+	}
+
+	int main_scale = scale_vector[0];
+	int ring_count = lambda_count * store.angle_count;
+
+	store.scale_offsets.assign(scale_count + 1, 0);
+	for (int s = 0; s < scale_count; s++) {
+		int tile_count = tileCount(scale_vector[s], main_scale, tile_overlap);
+		store.scale_offsets[s + 1] = store.scale_offsets[s] + static_cast<size_t>(tile_count) * ring_count * tau_count;
+	}
+	store.block_elements = store.scale_offsets[scale_count];
+	store.curve_count    = store.block_elements / tau_count;
+
+	store.frames_analysed.assign(static_cast<size_t>(episode_count) * store.window_slots, 0);
+	store.fit_curves = fit_curves;
+	store.in_memory  = in_memory;
+
+	if (in_memory) {
+		store.fd     = -1;
+		store.fit_fd = -1;
+		store.data.assign(store.block_elements * store.frames_analysed.size(), 0.0f);
+		if (fit_curves)
+			store.fit.assign(FIT_PARAM_COUNT * store.curve_count * store.frames_analysed.size(), 0.0f);
+
+		verbose("In-memory ISF store: %d episodes x %d windows x %zu values\n", episode_count, store.window_slots, store.block_elements);
+		return;
+	}
+
+	store.fd = open(store.data_path.c_str(), O_RDWR | O_CREAT | O_TRUNC, 0644);
+	conditionAssert(store.fd >= 0, "unable to open " + store.data_path, true);
+
+	off_t file_size = static_cast<off_t>(sizeof(float) * store.block_elements * store.frames_analysed.size());
+	conditionAssert(ftruncate(store.fd, file_size) == 0, "unable to size " + store.data_path, true);
+
+	store.fit_fd = -1;
+	if (fit_curves) {
+		store.fit_fd = open(store.fit_path.c_str(), O_RDWR | O_CREAT | O_TRUNC, 0644);
+		conditionAssert(store.fit_fd >= 0, "unable to open " + store.fit_path, true);
+
+		off_t fit_size = static_cast<off_t>(sizeof(float) * FIT_PARAM_COUNT * store.curve_count * store.frames_analysed.size());
+		conditionAssert(ftruncate(store.fit_fd, fit_size) == 0, "unable to size " + store.fit_path, true);
+	}
+
+	verbose("Binary ISF store %s: %d episodes x %d windows x %zu values\n", store.data_path.c_str(),
+	        episode_count, store.window_slots, store.block_elements);
+}
+
+
+// Writes block [block_index] of block_bytes bytes
+static void writeAt(int fd, const std::string &path, const float *data, size_t block_bytes, size_t block_index) {
+	const char *src = reinterpret_cast<const char *>(data);
+	off_t offset = static_cast<off_t>(block_bytes * block_index);
+
+	for (size_t done = 0; done < block_bytes; ) {
+		ssize_t written = pwrite(fd, src + done, block_bytes - done, offset + done);
+		conditionAssert(written > 0, "unable to write " + path, true);
+		done += written;
+	}
+}
+
+
+///////////////////////////////////////////////////////
+// ISF sink of the store, thread-safe
+///////////////////////////////////////////////////////
+void writeBinaryBlock(ISF_binary_store_struct &store, const ISF_block_struct &block) {
+	conditionAssert(block.ISF_offsets[block.scale_count] == store.block_elements, "ISF block does not match binary store layout", true);
+
+	int episode = static_cast<int>(std::find(store.episodes.begin(), store.episodes.end(), block.window_size) - store.episodes.begin());
+	conditionAssert(episode < static_cast<int>(store.episodes.size()) && block.window_index < store.window_slots,
+	                "ISF block outside binary store", true);
+
+	size_t block_index = static_cast<size_t>(episode) * store.window_slots + block.window_index;
+
+	size_t fit_elements = FIT_PARAM_COUNT * store.curve_count;
+
+	if (store.in_memory) { // blocks do not overlap, no lock needed for the copy
+		std::copy(block.ISF, block.ISF + store.block_elements, store.data.begin() + store.block_elements * block_index);
+		if (store.fit_curves && block.fit != NULL)
+			std::copy(block.fit, block.fit + fit_elements, store.fit.begin() + fit_elements * block_index);
+	} else {
+		writeAt(store.fd, store.data_path, block.ISF, sizeof(float) * store.block_elements, block_index);
+
+		if (store.fit_fd >= 0 && block.fit != NULL)
+			writeAt(store.fit_fd, store.fit_path, block.fit, sizeof(float) * fit_elements, block_index);
+	}
+
+	std::lock_guard<std::mutex> lock(store.mtx);
+	store.frames_analysed[block_index] = block.frames_analysed;
+	store.fps = block.fps;
+
+	verbose("I(lambda, tau) of episode %d window %d written to %s\n", block.window_size, block.window_index,
+	        store.in_memory ? "memory" : store.data_path.c_str());
+}
+
+
+void writeBinaryStoreMeta(std::ostream &out, const ISF_binary_store_struct &store) {
+	std::vector<int> tiles_per_scale;
+	for (int scale : store.scales)
+		tiles_per_scale.push_back(tileCount(scale, store.scales[0], store.tile_overlap));
+
+	std::vector<float> tau_seconds;
+	for (int tau : store.taus)
+		tau_seconds.push_back(store.fps > 0.0f ? tau / store.fps : static_cast<float>(tau));
+
+	out << "{\n";
+	if (!store.in_memory)
+		out << "  \"data_file\": \"" << store.data_path.substr(store.data_path.find_last_of('/') + 1) << "\",\n";
+	out << "  \"dtype\": \"float32\",\n";
+	out << "  \"shape\": [" << store.episodes.size() << ", " << store.window_slots << ", " << store.block_elements << "],\n";
+	out << "  \"block_layout\": \"[scale][tile][q][angle][tau]\",\n";
+	if (store.fit_curves) {
+		if (!store.in_memory)
+			out << "  \"fit_file\": \"" << store.fit_path.substr(store.fit_path.find_last_of('/') + 1) << "\",\n";
+		out << "  \"fit_shape\": [" << store.episodes.size() << ", " << store.window_slots << ", " << store.curve_count << ", " << FIT_PARAM_COUNT << "],\n";
+		out << "  \"fit_params\": [\"A\", \"Gamma\", \"beta\", \"B\"],\n";
+	}
+	out << "  \"q_count\": " << store.q_count << ",\n";
+	out << "  \"angle_count\": " << store.angle_count << ",\n";
+	out << "  \"fps\": " << store.fps << ",\n";
+	out << "  \"window_hop\": " << store.window_hop << ",\n";
+	out << "  \"tile_overlap\": " << store.tile_overlap << ",\n";
+	writeJSONArray(out, "episodes", store.episodes);
+	writeJSONArray(out, "scales", store.scales);
+	writeJSONArray(out, "tiles_per_scale", tiles_per_scale);
+	writeJSONArray(out, "scale_offsets", store.scale_offsets);
+	writeJSONArray(out, "lambda", store.lambdas);
+	writeJSONArray(out, "tau_frames", store.taus);
+	writeJSONArray(out, "tau", tau_seconds);
+	writeJSONArray(out, "frames_analysed", store.frames_analysed, true);
+	out << "}\n";
+}
+
+
+///////////////////////////////////////////////////////
+// Closes the tensor file and writes the JSON sidecar
+///////////////////////////////////////////////////////
+void closeBinaryStore(ISF_binary_store_struct &store) {
+	if (store.in_memory)
+		return;
+
+	close(store.fd);
+	if (store.fit_fd >= 0)
+		close(store.fit_fd);
+
+	std::ofstream out(store.meta_path);
+	conditionAssert(out.is_open(), "unable to open " + store.meta_path, true);
+	writeBinaryStoreMeta(out, store);
+
+	verbose("Binary ISF store metadata written to %s\n", store.meta_path.c_str());
+}
@@ -0,0 +1,87 @@
+#include <string>
+#include <vector>
+#include <mutex>
+#include <ostream>
+
+#include "DDM.hpp"
+
+#ifndef _ISF_STORE_H_
+#define _ISF_STORE_H_
+
+///////////////////////////////////////////////////////
+// Binary ISF output (-b). One float32 file holds the ISF of
+// every window as a tensor [episode][window][block], where
+// a block is the ISF of one window in the layout of the
+// analysis staging buffer (see ISF_block_struct):
+// [scale][tile][q][angle][tau], the offset of each scale
+// given by scale_offsets. Windows that do not exist for an
+// episode are left zero. With the GPU fit a second file
+// holds the model parameters as [episode][window][curve]
+// [param], a curve being one (scale, tile, q, angle) of a
+// block. A JSON sidecar holds the shapes, the parameter
+// lists and the frames analysed per window. With sliding
+// windows (window_hop > 0) window w of an episode starts at
+// frame w * window_hop. An in-memory store holds the same
+// tensors in data and fit, no files.
+///////////////////////////////////////////////////////
+struct ISF_binary_store_struct {
+	std::string         data_path;		// <file_out>ISF.bin
+	std::string         meta_path;		// <file_out>ISF.json
+	int                 fd;
+	std::string         fit_path;		// <file_out>ISF_fit.bin, empty without the fit
+	int                 fit_fd;
+
+	std::vector<int>    episodes;		// window size of every episode
+	int                 window_hop;		// 0 for disjoint windows
+	int                 window_slots;	// windows per episode in the tensor
+	std::vector<int>    scales;
+	int                 tile_overlap;
+	std::vector<size_t> scale_offsets;	// element offset of each scale within a block, scale_count + 1 values
+	size_t              block_elements;
+	size_t              curve_count;	// ISF curves per block
+	std::vector<float>  lambdas;
+	std::vector<int>    taus;			// in frames
+	int                 q_count;
+	int                 angle_count;	// 1 without angle analysis
+	float               fps;
+
+	std::vector<int>    frames_analysed; // [episode][window], 0 for windows not written
+	bool                fit_curves;
+	bool                in_memory;
+	std::vector<float>  data;			// in memory: [episode][window][block]
+	std::vector<float>  fit;			// in memory: [episode][window][curve][param]
+	std::mutex          mtx;
+};
+
+void openBinaryStore(ISF_binary_store_struct &store,
+                     std::string file_out,
+                     int *episode_vector, int episode_count,
+                     int total_frames,
+                     int window_hop,
+                     int *scale_vector, int scale_count,
+                     int tile_overlap,
+                     float *lambda_arr, int lambda_count,
+                     int *tau_vector, int tau_count,
+                     bool enable_angle_analysis,
+                     int angle_count,
+                     bool fit_curves,
+                     bool in_memory);
+
+void writeBinaryBlock(ISF_binary_store_struct &store, const ISF_block_struct &block);
+
+// JSON description of the store (the sidecar of the file store)
+void writeBinaryStoreMeta(std::ostream &out, const ISF_binary_store_struct &store);
+
+// Writes "name": [values] as one member of a JSON object, shared by the JSON sidecars
+template <typename T>
+inline void writeJSONArray(std::ostream &out, const char *name, const std::vector<T> &values, bool last = false) {
+	out << "  \"" << name << "\": [";
+	for (size_t i = 0; i < values.size(); i++) {
+		out << (i ? ", " : "") << values[i];
+	}
+	out << "]" << (last ? "\n" : ",\n");
+}
+
+void closeBinaryStore(ISF_binary_store_struct &store);
+
+#endif
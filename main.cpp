@@ -5,66 +5,16 @@
 #include <string>
 #include <iostream>
 #include <fstream>
+#include <algorithm>
+#include <functional>
 
 #include "debug.hpp"
+#include "DDM.hpp"
+#include "instrumentation.hpp"
+
+DDMparams params;
+
 
-struct DDMparams {
-	std::string     file_in;
-	std::string     file_out;
-	std::string     q_file_name;	// file-path for q-vector
-	std::string     t_file_name;	// file-path for tau-vector
-	std::string		s_file_name;	// file-path for scale-vector
-	std::string     e_file_name;    // file-path for episode-vector
-
-	int    frame_count;				// number of frames to analyse
-	int    frame_offset     = 0;    // number of frames to skip at start
-	int    x_off 			= 0;    // number of pixels to offset x=0 by in frame
-	int    y_off 			= 0;	// number of pixels to offset y=0 by in frame
-	int    chunk_length		= 30;   // number of frames in frame buffer, default is 30
-	int    rolling_purge	= 0;    // purge and analyse accumulators after number of frames
-
-	bool   use_webcam 		= false;
-	int    webcam_idx 		= 0;
-	bool   use_movie_file	= false;
-	bool   use_index_fps 	= false; // if flag set to false, use frame-indcies not frame-rate
-	bool   use_explicit_fps = false;
-	float  explicit_fps 	= 1.0;
-	bool   multi_stream 	= true;
-	float  q_tolerance		= 1.2;  // tolerance factor for q-vector mask: values between q and q*tolerance are included in the mask
-	bool   benchmark_mode 	= false;
-    bool   use_episodes = false;            // Whether to use time windows from episode file
-	bool enable_angle_analysis = false;   // Whether to enable angle sector analysis, disabled by default
-	int angle_count = 8;                 // Number of angle sections, default is 8
-} params;
-
-// forward declare main DDM function
-void runDDM(std::string file_in,
-            std::string file_out,
-            int *tau_arr,
-            int tau_count,
-            float *lambda_arr,
-            int lambda_count,
-            int *scale_arr,
-            int scale_count,
-            int x_off,
-            int y_off,
-            int *episode_vector,
-            int episode_count,
-            int frame_count,
-            int frame_offset,
-            int chunk_frame_count,
-            bool multistream,
-            bool use_webcam,
-            int webcam_idx,
-            float q_tolerance,
-            bool use_movie_file,
-            bool use_index_fps,
-            bool use_explicit_fps,
-            float explicit_fps,
-            int dump_accum_after,
-            bool benchmark_mode,
-            bool enable_angle_analysis,
-            int angle_count);
 
 void printHelp() {
     fprintf(stderr,
@@ -93,31 +43,59 @@ void printHelp() {
 			"  -v			Verbose mode on.\n"
             "  -Z           Turn off multi-stream (smaller memory footprint - slower execution time).\n"
 			"  -t INT       Set the q-vector mask tolerance - percent (integer only) (default 20 i.e. radial mask (1 - 1.2) * q).\n"
-			"  -C INT	    Set main chunk frame count, a buffer 3x chunk frame count will be allocated in memory (default 30 frames).\n"
+			"  -C INT	    Set main chunk frame count, a buffer 3x chunk frame count will be allocated in memory (default 30 frames, 0 = largest chunk fitting the free device memory).\n"
 			"  -G SIZE      Sub-divide analysis, buffer will be output and purged every SIZE chunks\n"
     		"  -M			Set if using movie-file format.\n"
     		"  -F FPS 		Force the analysis to assume a specific frame-rate, over-rides other options.\n"
             "  -A           Enable angle analysis\n"
             "  -n INT       Set angle count\n"
+            "  -P           Single-pass mode, video is read and FFT'd once for all episode sizes (one accumulator set per episode).\n"
+            "  -D INT       Number of chunks the video reader thread loads ahead of the GPU (default 4, minimum 2).\n"
+            "  -g INT       Number of GPUs to use (default 1), windows (or episodes with -P) are shared out between GPUs.\n"
+            "  -K           Multi-GPU frame-split mode, every window's frames are split between the GPUs and reduced on the first.\n"
+            "  -R PATH      Batch mode, each line of the manifest at PATH is the argument list of one run (see README).\n"
+            "  -H           Half precision FFT, halves the memory of the FFT buffer (8-bit video only, differences still accumulated in single precision).\n"
+            "  -V           Validate half precision, analyse in single and half precision and report the largest relative ISF error (no output written).\n"
+            "  -w           Wiener-Khinchin engine, structure function from a temporal FFT per Fourier pixel, cost almost independent of tau count, tau only limited by window size.\n"
+            "  -m INT       Multi-tau correlator with INT frames per level (even, >= 4), tau values are rounded to the log-spaced multi-tau lags, tau not limited by chunk size.\n"
+            "  -b           Binary output, the ISF of all windows in one float32 file <out>ISF.bin with a JSON description <out>ISF.json.\n"
+            "  -L           Fit A(1-exp(-(Gamma tau)^beta)) + B to every ISF curve on the GPU (Levenberg-Marquardt), parameters written next to the ISF.\n"
+            "  -l INT       Live mode, analyse frames as they arrive over a sliding window of the last INT chunks, an ISF snapshot every -G chunks (default every chunk), -N 0 runs until Ctrl-C (camera).\n"
+            "  -J PATH      Benchmark suite, sweep scale sets, tau counts, chunk sizes, angle analysis and multi-stream on random frames, per-stage timing and roofline report written to PATH (JSON).\n"
+            "  -X PATH      Export the run's counters (frames, bytes H2D, GPU time per stage, queue depths, flushes) to PATH every few seconds, Prometheus text if PATH ends in .prom, JSON otherwise.\n"
+            "  -k SECONDS   Checkpoint the accumulators and the position in the run to <out>checkpoint.bin every SECONDS seconds (removed once the run completes).\n"
+            "  -r           Resume from <out>checkpoint.bin of an interrupted run with the same arguments.\n"
+            "  -p           Map mode, the ISF of every scale and window as one dense [tile_y][tile_x][q][angle][tau] float32 array <out>episode<W>-<i>_scale<S>_map.npy, axes in <out>maps.json.\n"
+            "  -u           Map mode (-p) with a heatmap PNG per scale and q-value (ISF at the largest tau, one cell per tile).\n"
+            "  -O INT       Overlapping tiles, tiles of a scale are scale / INT pixels apart (INT dividing every scale, default 1 = no overlap).\n"
+            "  -j HOP       Sliding windows, a window of every episode size starts every HOP frames (multiple of the chunk size, episode sizes multiples of HOP).\n"
+            "  -U           GPU decoding, compressed videos (MP4, AVI ..) are decoded by NVDEC straight into device memory (build with -DUSE_NVDEC, 8-bit grey).\n"
+            "  -c PATH      Gain map (flat-field), raw samples are multiplied by it per pixel, one row of pixels per line (region read or whole frame).\n"
+            "  -d PATH      Offset map (dark frame), subtracted per pixel before the gain, same format as -c.\n"
+            "  -e WEIGHT    Subtract a running mean background, updated with WEIGHT (0 - 1) per frame, B += WEIGHT * (frame - B).\n"
+            "  -i INT       Bin INT x INT raw pixels into one sample (mean), a region INT times the largest scale wide is read.\n"
             );
 }
 
-////////////////////////////////////////////////////////////////////////////////
-// Program main
-////////////////////////////////////////////////////////////////////////////////
-int main(int argc, char **argv) {
-
-	printf("DDM Start\n");
+///////////////////////////////////////////////////////
+// Fills params from the command line. Can be called more than
+// once (batch manifests), getopt is reset on every call.
+// Returns false if help was requested. Without require_input
+// the input may be left out (engines, frames are passed later).
+///////////////////////////////////////////////////////
+bool parseArguments(int argc, char **argv, DDMparams &params, bool require_input) {
 
     // Flags
     bool input_specified = false;
 
+    optind = 0; // full re-initialisation of getopt
+
     for (;;) {
-        switch (getopt(argc, argv, "ho:N:s:x:y:Q:T:S:E:If:W::vZt:C:MG:F:BAn:")) {
+        switch (getopt(argc, argv, "ho:N:s:x:y:Q:T:S:E:If:W::vZt:C:MG:F:BAn:PD:g:KR:HVwm:bLl:J:X:k:rpuO:j:Uc:d:e:i:")) {
             case '?':
             case 'h':
                 printHelp();
-                return -1;
+                return false;
 
             case 'o':
                 params.file_out = optarg;
@@ -219,6 +197,110 @@ int main(int argc, char **argv) {
              case 'n':
                  params.angle_count = atoi(optarg);
                   continue;
+
+             case 'P':
+                 params.single_pass = true;
+                 continue;
+
+             case 'D':
+                 params.prefetch_depth = atoi(optarg);
+                 continue;
+
+             case 'g':
+                 params.device_count = atoi(optarg);
+                 continue;
+
+             case 'K':
+                 params.split_frames = true;
+                 continue;
+
+             case 'R':
+                 params.manifest_file = optarg;
+                 input_specified = true;
+                 continue;
+
+             case 'H':
+                 params.half_precision = true;
+                 continue;
+
+             case 'V':
+                 params.validate_precision = true;
+                 continue;
+
+             case 'w':
+                 params.wk_engine = true;
+                 continue;
+
+             case 'm':
+                 params.multitau_points = atoi(optarg);
+                 continue;
+
+             case 'b':
+                 params.binary_output = true;
+                 continue;
+
+             case 'L':
+                 params.fit_curves = true;
+                 continue;
+
+             case 'l':
+                 params.live_chunks = atoi(optarg);
+                 continue;
+
+             case 'J':
+                 params.benchmark_suite_file = optarg;
+                 params.benchmark_mode = true;
+                 input_specified = true;
+                 continue;
+
+             case 'X':
+                 params.metrics_file = optarg;
+                 continue;
+
+             case 'k':
+                 params.checkpoint_interval = atoi(optarg);
+                 continue;
+
+             case 'r':
+                 params.resume = true;
+                 continue;
+
+             case 'p':
+                 params.map_output = true;
+                 continue;
+
+             case 'u':
+                 params.map_output = true;
+                 params.map_images = true;
+                 continue;
+
+             case 'O':
+                 params.tile_overlap = atoi(optarg);
+                 continue;
+
+             case 'j':
+                 params.window_hop = atoi(optarg);
+                 continue;
+
+             case 'U':
+                 params.gpu_decode = true;
+                 continue;
+
+             case 'c':
+                 params.preprocess.gain_file = optarg;
+                 continue;
+
+             case 'd':
+                 params.preprocess.offset_file = optarg;
+                 continue;
+
+             case 'e':
+                 params.preprocess.background_weight = atof(optarg);
+                 continue;
+
+             case 'i':
+                 params.preprocess.binning = atoi(optarg);
+                 continue;
         }
         break;
     }
@@ -228,12 +310,19 @@ int main(int argc, char **argv) {
         conditionAssert(false, "An unexpected option was found.", true);
     }
 
-    conditionAssert(input_specified, "Must specify input.", true);
+    conditionAssert(input_specified || !require_input, "Must specify input.", true);
 
     // Angle parameter conversion (input full circle angle count, output half circle angle count for processing)
     // params.angle_count = params.enable_angle_analysis ? (params.angle_count + 1) / 2 : params.angle_count;
-    
-    /////////////////////////////////////////////////////////////////////////////
+
+    return true;
+}
+
+
+///////////////////////////////////////////////////////
+// Reads the lambda, tau, scale and episode files
+///////////////////////////////////////////////////////
+void readParameterFiles(DDMparams &params, parameter_lists_struct &lists) {
 
     std::ifstream q_file(params.q_file_name);
     std::ifstream t_file(params.t_file_name);
@@ -247,83 +336,57 @@ int main(int argc, char **argv) {
     
     /// Read scale, lambda, tau and episode values
 
-    // First count number of elements in each file
-    
-    int tau_count = 0;
-    int lambda_count = 0;
-    int scale_count = 0;
-    int episode_count = 0;
-
     float tmp_q;
     while (q_file >> tmp_q) {
-        lambda_count++;
+        lists.lambda.push_back(tmp_q);
     }
-    
+
     int tmp_tau;
     while (t_file >> tmp_tau) {
-        tau_count++;
+        lists.tau.push_back(tmp_tau);
     }
-    
+
     int tmp_scale;
     while (s_file >> tmp_scale) {
-        scale_count++;
+        lists.scale.push_back(tmp_scale);
     }
-    
+
     int tmp_episode;
     while (e_file >> tmp_episode) {
-        episode_count++;
+        lists.episode.push_back(tmp_episode);
     }
-    
-    // Seek back to the beginning of the file and read the values
-    
-    q_file.clear();
-    q_file.seekg(0, std::ios::beg);
-    t_file.clear();
-    t_file.seekg(0, std::ios::beg);
-    s_file.clear();
-    s_file.seekg(0, std::ios::beg);
-    e_file.clear();
-    e_file.seekg(0, std::ios::beg);
-    
-    float lambda_arr[lambda_count];
-    int tau_arr[tau_count];
-    int scale_arr[scale_count];
-    int episode_arr[episode_count];
 
-    int idx;
+    q_file.close();
+    t_file.close();
+    s_file.close();
+    e_file.close();
+
+    // Same order runDDM sorts into, so episode indices match between callers and runDDM
+    std::sort(lists.tau.begin(), lists.tau.end());
+    std::sort(lists.lambda.begin(), lists.lambda.end());
+    std::sort(lists.scale.begin(), lists.scale.end(), std::greater<int>());
+    std::sort(lists.episode.begin(), lists.episode.end());
+}
+
+
+void runFromParams(DDMparams &params, parameter_lists_struct &lists,
+                   int only_episode, int window_begin, int window_end,
+                   const ISF_sink_function &sink,
+                   benchmark_report_struct *report,
+                   const engine_run_struct *engine) {
 
-    idx = 0;
-    while (q_file >> tmp_q) {
-        lambda_arr[idx++] = tmp_q;
-    }
-    
-    idx = 0;
-    while (t_file >> tmp_tau) {
-        tau_arr[idx++] = tmp_tau;
-    }
-    
-    idx = 0;
-    while (s_file >> tmp_scale) {
-        scale_arr[idx++] = tmp_scale;
-    }
-    
-    idx = 0;
-    while (e_file >> tmp_episode) {
-        episode_arr[idx++] = tmp_episode;
-    }
-    
     runDDM(params.file_in,
            params.file_out,
-           tau_arr,
-           tau_count,
-           lambda_arr,
-           lambda_count,
-           scale_arr,
-           scale_count,
+           lists.tau.data(),
+           lists.tau.size(),
+           lists.lambda.data(),
+           lists.lambda.size(),
+           lists.scale.data(),
+           lists.scale.size(),
            params.x_off,
            params.y_off,
-           episode_arr,
-           episode_count,
+           lists.episode.data(),
+           lists.episode.size(),
            params.frame_count,
            params.frame_offset,
            params.chunk_length,
@@ -338,17 +401,71 @@ int main(int argc, char **argv) {
            params.rolling_purge,
            params.benchmark_mode,
            params.enable_angle_analysis,
-           params.angle_count);
-    
+           params.angle_count,
+           params.single_pass,
+           params.prefetch_depth,
+           params.device_count,
+           params.split_frames,
+           only_episode,
+           window_begin,
+           window_end,
+           sink,
+           params.half_precision,
+           params.validate_precision,
+           params.wk_engine,
+           params.multitau_points,
+           params.binary_output,
+           params.fit_curves,
+           params.live_chunks,
+           params.checkpoint_interval,
+           params.resume,
+           params.map_output,
+           params.map_images,
+           params.tile_overlap,
+           params.window_hop,
+           params.gpu_decode,
+           params.preprocess,
+           report,
+           engine);
+}
+
+
+////////////////////////////////////////////////////////////////////////////////
+// Program main, left out of the shared library build (-DDDM_LIBRARY)
+////////////////////////////////////////////////////////////////////////////////
+#ifndef DDM_LIBRARY
+int main(int argc, char **argv) {
+
+	printf("DDM Start\n");
+
+    if (!parseArguments(argc, argv, params, true))
+        return -1;
+
+    if (!params.metrics_file.empty())
+        startMetricsExport(params.metrics_file);
+
+    int ret = 0;
+
+    if (!params.manifest_file.empty()) {
+        ret = runBatch(params, &argc, &argv);
+    } else {
+        parameter_lists_struct lists;
+        readParameterFiles(params, lists);
+
+        if (!params.benchmark_suite_file.empty()) {
+            ret = runBenchmarkSuite(params, lists);
+        } else {
+            runFromParams(params, lists, -1, 0, 0, ISF_sink_function(), NULL, NULL);
+        }
+    }
+
+    stopMetricsExport();
+
+    if (!params.manifest_file.empty() || !params.benchmark_suite_file.empty())
+        return ret;
 
     printf("DDM End\n");
-    
-    q_file.close();
-    t_file.close();
-    s_file.close();
-    e_file.close();
 
     return 0;
 }
-
-
+#endif
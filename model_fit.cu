@@ -0,0 +1,93 @@
+//////////////////////////////////////
+//  GPU fitting of the ISF curves, see model_fit_kernel.cuh
+//////////////////////////////////////
+
+#include <string>
+#include <iostream>
+#include <fstream>
+#include <cmath>
+
+#include "constants.hpp"
+#include "debug.hpp"
+#include "model_fit.cuh"
+#include "model_fit_kernel.cuh"
+
+///////////////////////////////////////////////////////
+// Fits the model to the curve_count ISF curves of d_ISF
+// (tau_count values each, tau in seconds in d_tau) in a
+// single launch, the parameters are left in d_fit.
+///////////////////////////////////////////////////////
+void fitISFDevice(const float *d_ISF,
+                  float *d_fit,
+                  const float *d_tau,
+                  int curve_count,
+                  int tau_count,
+                  cudaStream_t stream) {
+
+    dim3 dimBlock(FIT_BLOCKSIZE, 1, 1);
+    dim3 dimGrid((curve_count + FIT_BLOCKSIZE - 1) / FIT_BLOCKSIZE, 1, 1);
+
+    kernelFitISF<<<dimGrid, dimBlock, sizeof(float) * tau_count, stream>>>(d_ISF, d_fit, d_tau, curve_count, tau_count);
+    gpuErrorCheck(cudaPeekAtLastError());
+}
+
+
+///////////////////////////////////////////////////////
+//	Writes the fit parameters of one tile, fit[ring][param],
+//  in the format of the fitting.py parameter files.
+///////////////////////////////////////////////////////
+void writeFitToFile(std::string filename,
+                    const float *fit,
+                    const float *lambda_arr, int lambda_count,
+                    bool enable_angle_analysis,
+                    int angle_count) {
+
+    std::ofstream out(filename);
+
+    if (!out.is_open()) {
+        fprintf(stderr, "[Out Error] Unable to open %s.\n", filename.c_str());
+        exit(EXIT_FAILURE);
+    }
+
+    const char *param_names[FIT_PARAM_COUNT] = {"A", "Gamma", "beta", "B"};
+    int section_count = enable_angle_analysis ? angle_count : 1;
+    char line[256];
+
+    out << "Fitting model: $I(q,\\tau) = A(1-e^{-(\\Gamma\\tau)^{\\beta}}) + B$\n\n";
+
+    for (int angle_idx = 0; angle_idx < section_count; angle_idx++) {
+        if (enable_angle_analysis) {
+            float angle_width = 180.0f / angle_count;
+            snprintf(line, sizeof(line), "Angle %d: Center %.1f°, Range: %.1f° to %.1f°\n", angle_idx,
+                     angle_idx * angle_width - 90.0f + angle_width / 2, angle_idx * angle_width - 90.0f, (angle_idx + 1) * angle_width - 90.0f);
+        } else {
+            snprintf(line, sizeof(line), "Radial Average\n");
+        }
+        out << line;
+
+        snprintf(line, sizeof(line), "%-10s", "q (2π/λ)");
+        out << line;
+        for (int k = 0; k < FIT_PARAM_COUNT; k++) {
+            snprintf(line, sizeof(line), " %-10s", param_names[k]);
+            out << line;
+        }
+        out << "\n" << std::string(11 + 11 * FIT_PARAM_COUNT, '-') << "\n";
+
+        for (int li = 0; li < lambda_count; li++) {
+            const float *p = fit + (li * section_count + angle_idx) * FIT_PARAM_COUNT;
+            if (std::isnan(p[0])) // flat curve, not fitted
+                continue;
+
+            snprintf(line, sizeof(line), "%-10.2f", 2.0 * M_PI / lambda_arr[li]);
+            out << line;
+            for (int k = 0; k < FIT_PARAM_COUNT; k++) {
+                snprintf(line, sizeof(line), " %-10.3f", p[k]);
+                out << line;
+            }
+            out << "\n";
+        }
+        out << "\n\n";
+    }
+
+    verbose("Fit parameters written to %s\n", filename.c_str());
+}
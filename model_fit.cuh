@@ -0,0 +1,20 @@
+#include <string>
+#include <cuda_runtime.h>
+
+#ifndef _MODEL_FIT_
+#define _MODEL_FIT_
+
+void fitISFDevice(const float *d_ISF,
+				  float *d_fit,
+				  const float *d_tau,
+				  int curve_count,
+				  int tau_count,
+				  cudaStream_t stream);
+
+void writeFitToFile(std::string filename,
+					const float *fit,
+					const float *lambda_arr, int lambda_count,
+					bool enable_angle_analysis,
+					int angle_count);
+
+#endif
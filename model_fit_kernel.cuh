@@ -0,0 +1,193 @@
+//////////////////////////////////////
+//  Batched Levenberg-Marquardt fit of the ISF model
+//  I(q, tau) = A (1 - exp(-(Gamma tau)^beta)) + B
+//  one thread fits one curve (scale, tile, ring), the
+//  parameters are kept inside the box bounds used by
+//  fitting.py by projecting every step onto them
+//////////////////////////////////////
+
+#include <stdio.h>
+#include <cuda_runtime.h>
+
+#include "constants.hpp"
+
+#ifndef MODEL_FIT_KERNEL
+#define MODEL_FIT_KERNEL
+
+///////////////////////////////////////////////////////
+// Model value at [tau] for parameters p = (A, Gamma, beta, B),
+// fills the partial derivatives into [jac] when it is not NULL
+///////////////////////////////////////////////////////
+__device__ __forceinline__ float fitModel(float tau, const float *p, float *jac) {
+    float x = p[1] * tau;
+    float u = (x > 0.0f) ? powf(x, p[2]) : 0.0f;
+    float e = expf(-u);
+
+    if (jac != NULL) {
+        jac[0] = 1.0f - e;
+        jac[1] = (x > 0.0f) ? p[0] * e * u * p[2] / p[1] : 0.0f;
+        jac[2] = (x > 0.0f) ? p[0] * e * u * logf(x) : 0.0f;
+        jac[3] = 1.0f;
+    }
+
+    return p[0] * (1.0f - e) + p[3];
+}
+
+
+__device__ __forceinline__ float fitCost(const float *y, const float *tau, int tau_count, const float *p) {
+    float cost = 0.0f;
+    for (int t = 0; t < tau_count; t++) {
+        float r = y[t] - fitModel(tau[t], p, NULL);
+        cost += r * r;
+    }
+    return cost;
+}
+
+
+///////////////////////////////////////////////////////
+// Solves the 4 x 4 symmetric positive definite system
+// M x = b by Cholesky decomposition, false if M is singular
+///////////////////////////////////////////////////////
+__device__ __forceinline__ bool solveNormal4(float M[FIT_PARAM_COUNT][FIT_PARAM_COUNT], const float *b, float *x) {
+    float L[FIT_PARAM_COUNT][FIT_PARAM_COUNT];
+
+    for (int i = 0; i < FIT_PARAM_COUNT; i++) {
+        for (int j = 0; j <= i; j++) {
+            float sum = M[i][j];
+            for (int k = 0; k < j; k++)
+                sum -= L[i][k] * L[j][k];
+
+            if (i == j) {
+                if (sum <= 0.0f)
+                    return false;
+                L[i][i] = sqrtf(sum);
+            } else {
+                L[i][j] = sum / L[j][j];
+            }
+        }
+    }
+
+    float z[FIT_PARAM_COUNT];
+    for (int i = 0; i < FIT_PARAM_COUNT; i++) {
+        float sum = b[i];
+        for (int k = 0; k < i; k++)
+            sum -= L[i][k] * z[k];
+        z[i] = sum / L[i][i];
+    }
+    for (int i = FIT_PARAM_COUNT - 1; i >= 0; i--) {
+        float sum = z[i];
+        for (int k = i + 1; k < FIT_PARAM_COUNT; k++)
+            sum -= L[k][i] * x[k];
+        x[i] = sum / L[i][i];
+    }
+    return true;
+}
+
+
+///////////////////////////////////////////////////////
+// Fits curve [blockIdx.x * blockDim.x + threadIdx.x] of
+// d_ISF (tau_count values each) and writes its parameters
+// to d_fit[curve][FIT_PARAM_COUNT], NaN if the curve is
+// flat. Initial values and bounds follow fitting.py.
+///////////////////////////////////////////////////////
+__global__ void kernelFitISF(const float * __restrict__ d_ISF,
+                             float *d_fit,
+                             const float * __restrict__ d_tau,
+                             int curve_count,
+                             int tau_count) {
+
+    extern __shared__ float s_tau[];
+
+    for (int t = threadIdx.x; t < tau_count; t += blockDim.x)
+        s_tau[t] = d_tau[t];
+    __syncthreads();
+
+    int curve = blockIdx.x * blockDim.x + threadIdx.x;
+    if (curve >= curve_count)
+        return;
+
+    const float *y = d_ISF + static_cast<size_t>(curve) * tau_count;
+    float *out = d_fit + static_cast<size_t>(curve) * FIT_PARAM_COUNT;
+
+    float y_min = y[0];
+    float y_max = y[0];
+    for (int t = 1; t < tau_count; t++) {
+        y_min = fminf(y_min, y[t]);
+        y_max = fmaxf(y_max, y[t]);
+    }
+
+    float A_init = y_max - y_min;
+    float B_init = y_min;
+    float tau_mid = s_tau[tau_count / 2];
+    float Gamma_init = (tau_mid > 0.0f && A_init > 1e-6f) ? 1.0f / tau_mid : 1.0f;
+
+    if (!(A_init > 0.0f)) { // degenerate bounds, fitting.py skips these curves too
+        for (int k = 0; k < FIT_PARAM_COUNT; k++)
+            out[k] = nanf("");
+        return;
+    }
+
+    float p[FIT_PARAM_COUNT]  = {A_init, Gamma_init, 1.0f, B_init};
+    float lo[FIT_PARAM_COUNT] = {0.5f * A_init, 0.1f * Gamma_init, 0.5f, B_init - 0.1f};
+    float hi[FIT_PARAM_COUNT] = {1.5f * A_init, 10.0f * Gamma_init, 2.0f, B_init + 0.1f};
+
+    float cost = fitCost(y, s_tau, tau_count, p);
+    float damping = FIT_INITIAL_DAMPING;
+
+    for (int it = 0; it < FIT_MAX_ITERATIONS; it++) {
+        // normal equations J^T J and J^T r at the current parameters
+        float JTJ[FIT_PARAM_COUNT][FIT_PARAM_COUNT] = {};
+        float JTr[FIT_PARAM_COUNT] = {};
+
+        for (int t = 0; t < tau_count; t++) {
+            float jac[FIT_PARAM_COUNT];
+            float r = y[t] - fitModel(s_tau[t], p, jac);
+
+            for (int i = 0; i < FIT_PARAM_COUNT; i++) {
+                JTr[i] += jac[i] * r;
+                for (int j = 0; j <= i; j++)
+                    JTJ[i][j] += jac[i] * jac[j];
+            }
+        }
+
+        bool accepted = false;
+        float new_cost = cost;
+
+        // raise the damping until a step lowers the cost
+        for (int attempt = 0; attempt < FIT_MAX_DAMPING_STEPS && !accepted; attempt++) {
+            float M[FIT_PARAM_COUNT][FIT_PARAM_COUNT];
+            for (int i = 0; i < FIT_PARAM_COUNT; i++) {
+                for (int j = 0; j <= i; j++)
+                    M[i][j] = M[j][i] = JTJ[i][j];
+                M[i][i] += damping * fmaxf(JTJ[i][i], 1e-20f);
+            }
+
+            float step[FIT_PARAM_COUNT];
+            float trial[FIT_PARAM_COUNT];
+
+            if (solveNormal4(M, JTr, step)) {
+                for (int k = 0; k < FIT_PARAM_COUNT; k++)
+                    trial[k] = fminf(fmaxf(p[k] + step[k], lo[k]), hi[k]);
+
+                new_cost = fitCost(y, s_tau, tau_count, trial);
+
+                if (new_cost < cost) {
+                    for (int k = 0; k < FIT_PARAM_COUNT; k++)
+                        p[k] = trial[k];
+                    accepted = true;
+                }
+            }
+
+            damping = accepted ? fmaxf(damping * 0.1f, 1e-10f) : damping * 10.0f;
+        }
+
+        if (!accepted || (cost - new_cost) <= FIT_TOLERANCE * cost)
+            break;
+        cost = new_cost;
+    }
+
+    for (int k = 0; k < FIT_PARAM_COUNT; k++)
+        out[k] = p[k];
+}
+
+#endif
@@ -11,15 +11,21 @@
 #include <stdint.h>
 #include <stdio.h>
 #include <stdlib.h>
-#include <nvToolsExt.h>
+#include <string.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
 #include <opencv4/opencv2/opencv.hpp>
 
 #include <iostream>
 #include <string>
 #include <fstream>
+#include <algorithm>
 
 #include "video_reader.hpp"
 #include "debug.hpp"
+#include "instrumentation.hpp"
 
 void loadMovieToHost(FILE *moviefile,        unsigned char *h_buffer, video_info_struct info, int frame_count);
 void loadCaptureToHost(cv::VideoCapture cap, unsigned char *h_buffer, video_info_struct info, int frame_count);
@@ -217,6 +223,8 @@ video_info_struct initFile(FILE *moviefile, int frame_offset) {
     out.type = camera_frame.type;
     out.length = camera_frame.length_data;
     out.bpp = (camera_frame.pixelmode == CAMERA_PIXELMODE_MONO_8) ? 1 : 2;
+    out.bytes_per_sample = out.bpp;
+    out.big_endian = (camera_frame.pixelmode == CAMERA_PIXELMODE_MONO_16BE);
 
     uint64_t frame_time = time_one - time_zero; // frame time (microseconds)
     out.fps = 1.0e6 / static_cast<float>(frame_time);
@@ -231,7 +239,7 @@ video_info_struct initFile(FILE *moviefile, int frame_offset) {
 //  unexpected than repeat slow file manipulation from initialise phase.
 ///////////////////////////////////////////////////////
 void loadMovieToHost(FILE *moviefile, unsigned char *h_buffer, video_info_struct info, int frame_count) {
-    nvtxRangePush(__FUNCTION__); // Nvidia profiling option (for use in nvvp)
+    profileRangePush(PROFILE_LOAD, __FUNCTION__); // NVTX range of the multiDDM domain (nsys / nvvp)
 
     int frame_index = 0;
 
@@ -271,30 +279,204 @@ void loadMovieToHost(FILE *moviefile, unsigned char *h_buffer, video_info_struct
 				break;
 			}
 
-        unsigned char *h_current = h_buffer + info.w * info.h * info.bpp * frame_index;
+        unsigned char *h_current = h_buffer + frameBytes(info) * frame_index;
 
-        // Read data
-        if (fread(h_current, info.length, 1, moviefile) != 1) {
-            fprintf(stderr, "[.moviefile Read Error] Corrupted data at offset %lu\n", ftell(moviefile));
-            exit(EXIT_FAILURE);
+        // Read data, only the rows / columns of the region of interest are kept
+        long data_start = ftell(moviefile);
+        size_t row_bytes = static_cast<size_t>(info.roi_w) * info.bpp;
+
+        for (int y = 0; y < info.roi_h; y++) {
+            fseek(moviefile, data_start + (static_cast<long>(y + info.y_off) * info.w + info.x_off) * info.bpp, SEEK_SET);
+
+            if (fread(h_current + y * row_bytes, row_bytes, 1, moviefile) != 1) {
+                fprintf(stderr, "[.moviefile Read Error] Corrupted data at offset %lu\n", ftell(moviefile));
+                exit(EXIT_FAILURE);
+            }
         }
+        fseek(moviefile, data_start + info.length, SEEK_SET);
         frame_index++;
     }
-    nvtxRangePop();
+    profileRangePop();
+}
+
+
+///////////////////////////////////////////////////////
+//  Maps the whole movie-file and walks the frame headers once, storing the
+//  offset of each frame's image data. Any frame can then be read without
+//  seeking or re-parsing headers. Header lengths are those used by initFile.
+///////////////////////////////////////////////////////
+void openMovieIndex(movie_index_struct &index, const char *filename, video_info_struct info) {
+    index.fd = open(filename, O_RDONLY);
+    conditionAssert(index.fd >= 0, "couldn't open .movie file for mapping", true);
+
+    struct stat file_stat;
+    conditionAssert(fstat(index.fd, &file_stat) == 0, "couldn't stat .movie file", true);
+    index.file_size = static_cast<size_t>(file_stat.st_size);
+
+    void *map = mmap(NULL, index.file_size, PROT_READ, MAP_SHARED, index.fd, 0);
+    conditionAssert(map != MAP_FAILED, "couldn't memory-map .movie file", true);
+    index.map = static_cast<unsigned char *>(map);
+
+    madvise(index.map, index.file_size, MADV_SEQUENTIAL);
+
+    size_t header_length;
+    switch (info.type) {
+        case CAMERA_TYPE_IIDC:  header_length = IIDC_MOVIE_HEADER_LENGTH;  break;
+        case CAMERA_TYPE_ANDOR: header_length = ANDOR_MOVIE_HEADER_LENGTH; break;
+        case CAMERA_TYPE_XIMEA: header_length = XIMEA_MOVIE_HEADER_LENGTH; break;
+        default:
+            fprintf(stderr, "[Movie-file Index Error] Unsupported camera type.\n");
+            exit(EXIT_FAILURE);
+    }
+
+    // Locate start of first header using magic value
+    size_t pos = 0;
+    uint32_t magic_val;
+    while (pos + sizeof(uint32_t) <= index.file_size) {
+        memcpy(&magic_val, index.map + pos, sizeof(uint32_t));
+        if (magic_val == CAMERA_MOVIE_MAGIC)
+            break;
+        pos++;
+    }
+
+    // Upper bound on the frame count, frames are at least header + data long
+    size_t max_frames = index.file_size / (header_length + info.length) + 1;
+    index.frame_offsets = new size_t[max_frames];
+    index.frame_count = 0;
+
+    camera_save_struct camera_frame;
+    while (pos + header_length <= index.file_size && static_cast<size_t>(index.frame_count) < max_frames) {
+        memcpy(&camera_frame, index.map + pos, sizeof(struct camera_save_struct));
+
+        if (camera_frame.magic != CAMERA_MOVIE_MAGIC || pos + header_length + camera_frame.length_data > index.file_size)
+            break; // truncated final frame or trailing data
+
+        if (camera_frame.length_data != info.length) {
+            fprintf(stderr, "[Movie-file Index Error] Frame %d has unexpected data length %u\n", index.frame_count, camera_frame.length_data);
+            exit(EXIT_FAILURE);
+        }
+
+        index.frame_offsets[index.frame_count++] = pos + header_length;
+        pos += header_length + camera_frame.length_data;
+    }
+
+    verbose("[Movie-file Index] %d frames indexed\n", index.frame_count);
+}
+
+
+void closeMovieIndex(movie_index_struct &index) {
+    munmap(index.map, index.file_size);
+    close(index.fd);
+    delete[] index.frame_offsets;
+}
+
+
+///////////////////////////////////////////////////////
+//  Copies the region of interest of frames [first_frame, first_frame + frame_count)
+//  (absolute frame numbers) from the mapped movie-file straight into the (pinned)
+//  host buffer.
+///////////////////////////////////////////////////////
+void loadIndexedMovieToHost(movie_index_struct &index, unsigned char *h_buffer, video_info_struct info, int first_frame, int frame_count) {
+    profileRangePush(PROFILE_LOAD, __FUNCTION__); // NVTX range of the multiDDM domain (nsys / nvvp)
+
+    if (first_frame + frame_count > index.frame_count) {
+        fprintf(stderr, "[.moviefile Read Error] Frame %d requested, file holds %d frames\n", first_frame + frame_count - 1, index.frame_count);
+        exit(EXIT_FAILURE);
+    }
+
+    // Let the kernel start reading the frames after this chunk
+    int ahead_last = std::min(first_frame + 2 * frame_count, index.frame_count) - 1;
+    if (ahead_last >= first_frame + frame_count) {
+        size_t page = static_cast<size_t>(sysconf(_SC_PAGESIZE));
+        size_t ahead_begin = index.frame_offsets[first_frame + frame_count] & ~(page - 1);
+        size_t ahead_end = index.frame_offsets[ahead_last] + info.length;
+        madvise(index.map + ahead_begin, ahead_end - ahead_begin, MADV_WILLNEED);
+    }
+
+    size_t row_bytes = static_cast<size_t>(info.roi_w) * info.bpp;
+
+    for (int frame_index = 0; frame_index < frame_count; frame_index++) {
+        unsigned char *h_current = h_buffer + frameBytes(info) * frame_index;
+        const unsigned char *frame = index.map + index.frame_offsets[first_frame + frame_index];
+
+        // Only the region of interest is copied
+        for (int y = 0; y < info.roi_h; y++) {
+            memcpy(h_current + y * row_bytes, frame + (static_cast<size_t>(y + info.y_off) * info.w + info.x_off) * info.bpp, row_bytes);
+        }
+    }
+
+    profileRangePop();
+}
+
+
+///////////////////////////////////////////////////////
+//  Copies the region of interest of frames [first_frame, first_frame + frame_count)
+//  of a contiguous array of w x h frames in host memory (engine input, e.g. a NumPy
+//  stack) into the (pinned) host buffer. Only the crop is copied, the frames are
+//  read in place.
+///////////////////////////////////////////////////////
+void loadHostFramesToHost(const unsigned char *frames, unsigned char *h_buffer, video_info_struct info, int first_frame, int frame_count) {
+    profileRangePush(PROFILE_LOAD, __FUNCTION__); // NVTX range of the multiDDM domain (nsys / nvvp)
+
+    size_t row_bytes   = static_cast<size_t>(info.roi_w) * info.bpp;
+    size_t frame_bytes = static_cast<size_t>(info.w) * info.h * info.bpp;
+
+    for (int frame_index = 0; frame_index < frame_count; frame_index++) {
+        unsigned char *h_current = h_buffer + frameBytes(info) * frame_index;
+        const unsigned char *frame = frames + frame_bytes * (first_frame + frame_index);
+
+        for (int y = 0; y < info.roi_h; y++) {
+            memcpy(h_current + y * row_bytes, frame + (static_cast<size_t>(y + info.y_off) * info.w + info.x_off) * info.bpp, row_bytes);
+        }
+    }
+
+    profileRangePop();
+}
+
+
+///////////////////////////////////////////////////////
+//  Reads a per-pixel map (gain / offset, one row of pixels per line) for the region
+//  of interest. A map of the whole frame is cropped at the offset, a map of the
+//  region of interest is taken as it is.
+///////////////////////////////////////////////////////
+std::vector<float> loadPixelMap(const std::string &path, video_info_struct info) {
+    std::ifstream map_file(path);
+    conditionAssert(map_file.is_open(), "cannot open pixel map " + path, true);
+
+    std::vector<float> values;
+    float value;
+    while (map_file >> value) {
+        values.push_back(value);
+    }
+
+    size_t roi_pixels   = static_cast<size_t>(info.roi_w) * info.roi_h;
+    size_t frame_pixels = static_cast<size_t>(info.w) * info.h;
+
+    if (values.size() == roi_pixels)
+        return values;
+
+    conditionAssert(values.size() == frame_pixels, "pixel map " + path + " matches neither the frame nor the region read", true);
+
+    std::vector<float> crop(roi_pixels);
+    for (int y = 0; y < info.roi_h; y++) {
+        std::copy_n(values.begin() + static_cast<size_t>(y + info.y_off) * info.w + info.x_off, info.roi_w,
+                    crop.begin() + static_cast<size_t>(y) * info.roi_w);
+    }
+    return crop;
 }
 
 
 // OpenCV video reader
 
 ///////////////////////////////////////////////////////
-//	This function takes a openCV video capture and loads a specified number of frames into a given uchar
-//	pointer. The pointer must have a size at least [img.cols * img.rows * img.channels * frame_count]
+//	This function takes a openCV video capture and loads the region of interest of a specified number of
+//	frames into a given uchar pointer. The pointer must have a size at least [roi_w * roi_h * img.channels * frame_count]
 //	If the frame is continuous in memory and each element is a uchar (i.e. Mat type 0, 8, 16, 24) then we
 //	can do a direct memory copy. However if the image type is more complicated we do a much more time costly
 //	iteration over the whole image. As we deal with uchars only - can lose image fidelity!
 ///////////////////////////////////////////////////////
 void loadCaptureToHost(cv::VideoCapture cap, unsigned char *h_buffer, video_info_struct info, int frame_count) {
-    nvtxRangePush(__FUNCTION__);  // Nvidia profiling option (for use in nvvp)
+    profileRangePush(PROFILE_LOAD, __FUNCTION__); // NVTX range of the multiDDM domain (nsys / nvvp)
 
     cv::Mat img;
 
@@ -305,24 +487,29 @@ void loadCaptureToHost(cv::VideoCapture cap, unsigned char *h_buffer, video_info
 
         int base_type = img.type() % 8;
 
-        if (img.isContinuous() && base_type == 0) {
-            // We have the simplest case that the image is a (multi-channel) uchar array in continuous memory
-            int frame_bytes = img.cols * img.rows * img.elemSize();
-            memcpy(h_buffer + frame_idx * frame_bytes, img.data, frame_bytes);
+        if (base_type == 0 || (base_type == 2 && info.bytes_per_sample == 2)) {
+            // We have the simplest case that the image is a (multi-channel) uchar array or a native
+            // 16-bit one, copy the region of interest row by row
+            size_t row_bytes = static_cast<size_t>(info.roi_w) * img.elemSize();
+            unsigned char *h_frame = h_buffer + frame_idx * info.roi_h * row_bytes;
+
+            for (int y = 0; y < info.roi_h; y++) {
+                memcpy(h_frame + y * row_bytes, img.ptr(y + info.y_off) + info.x_off * img.elemSize(), row_bytes);
+            }
         } else {
             // If not simple case then we must directly iterate across image data array.
             // Slight speed up as only need consider out image dimensions (not full frame)
             // TODO: Not heavily tested as these video types not common.
-            int width = info.w;
-            int height = info.h;
-            int frame_elements = img.cols * img.rows;
+            int width = info.roi_w;
+            int height = info.roi_h;
+            int frame_elements = width * height;
 
-            int idx, oidx;
-            for (int y = 0; y < height; y++) {
-                for (int x = 0; x < width; x++) {
-                    idx = ((img.step) / img.elemSize1()) * y
-                            + img.channels() * x;
-                    oidx = frame_idx * frame_elements + y * img.cols + x;
+            int oidx;
+            for (int yy = 0; yy < height; yy++) {
+                for (int xx = 0; xx < width; xx++) {
+                    int y = yy + info.y_off;
+                    int x = xx + info.x_off;
+                    oidx = frame_idx * frame_elements + yy * width + xx;
 
                     switch (base_type) {// Note funky {} to allow redeclare of "data" var-name
                     case 1:  // CV_8S
@@ -374,7 +561,7 @@ void loadCaptureToHost(cv::VideoCapture cap, unsigned char *h_buffer, video_info
         }
     }
 
-    nvtxRangePop();
+    profileRangePop();
 }
 
 
@@ -4,6 +4,7 @@
 #include <iostream>
 #include <string>
 #include <fstream>
+#include <vector>
 
 #include <opencv2/opencv.hpp>
 
@@ -16,18 +17,45 @@ struct video_info_struct {
     int h;
     int x_off = 0;
     int y_off = 0;
+    int roi_w = 0;		// Region of interest at (x_off, y_off), only this part of
+    int roi_h = 0;		// each frame is loaded to host and copied to device
     int bpp; 			// Bytes-per-pixel
+    int bytes_per_sample = 1;	// 1 (uchar) or 2 (uint16), channels per pixel = bpp / bytes_per_sample
+    bool big_endian = false;	// 16-bit samples stored big-endian (MONO_16BE)
     float fps = 1.0;
     uint32_t type; 		// Camera type
     uint32_t length;	// Total length of data in bytes
 };
 
+// Memory-mapped movie-file with the byte offset of every frame's
+// image data, built once when the file is opened
+struct movie_index_struct {
+    int fd;
+    unsigned char *map;
+    size_t file_size;
+    int frame_count;
+    size_t *frame_offsets;
+};
+
+// Bytes of one (cropped) frame in host and device chunk buffers
+inline size_t frameBytes(const video_info_struct &info) {
+    return static_cast<size_t>(info.roi_w) * info.roi_h * info.bpp;
+}
+
 void loadMovieToHost(FILE *mv, unsigned char *h_buff, video_info_struct vid_info, int frame_count);
 void loadCaptureToHost(cv::VideoCapture cap, unsigned char *h_buffer, video_info_struct info, int frame_count);
 void loadVideoToHost(bool is_movie_file, FILE *mv, cv::VideoCapture cap, unsigned char *h_buff, video_info_struct info, int frame_count, bool benchmark_mode);
 
 video_info_struct initFile(FILE *moviefile, int frame_offset);
 
+void openMovieIndex(movie_index_struct &index, const char *filename, video_info_struct info);
+void closeMovieIndex(movie_index_struct &index);
+void loadIndexedMovieToHost(movie_index_struct &index, unsigned char *h_buff, video_info_struct info, int first_frame, int frame_count);
+void loadHostFramesToHost(const unsigned char *frames, unsigned char *h_buff, video_info_struct info, int first_frame, int frame_count);
+
+// Per-pixel map of the region of interest, read from a text file of the region or the whole frame
+std::vector<float> loadPixelMap(const std::string &path, video_info_struct info);
+
 // Common camera frame struct
 struct camera_save_struct {
     // Common stuff